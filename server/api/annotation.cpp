@@ -1,5 +1,7 @@
 #include "api.hpp"
 #include "../utils.hpp"
+#include "../index/annotation_index.hpp"
+#include "../cache/annotation_cache.hpp"
 
 using namespace postgres;
 using namespace utils;
@@ -9,20 +11,17 @@ class AnnotationHandler : public RequestHandler
 private:
   ConnectionPool &pool;
 
-  struct RangeOccupancies
-  {
-    int *ranges;
-    size_t size;
-  };
-
   /**
    * Select annotation data from the database. This will return the annotation ID,
    * annotation description, dislikes, likes, creation date and author ID of the annotations
    * at a given starting and ending point in the text (assuming there are matches).
+   * The matching annotations are found in the annotation index, so a window
+   * without annotations never reaches the database.
    *
    * @param text_id ID of the text to select annotations from.
    * @param start Start position of the annotation.
    * @param end End position of the annotation.
+   * @param session_id Session of the reader, so their own recent writes are visible.
    * @return JSON of annotation data.
    *
    * @example
@@ -45,16 +44,28 @@ private:
    * Multiple annotations may be returned if there are multiple
    * annotations within the given range.
    */
-  nlohmann::json select_annotation_data(int text_id, int start, int end)
+  nlohmann::json select_annotation_data(int text_id, int start, int end, std::string_view session_id)
   {
     nlohmann::json annotation_info = nlohmann::json::array();
     Logger::instance().debug("Selecting annotation data for text_id=" + std::to_string(text_id) + ", start=" + std::to_string(start) + ", end=" + std::to_string(end));
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      std::vector<annotation_index::Interval> matches = annotation_index::get_annotation_index().within(text_id, start, end);
+      if (matches.empty())
+      {
+        Logger::instance().info("No annotations found for text_id=" + std::to_string(text_id));
+        return annotation_info;
+      }
+      std::string ids;
+      for (const annotation_index::Interval &match : matches)
+      {
+        ids += (ids.empty() ? "" : ",") + std::to_string(match.id);
+      }
+
+      request::PooledTxn txn = request::begin_read_transaction(session_id);
       pqxx::result r = txn.exec_prepared(
           "select_annotation_data",
-          std::to_string(text_id), std::to_string(start), std::to_string(end));
+          text_id, "{" + ids + "}");
       try
       {
         txn.commit();
@@ -93,7 +104,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_author_id_by_annotation", annotation_id);
       try
@@ -124,14 +135,15 @@ private:
    *
    * @param annotation_id ID of the annotation to update.
    * @param description New description of the annotation.
+   * @param session_id Session making the write, for read-your-writes.
    * @return true if the annotation was updated, false otherwise.
    */
-  bool update_annotation(int annotation_id, std::string description)
+  bool update_annotation(int annotation_id, std::string description, std::string_view session_id)
   {
     Logger::instance().debug("Updating annotation id=" + std::to_string(annotation_id));
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool, session_id);
       pqxx::result r = txn.exec_prepared(
           "update_annotation",
           description, annotation_id);
@@ -161,72 +173,26 @@ private:
   }
 
   /**
-   * Select all annotation ranges for a given text ID. This is used to determine
-   * which parts of the text are already annotated. If the user tries to submit an
-   * annotation that overlaps with an existing annotation, it will be rejected.
-   *
-   * @param text_id ID of the text to select annotation ranges from.
-   * @return Array of integers representing the start and end positions of annotations.
+   * Drop cached profiles whose stats were changed by an annotation write.
+   * @param user_ids IDs of the users whose stats changed.
    */
-  RangeOccupancies select_annotation_ranges(int text_id)
+  void invalidate_profiles(const std::vector<int> &user_ids)
   {
-    try
-    {
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result r = txn.exec_prepared(
-          "select_annotation_ranges",
-          text_id);
-      try
-      {
-        txn.commit();
-      }
-      catch (const std::exception &e)
-      {
-        throw;
-      }
-      if (r.empty())
-      {
-        return {nullptr, 0};
-      }
-      int *ranges = new int[r.size() * 2];
-      for (int i = 0; i < r.size(); i++)
-      {
-        ranges[i * 2] = r[i][0].as<int>();
-        ranges[i * 2 + 1] = r[i][1].as<int>();
-      }
-      return {ranges, r.size() * 2};
-    }
-    catch (const std::exception &e)
+    std::vector<std::string> keys;
+    keys.reserve(user_ids.size());
+    for (int user_id : user_ids)
     {
+      keys.push_back("profile:" + std::to_string(user_id));
     }
-    catch (...)
+
+    try
     {
+      Redis::get_instance().del(keys.begin(), keys.end());
     }
-  }
-
-  /**
-   * Check if a given start and end position overlaps with any existing annotation ranges.
-   * However, if the start and end exactly match an existing annotation, it is considered valid.
-   *
-   * @param ranges Array of integers representing the start and end positions of annotations.
-   * @param start Start position of the annotation to check.
-   * @param end End position of the annotation to check.
-   * @return true if the annotation overlaps with an existing annotation, false otherwise.
-   */
-  bool check_valid_ranges(int *ranges, size_t size, int start, int end)
-  {
-    for (size_t i = 0; i < size; i += 2)
+    catch (const std::exception &e)
     {
-      if (ranges[i] == start && ranges[i + 1] == end)
-      {
-        return true;
-      }
-      if (!(end < ranges[i] || start > ranges[i + 1]))
-      {
-        return false;
-      }
+      Logger::instance().error(std::string("Error invalidating profile cache: ") + e.what());
     }
-    return true;
   }
 
   /**
@@ -237,15 +203,16 @@ private:
    * @param start Start position of the annotation.
    * @param end End position of the annotation.
    * @param description Description of the annotation.
-   * @return true if the annotation was inserted, false otherwise.
+   * @param session_id Session making the write, for read-your-writes.
+   * @return ID of the new annotation if it was inserted, -1 otherwise.
    */
-  bool insert_annotation(int text_id, int user_id, int start, int end, std::string description)
+  int insert_annotation(int text_id, int user_id, int start, int end, std::string description, std::string_view session_id)
   {
     Logger::instance().debug("Inserting annotation for text_id=" + std::to_string(text_id) + ", user_id=" + std::to_string(user_id));
     std::time_t created_at = std::time(nullptr);
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool, session_id);
       pqxx::result r = txn.exec_prepared(
           "insert_annotation",
           text_id, user_id, start, end, description, created_at);
@@ -257,12 +224,16 @@ private:
       {
         throw;
       }
-      if (r.affected_rows() == 0)
+      if (r.empty())
       {
         Logger::instance().info("Failed to insert annotation for text_id=" + std::to_string(text_id));
-        return false;
+        return -1;
       }
-      return true;
+      int annotation_id = r[0][0].as<int>();
+      annotation_index::get_annotation_index().insert(text_id, {annotation_id, start, end});
+      annotation_cache::invalidate(text_id);
+      invalidate_profiles({user_id});
+      return annotation_id;
     }
     catch (const std::exception &e)
     {
@@ -271,20 +242,21 @@ private:
     catch (...)
     {
     }
-    return false;
+    return -1;
   }
 
   /**
    * Delete an annotation by its ID.
    *
    * @param annotation_id ID of the annotation to delete.
+   * @param session_id Session making the write, for read-your-writes.
    * @return true if the annotation was deleted, false otherwise.
    */
-  bool delete_annotation(int annotation_id)
+  bool delete_annotation(int annotation_id, std::string_view session_id)
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool, session_id);
       pqxx::result r = txn.exec_prepared(
           "delete_annotation",
           annotation_id);
@@ -296,10 +268,16 @@ private:
       {
         throw;
       }
-      if (r.affected_rows() == 0)
+      if (r.empty())
       {
         return false;
       }
+      annotation_index::get_annotation_index().remove(r[0][0].as<int>(), annotation_id);
+      annotation_cache::invalidate(r[0][0].as<int>());
+      if (!r[0][1].is_null())
+      {
+        invalidate_profiles(nlohmann::json::parse(r[0][1].as<std::string>()).get<std::vector<int>>());
+      }
       return true;
     }
     catch (const std::exception &e)
@@ -366,6 +344,11 @@ public:
     return "/annotation";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get, http::verb::patch, http::verb::put, http::verb::delete_};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Annotation endpoint called: " + std::string(req.method_string()));
@@ -404,7 +387,7 @@ public:
         return request::make_bad_request_response("Number out of range for text_id | start | end", req);
       }
 
-      nlohmann::json annotation_info = select_annotation_data(text_id, start, end);
+      nlohmann::json annotation_info = select_annotation_data(text_id, start, end, request::get_session_id_from_cookie(req));
       if (annotation_info.empty())
       {
         return request::make_bad_request_response("No annotations found", req);
@@ -471,7 +454,7 @@ public:
         return request::make_bad_request_response("Description too short. Min 15 characters", req);
       }
 
-      if (!update_annotation(annotation_id, description))
+      if (!update_annotation(annotation_id, description, session_id))
       {
         return request::make_bad_request_response("Failed to update annotation", req);
       }
@@ -551,8 +534,19 @@ public:
         return request::make_unauthorized_response("User has not accepted the privacy policy", req);
       }
 
-      RangeOccupancies ranges = select_annotation_ranges(text_id);
-      if (!check_valid_ranges(ranges.ranges, ranges.size, start, end))
+      bool valid_range;
+      try
+      {
+        // Annotations written by other server instances reach the index
+        // through the cache invalidation listener
+        valid_range = annotation_index::get_annotation_index().can_insert(text_id, start, end);
+      }
+      catch (const std::exception &e)
+      {
+        Logger::instance().error(std::string("Error loading annotation ranges: ") + e.what());
+        return request::make_bad_request_response("Failed to validate annotation range", req);
+      }
+      if (!valid_range)
       {
         return request::make_bad_request_response("Annotation overlaps with existing annotation", req);
       }
@@ -573,7 +567,7 @@ public:
         return request::make_bad_request_response("Description too short. Min 15 characters", req);
       }
 
-      if (!insert_annotation(text_id, user_id, start, end, description))
+      if (insert_annotation(text_id, user_id, start, end, description, session_id) == -1)
       {
         return request::make_bad_request_response("Failed to insert annotation", req);
       }
@@ -624,7 +618,7 @@ public:
         return validation_response;
       }
 
-      if (!delete_annotation(annotation_id))
+      if (!delete_annotation(annotation_id, session_id))
       {
         return request::make_bad_request_response("Failed to delete annotation", req);
       }
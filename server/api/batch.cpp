@@ -0,0 +1,292 @@
+#include "api.hpp"
+#include "../server.hpp"
+
+using namespace postgres;
+using namespace utils;
+
+class BatchHandler : public RequestHandler
+{
+private:
+  ConnectionPool &pool;
+
+  static constexpr std::size_t MAX_SUB_REQUESTS = 20;
+
+  /**
+   * Sub-request of a batch and its route. The route's parameters point into the
+   * request target, so a SubRequest must not be moved once it has been matched.
+   */
+  struct SubRequest
+  {
+    http::request<http::string_body> req;
+    router::RouteMatch match;
+  };
+
+  /**
+   * Build the sub-requests of a batch. Each sub-request is an object with a
+   * method, a path (with query string) and an optional JSON body, and inherits
+   * the headers of the batch request, so cookies and API keys carry over.
+   *
+   * @param req Batch request.
+   * @param sub_requests Vector to build the sub-requests in.
+   * @return Error message if the batch is malformed, empty otherwise.
+   */
+  std::optional<std::string> parse_sub_requests(const http::request<http::string_body> &req, std::vector<SubRequest> &sub_requests)
+  {
+    nlohmann::json json_request;
+    try
+    {
+      json_request = nlohmann::json::parse(req.body());
+    }
+    catch (const nlohmann::json::parse_error &e)
+    {
+      return "Invalid JSON";
+    }
+    if (!json_request.contains("requests") || !json_request["requests"].is_array())
+    {
+      return "Missing parameter requests";
+    }
+
+    const nlohmann::json &requests = json_request["requests"];
+    if (requests.empty() || requests.size() > MAX_SUB_REQUESTS)
+    {
+      return "requests must hold between 1 and " + std::to_string(MAX_SUB_REQUESTS) + " sub-requests";
+    }
+
+    sub_requests.reserve(requests.size());
+    for (const nlohmann::json &request : requests)
+    {
+      if (!request.is_object() || !request.contains("method") || !request.contains("path") ||
+          !request["method"].is_string() || !request["path"].is_string())
+      {
+        return "Missing parameters method | path in sub-request";
+      }
+
+      http::verb method = http::string_to_verb(request["method"].get<std::string>());
+      std::string path = request["path"].get<std::string>();
+      if (method == http::verb::unknown)
+      {
+        return "Invalid method in sub-request";
+      }
+      if (path.empty() || path[0] != '/' || path.rfind(get_endpoint(), 0) == 0)
+      {
+        return "Invalid path in sub-request";
+      }
+
+      SubRequest &sub = sub_requests.emplace_back();
+      sub.req.method(method);
+      sub.req.target(path);
+      sub.req.version(req.version());
+      for (const auto &field : req)
+      {
+        if (field.name() != http::field::content_length && field.name() != http::field::content_type &&
+            field.name() != http::field::transfer_encoding)
+        {
+          sub.req.insert(field.name_string(), field.value());
+        }
+      }
+      if (request.contains("body") && !request["body"].is_null())
+      {
+        sub.req.set(http::field::content_type, "application/json");
+        sub.req.body() = request["body"].dump();
+      }
+      sub.req.prepare_payload();
+    }
+
+    // Match only once every sub-request is in place, as the matches point into them
+    for (SubRequest &sub : sub_requests)
+    {
+      sub.match = server::match_request(sub.req);
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Run a sub-request through its handler, or answer it like the server would
+   * if the router found no handler for it.
+   *
+   * @param sub Sub-request to run.
+   * @param ip_address IP address of the client.
+   * @return Response of the sub-request.
+   */
+  static http::response<http::string_body> run_sub_request(const SubRequest &sub, const std::string &ip_address)
+  {
+    if (sub.req.method() == http::verb::options || sub.match.status != router::MatchStatus::Found)
+    {
+      return server::make_unrouted_response(sub.req, sub.match);
+    }
+    return sub.match.handler->handle_route(sub.req, ip_address, sub.match.params);
+  }
+
+  /**
+   * Response for a sub-request that failed outside its handler.
+   * @param req Batch request, whose HTTP version every sub-request shares.
+   * @param error Error the sub-request failed with.
+   * @return 503 if the executor was full, 500 otherwise.
+   */
+  static http::response<http::string_body> make_failed_response(const http::request<http::string_body> &req, std::exception_ptr error)
+  {
+    http::status status = http::status::internal_server_error;
+    try
+    {
+      std::rethrow_exception(error);
+    }
+    catch (const executor::QueueFull &)
+    {
+      status = http::status::service_unavailable;
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error executing sub-request: ") + e.what());
+    }
+    catch (...)
+    {
+      Logger::instance().error("Unknown error while executing sub-request");
+    }
+
+    http::response<http::string_body> res{status, req.version()};
+    res.prepare_payload();
+    return res;
+  }
+
+  /**
+   * Collect sub-request responses into the batch response. JSON bodies are
+   * embedded as JSON, anything else as a string.
+   *
+   * @param responses Sub-request responses, in request order.
+   * @return JSON array of status and body per sub-request.
+   */
+  static nlohmann::json collect_responses(const std::vector<http::response<http::string_body>> &responses)
+  {
+    nlohmann::json batch_info = nlohmann::json::array();
+    for (const http::response<http::string_body> &res : responses)
+    {
+      nlohmann::json body = nlohmann::json::parse(res.body(), nullptr, false);
+      if (body.is_discarded())
+      {
+        body = res.body();
+      }
+      batch_info.push_back({{"status", res.result_int()}, {"body", std::move(body)}});
+    }
+    return batch_info;
+  }
+
+public:
+  BatchHandler(ConnectionPool &connection_pool) : pool(connection_pool)
+  {
+  }
+
+  std::string get_endpoint() const override
+  {
+    return "/batch";
+  }
+
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::post};
+  }
+
+  /**
+   * Validate a batch's session and find its user, once for every sub-request.
+   * @param session_id Session of the batch.
+   * @return Whether the session is valid, and its user ID or -1.
+   */
+  static std::pair<bool, int> resolve_session(const std::string &session_id)
+  {
+    if (session_id.empty())
+    {
+      return {false, -1};
+    }
+    return {request::validate_session(session_id), request::get_user_id_from_session(session_id)};
+  }
+
+  /**
+   * Run every sub-request of a batch concurrently on the blocking executor. The
+   * caller's session is resolved once up front, and each sub-request runs inside
+   * a SessionScope so its handler does not look the session up again.
+   */
+  net::awaitable<http::response<http::string_body>> handle_route_async(const http::request<http::string_body> &req, const std::string &ip_address, const router::RouteParams &) override
+  {
+    Logger::instance().info("Batch endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/batch", 20))
+    {
+      co_return request::make_too_many_requests_response("Too many requests", req);
+    }
+
+    std::vector<SubRequest> sub_requests;
+    std::optional<std::string> error = parse_sub_requests(req, sub_requests);
+    if (error)
+    {
+      co_return request::make_bad_request_response(*error, req);
+    }
+
+    std::string session_id(request::get_session_id_from_cookie(req));
+    std::pair<bool, int> session = co_await executor::run_blocking([&session_id]
+                                                                   { return resolve_session(session_id); });
+
+    std::vector<std::function<http::response<http::string_body>()>> jobs;
+    jobs.reserve(sub_requests.size());
+    for (const SubRequest &sub : sub_requests)
+    {
+      jobs.push_back([&sub, &ip_address, &session_id, session]
+                     {
+        request::SessionScope scope(session_id, session.first, session.second);
+        return run_sub_request(sub, ip_address); });
+    }
+
+    std::vector<http::response<http::string_body>> responses = co_await executor::run_blocking_each(std::move(jobs), [&req](std::exception_ptr error)
+                                                                                                     { return make_failed_response(req, error); });
+    Logger::instance().info("Batch of " + std::to_string(responses.size()) + " sub-requests completed");
+    co_return request::make_json_request_response(collect_responses(responses), req);
+  }
+
+  http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
+  {
+    Logger::instance().info("Batch endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/batch", 20))
+    {
+      return request::make_too_many_requests_response("Too many requests", req);
+    }
+    if (req.method() == http::verb::post)
+    {
+      Logger::instance().debug("POST batch requested");
+      /**
+       * POST a batch of sub-requests, run one after another.
+       */
+      std::vector<SubRequest> sub_requests;
+      std::optional<std::string> error = parse_sub_requests(req, sub_requests);
+      if (error)
+      {
+        return request::make_bad_request_response(*error, req);
+      }
+
+      std::string session_id(request::get_session_id_from_cookie(req));
+      std::pair<bool, int> session = resolve_session(session_id);
+      request::SessionScope scope(session_id, session.first, session.second);
+
+      std::vector<http::response<http::string_body>> responses;
+      responses.reserve(sub_requests.size());
+      for (const SubRequest &sub : sub_requests)
+      {
+        try
+        {
+          responses.push_back(run_sub_request(sub, ip_address));
+        }
+        catch (...)
+        {
+          responses.push_back(make_failed_response(req, std::current_exception()));
+        }
+      }
+      return request::make_json_request_response(collect_responses(responses), req);
+    }
+    else
+    {
+      Logger::instance().info("Invalid method for batch endpoint");
+      return request::make_bad_request_response("Invalid request method", req);
+    }
+  }
+};
+
+extern "C" RequestHandler *create_batch_handler()
+{
+  return new BatchHandler(get_connection_pool());
+}
@@ -265,7 +265,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       std::ostringstream oss;
       oss << "{";
       for (size_t i = 0; i < roles.size(); ++i)
@@ -315,7 +315,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       try
       {
         pqxx::result r = txn.exec_prepared(
@@ -359,7 +359,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "link_user_to_discord",
           user_id, discord_id);
@@ -395,7 +395,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_user_id_by_discord_id", discord_id);
       try
@@ -439,7 +439,7 @@ private:
     try
     {
       int current_time = static_cast<int>(std::time(0));
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "register_with_discord",
           discord_id, username, avatar, current_time);
@@ -477,7 +477,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       if (validate)
       {
         pqxx::result r = txn.exec_prepared(
@@ -522,6 +522,11 @@ public:
     return "/discord";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::post, http::verb::patch};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Discord endpoint called: " + std::string(req.method_string()));
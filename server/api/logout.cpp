@@ -12,6 +12,11 @@ public:
     return "/logout";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::post};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Logout endpoint called: " + std::string(req.method_string()));
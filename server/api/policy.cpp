@@ -14,7 +14,7 @@ private:
     Logger::instance().debug("Checking accepted policy for user_id=" + std::to_string(user_id));
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_accepted_policy",
           user_id);
@@ -48,7 +48,7 @@ private:
     Logger::instance().debug("Setting accepted policy for user_id=" + std::to_string(user_id) + " to " + (accepted ? "true" : "false"));
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "set_accepted_policy",
           user_id, accepted);
@@ -87,6 +87,11 @@ public:
     return "/policy";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::post};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Policy endpoint called: " + std::string(req.method_string()));
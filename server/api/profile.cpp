@@ -13,18 +13,30 @@ private:
    * of a user given their user ID. Will probably be changed to take from a "Profile"
    * table in the future, but currently will just get some public fields from the user
    * that are stored in the "User" table, and not seen in the navbar (e.g. proficiency levels).
+   * Annotation and vote counts come from "UserStats", which the write paths keep up to
+   * date, and the result is cached until one of those writes drops it.
    *
    * @param user_id ID of the user to select profile data from.
+   * @param session_id Session of the reader, so their own recent writes are visible.
    * @return JSON of profile data.
    */
-  nlohmann::json select_profile_data(int user_id)
+  nlohmann::json select_profile_data(int user_id, std::string_view session_id)
   {
     Logger::instance().debug("Selecting profile data for user_id=" + std::to_string(user_id));
     nlohmann::json profile_info = nlohmann::json::array();
+    std::string cache_key = "profile:" + std::to_string(user_id);
+    sw::redis::Redis &redis = Redis::get_instance();
 
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      std::optional<std::string> cache_result = redis.get(cache_key);
+
+      if (cache_result)
+      {
+        return nlohmann::json::parse(*cache_result);
+      }
+
+      request::PooledTxn txn = request::begin_read_transaction(session_id);
 
       pqxx::result r = txn.exec_prepared(
           "select_profile_data",
@@ -47,6 +59,7 @@ private:
       }
 
       profile_info = nlohmann::json::parse(r[0][0].as<std::string>());
+      redis.set(cache_key, profile_info.dump(), std::chrono::seconds(60)); // 1 minute
     }
     catch (const std::exception &e)
     {
@@ -69,6 +82,11 @@ public:
     return "/profile";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Profile endpoint called: " + std::string(req.method_string()));
@@ -102,7 +120,7 @@ public:
         return request::make_bad_request_response("Number out of range for user_id", req);
       }
 
-      nlohmann::json profile_info = select_profile_data(user_id);
+      nlohmann::json profile_info = select_profile_data(user_id, request::get_session_id_from_cookie(req));
       if (profile_info.empty())
       {
         Logger::instance().info("No profile found for user_id=" + std::to_string(user_id));
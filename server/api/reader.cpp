@@ -0,0 +1,491 @@
+#include "api.hpp"
+#include "../db/pgasync.hpp"
+#include "../cache/annotation_cache.hpp"
+#include "../cache/local_cache.hpp"
+
+using namespace postgres;
+using namespace utils;
+
+class ReaderHandler : public RequestHandler
+{
+private:
+  ConnectionPool &pool;
+
+  /**
+   * Parts of a reader bundle found in the cache, along with the reader's user ID.
+   * The annotation list can only be looked up once the text, and so its ID, is known.
+   */
+  struct CachedParts
+  {
+    std::optional<std::string> text;
+    std::optional<std::string> brief;
+    local_cache::Version text_version;
+    local_cache::Version brief_version;
+    std::optional<int> text_id;
+    annotation_cache::Lookup annotations;
+    int user_id = -1;
+  };
+
+  /**
+   * Parts of a reader bundle to fetch from the database, and their payloads once fetched.
+   */
+  struct FetchedParts
+  {
+    bool need_text = false;
+    bool need_brief = false;
+    bool need_annotations = false;
+    bool need_votes = false;
+    std::optional<std::string> text;
+    std::optional<std::string> brief;
+    std::optional<std::string> annotations;
+    std::optional<std::string> votes;
+  };
+
+  static std::string text_cache_key(int text_object_id, const std::string &language)
+  {
+    return "text:" + std::to_string(text_object_id) + ":" + language;
+  }
+
+  static std::string brief_cache_key(int text_object_id, const std::string &language)
+  {
+    return "text:" + std::to_string(text_object_id) + ":" + language + ":brief";
+  }
+
+  /**
+   * Read the cached text and brief of a text object from the local cache, or
+   * from Redis with one MGET, and resolve the reader's session. When the text is
+   * cached, its annotation list is looked up as well. A cache error is treated
+   * as a miss.
+   *
+   * @param text_object_id ID of the text object to read.
+   * @param language Language of the text object to read.
+   * @param session_id Session of the reader, or empty if not logged in.
+   * @return Cached parts of the bundle.
+   */
+  static CachedParts select_cached_parts(int text_object_id, const std::string &language, const std::string &session_id)
+  {
+    CachedParts cached;
+    if (!session_id.empty())
+    {
+      cached.user_id = request::get_user_id_from_session(session_id);
+    }
+
+    // Stale parts count as misses, so they are refetched in the same round trip as the rest
+    std::vector<std::string> cache_keys = {text_cache_key(text_object_id, language), brief_cache_key(text_object_id, language)};
+    std::vector<local_cache::Lookup> lookups = local_cache::find_fresh(cache_keys, {local_cache::generation_key(cache_keys[0]), local_cache::generation_key(cache_keys[1])});
+    if (lookups[0].value)
+    {
+      cached.text = *lookups[0].value;
+    }
+    if (lookups[1].value)
+    {
+      cached.brief = *lookups[1].value;
+    }
+    cached.text_version = std::move(lookups[0].version);
+    cached.brief_version = std::move(lookups[1].version);
+    find_cached_annotations(cached);
+    return cached;
+  }
+
+  /**
+   * Look up the cached annotation list of a cached text.
+   * @param cached Cached parts of the bundle, given the text ID and annotation list.
+   */
+  static void find_cached_annotations(CachedParts &cached)
+  {
+    if (!cached.text)
+    {
+      return;
+    }
+
+    nlohmann::json text_data = nlohmann::json::parse(*cached.text, nullptr, false);
+    if (text_data.is_array() && !text_data.empty() && text_data[0].contains("id"))
+    {
+      cached.text_id = text_data[0]["id"].get<int>();
+      cached.annotations = annotation_cache::find_annotations(*cached.text_id);
+    }
+  }
+
+  /**
+   * Work out which parts of a bundle are missing from the cache.
+   * @param cached Cached parts of the bundle.
+   * @return Parts to fetch from the database.
+   */
+  static FetchedParts plan_fetch(const CachedParts &cached)
+  {
+    FetchedParts fetched;
+    fetched.need_text = !cached.text;
+    fetched.need_brief = !cached.brief;
+    fetched.need_annotations = !cached.annotations.payload;
+    fetched.need_votes = cached.user_id >= 0;
+    return fetched;
+  }
+
+  /**
+   * Fetch the missing parts of a bundle in one pipelined round trip on the async driver.
+   * @param text_object_id ID of the text object to read.
+   * @param language Language of the text object to read.
+   * @param user_id ID of the reader, used when their votes are needed.
+   * @param fetched Parts to fetch, filled in with their payloads.
+   */
+  net::awaitable<void> fetch_parts_async(int text_object_id, const std::string &language, int user_id, FetchedParts &fetched)
+  {
+    Pipeline pipeline;
+    std::vector<std::optional<std::string> *> targets;
+    if (fetched.need_text)
+    {
+      pipeline.exec_prepared("select_text_details", text_object_id, language);
+      targets.push_back(&fetched.text);
+    }
+    if (fetched.need_brief)
+    {
+      pipeline.exec_prepared("select_text_brief", text_object_id, language);
+      targets.push_back(&fetched.brief);
+    }
+    if (fetched.need_annotations)
+    {
+      pipeline.exec_prepared("select_annotations_by_text_object", text_object_id, language);
+      targets.push_back(&fetched.annotations);
+    }
+    if (fetched.need_votes)
+    {
+      pipeline.exec_prepared("select_reader_votes", text_object_id, language, user_id);
+      targets.push_back(&fetched.votes);
+    }
+    if (pipeline.empty())
+    {
+      co_return;
+    }
+
+    AsyncPool &async_pool = get_async_pool(co_await net::this_coro::executor);
+    AsyncLease lease = co_await async_pool.acquire();
+    std::vector<AsyncResult> results = co_await lease.run(pipeline);
+
+    for (std::size_t i = 0; i < targets.size() && i < results.size(); ++i)
+    {
+      if (results[i].rows() > 0 && !results[i].is_null(0, 0))
+      {
+        *targets[i] = std::string(results[i].value(0, 0));
+      }
+    }
+  }
+
+  /**
+   * Fetch the missing parts of a bundle in one read transaction. Used when the
+   * async driver is unavailable and by the synchronous handler.
+   *
+   * @param text_object_id ID of the text object to read.
+   * @param language Language of the text object to read.
+   * @param user_id ID of the reader, used when their votes are needed.
+   * @param session_id Session of the reader, so their own recent writes are visible.
+   * @param fetched Parts to fetch, filled in with their payloads.
+   */
+  static void fetch_parts(int text_object_id, const std::string &language, int user_id, std::string_view session_id, FetchedParts &fetched)
+  {
+    if (!fetched.need_text && !fetched.need_brief && !fetched.need_annotations && !fetched.need_votes)
+    {
+      return;
+    }
+
+    auto first_cell = [](const pqxx::result &r) -> std::optional<std::string>
+    {
+      if (r.empty() || r[0][0].is_null())
+      {
+        return std::nullopt;
+      }
+      return r[0][0].as<std::string>();
+    };
+
+    request::PooledTxn txn = request::begin_read_transaction(session_id);
+    if (fetched.need_text)
+    {
+      fetched.text = first_cell(txn.exec_prepared("select_text_details", text_object_id, language));
+    }
+    if (fetched.need_brief)
+    {
+      fetched.brief = first_cell(txn.exec_prepared("select_text_brief", text_object_id, language));
+    }
+    if (fetched.need_annotations)
+    {
+      fetched.annotations = first_cell(txn.exec_prepared("select_annotations_by_text_object", text_object_id, language));
+    }
+    if (fetched.need_votes)
+    {
+      fetched.votes = first_cell(txn.exec_prepared("select_reader_votes", text_object_id, language, user_id));
+    }
+    try
+    {
+      txn.commit();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
+      throw;
+    }
+  }
+
+  /**
+   * Write freshly fetched text and brief payloads back to Redis in one pipeline,
+   * and to the local cache. Parts are only cached when read from the primary,
+   * each under the generation looked up before it was read, so a replica
+   * lagging behind an invalidation cannot refill it with the old payload.
+   *
+   * @param text_object_id ID of the text object read.
+   * @param language Language of the text object read.
+   * @param cached Cached parts of the bundle.
+   * @param fetched Fetched parts of the bundle.
+   * @param from_primary Whether the parts were read from the primary.
+   */
+  static void cache_fetched_parts(int text_object_id, const std::string &language, const CachedParts &cached, const FetchedParts &fetched, bool from_primary)
+  {
+    if (from_primary && fetched.need_annotations && cached.text_id && cached.annotations.generation)
+    {
+      annotation_cache::store_annotations(*cached.text_id, *cached.annotations.generation, fetched.annotations.value_or("[]"));
+    }
+
+    if (!from_primary || (!fetched.text && !fetched.brief))
+    {
+      return;
+    }
+
+    try
+    {
+      sw::redis::Pipeline pipeline = Redis::get_instance().pipeline(false);
+      if (fetched.text)
+      {
+        local_cache::queue_write(pipeline, text_cache_key(text_object_id, language), cached.text_version, *fetched.text, std::chrono::seconds(3600)); // 1 hour
+      }
+      if (fetched.brief)
+      {
+        local_cache::queue_write(pipeline, brief_cache_key(text_object_id, language), cached.brief_version, *fetched.brief, std::chrono::seconds(3600)); // 1 hour
+      }
+      pipeline.exec();
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error writing reader cache: ") + e.what());
+    }
+
+    local_cache::LocalCache &local = local_cache::get_local_cache();
+    if (fetched.text)
+    {
+      local.put_if_unchanged(text_cache_key(text_object_id, language), std::make_shared<const std::string>(*fetched.text), cached.text_version.epoch);
+    }
+    if (fetched.brief)
+    {
+      local.put_if_unchanged(brief_cache_key(text_object_id, language), std::make_shared<const std::string>(*fetched.brief), cached.brief_version.epoch);
+    }
+  }
+
+  /**
+   * Assemble a reader bundle from its cached and fetched parts.
+   *
+   * Example result:
+   * {
+   *   "text": { "id": 1, "text": "...", "language": "GR", "text_object_id": 1, "audio": null },
+   *   "brief": { "id": 1, "title": "...", "brief": "...", "level": "A1", ... },
+   *   "annotations": [ { "id": 1, "start": 0, "end": 10, "text_id": 1 } ],
+   *   "votes": { "1": "LIKE" }
+   * }
+   *
+   * @param cached Cached parts of the bundle.
+   * @param fetched Fetched parts of the bundle.
+   * @return JSON of the bundle, or nothing if the text does not exist.
+   */
+  static std::optional<nlohmann::json> assemble_bundle(const CachedParts &cached, const FetchedParts &fetched)
+  {
+    auto parse = [](const std::optional<std::string> &first, const std::optional<std::string> &second, nlohmann::json fallback)
+    {
+      const std::optional<std::string> &payload = first ? first : second;
+      return payload ? nlohmann::json::parse(*payload) : std::move(fallback);
+    };
+
+    nlohmann::json text_data = parse(cached.text, fetched.text, nlohmann::json::array());
+    if (!text_data.is_array() || text_data.empty())
+    {
+      return std::nullopt;
+    }
+    nlohmann::json brief_data = parse(cached.brief, fetched.brief, nlohmann::json::array());
+
+    nlohmann::json reader_info = {{"text", text_data[0]},
+                                  {"brief", brief_data.empty() ? nlohmann::json() : brief_data[0]},
+                                  {"annotations", parse(cached.annotations.payload, fetched.annotations, nlohmann::json::array())},
+                                  {"votes", parse(fetched.votes, std::nullopt, nlohmann::json::object())}};
+    return reader_info;
+  }
+
+  /**
+   * Parse the text object ID and language of a reader request.
+   * @param req Reader request.
+   * @param text_object_id Set to the requested text object ID.
+   * @param language Set to the requested language.
+   * @return Error message if the parameters are invalid, empty otherwise.
+   */
+  static std::optional<std::string> parse_reader_params(const http::request<http::string_body> &req, int &text_object_id, std::string &language)
+  {
+    std::optional<std::string> text_object_id_param = request::parse_from_request(req, "text_object_id");
+    std::optional<std::string> language_param = request::parse_from_request(req, "language");
+
+    if (!text_object_id_param || !language_param)
+    {
+      return "Missing parameters text_object_id | language";
+    }
+
+    try
+    {
+      text_object_id = std::stoi(text_object_id_param.value());
+    }
+    catch (const std::invalid_argument &)
+    {
+      return "Invalid numeric value for text_object_id";
+    }
+    catch (const std::out_of_range &)
+    {
+      return "Number out of range for text_object_id";
+    }
+    language = language_param.value();
+    return std::nullopt;
+  }
+
+public:
+  ReaderHandler(ConnectionPool &connection_pool) : pool(connection_pool)
+  {
+  }
+
+  std::string get_endpoint() const override
+  {
+    return "/reader";
+  }
+
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get};
+  }
+
+  /**
+   * Assemble the reader bundle for a text object: its text, brief, annotations and
+   * the caller's votes. The text and brief are read from the cache with one MGET
+   * and annotations from the annotation cache; whatever is still missing, and the
+   * caller's votes, are sent in a single pipeline on the async driver. If that
+   * fails, the same queries run in one transaction on the blocking executor.
+   */
+  net::awaitable<http::response<http::string_body>> handle_route_async(const http::request<http::string_body> &req, const std::string &ip_address, const router::RouteParams &) override
+  {
+    Logger::instance().info("Reader endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/reader", 20))
+    {
+      co_return request::make_too_many_requests_response("Too many requests", req);
+    }
+
+    int text_object_id = 0;
+    std::string language;
+    std::optional<std::string> error = parse_reader_params(req, text_object_id, language);
+    if (error)
+    {
+      co_return request::make_bad_request_response(*error, req);
+    }
+
+    std::string session_id(request::get_session_id_from_cookie(req));
+    CachedParts cached = co_await executor::run_blocking([text_object_id, &language, &session_id]
+                                                         { return select_cached_parts(text_object_id, language, session_id); });
+
+    FetchedParts fetched = plan_fetch(cached);
+    bool pipelined = false;
+
+    try
+    {
+      co_await fetch_parts_async(text_object_id, language, cached.user_id, fetched);
+      pipelined = true;
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error executing pipelined query: ") + e.what());
+    }
+
+    try
+    {
+      if (!pipelined)
+      {
+        co_await executor::run_blocking([text_object_id, &language, &cached, &session_id, &fetched]
+                                        { fetch_parts(text_object_id, language, cached.user_id, session_id, fetched); return true; });
+      }
+      co_await executor::run_blocking([text_object_id, &language, &cached, &fetched, pipelined]
+                                      { cache_fetched_parts(text_object_id, language, cached, fetched, pipelined); return true; });
+    }
+    catch (const executor::QueueFull &)
+    {
+      throw;
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error executing query: ") + e.what());
+    }
+
+    std::optional<nlohmann::json> reader_info = assemble_bundle(cached, fetched);
+    if (!reader_info)
+    {
+      Logger::instance().info("No text found for text_object_id=" + std::to_string(text_object_id));
+      co_return request::make_bad_request_response("No text found", req);
+    }
+
+    Logger::instance().info("Reader data returned for text_object_id=" + std::to_string(text_object_id));
+    co_return request::make_json_request_response(*reader_info, req);
+  }
+
+  http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
+  {
+    Logger::instance().info("Reader endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/reader", 20))
+    {
+      return request::make_too_many_requests_response("Too many requests", req);
+    }
+    if (req.method() == http::verb::get)
+    {
+      Logger::instance().debug("GET reader requested");
+      /**
+       * GET the reader bundle of a text object.
+       */
+      int text_object_id = 0;
+      std::string language;
+      std::optional<std::string> error = parse_reader_params(req, text_object_id, language);
+      if (error)
+      {
+        return request::make_bad_request_response(*error, req);
+      }
+
+      std::string session_id(request::get_session_id_from_cookie(req));
+      CachedParts cached = select_cached_parts(text_object_id, language, session_id);
+
+      FetchedParts fetched = plan_fetch(cached);
+      try
+      {
+        fetch_parts(text_object_id, language, cached.user_id, session_id, fetched);
+        cache_fetched_parts(text_object_id, language, cached, fetched, false);
+      }
+      catch (const std::exception &e)
+      {
+        Logger::instance().error(std::string("Error executing query: ") + e.what());
+      }
+
+      std::optional<nlohmann::json> reader_info = assemble_bundle(cached, fetched);
+      if (!reader_info)
+      {
+        Logger::instance().info("No text found for text_object_id=" + std::to_string(text_object_id));
+        return request::make_bad_request_response("No text found", req);
+      }
+
+      Logger::instance().info("Reader data returned for text_object_id=" + std::to_string(text_object_id));
+      return request::make_json_request_response(*reader_info, req);
+    }
+    else
+    {
+      Logger::instance().info("Invalid method for reader endpoint");
+      return request::make_bad_request_response("Invalid request method", req);
+    }
+  }
+};
+
+extern "C" RequestHandler *create_reader_handler()
+{
+  return new ReaderHandler(get_connection_pool());
+}
@@ -0,0 +1,147 @@
+#include "api.hpp"
+#include "../index/text_index.hpp"
+
+using namespace postgres;
+using namespace utils;
+
+class SearchHandler : public RequestHandler
+{
+private:
+  ConnectionPool &pool;
+
+  /**
+   * Search every text for a query. This is answered entirely from the in-memory
+   * text index, so it never touches the database. Words are matched regardless of
+   * case and accents, and double-quoted phrases must appear word for word.
+   *
+   * Example result:
+   * [
+   *   {
+   *     "text_id": 1,
+   *     "text_object_id": 1,
+   *     "language": "GR",
+   *     "hits": 2,
+   *     "matches": [
+   *       {
+   *         "position": 14,
+   *         "left": "και ο ",
+   *         "match": "Οδυσσέας",
+   *         "right": " είπε"
+   *       }
+   *     ]
+   *   }
+   * ]
+   *
+   * @param query Search query.
+   * @param language Language to restrict results to, or empty for every language.
+   * @param limit Maximum number of texts to return.
+   * @param context Number of words to show on each side of a match.
+   * @return JSON of matching texts, best first.
+   */
+  nlohmann::json search_texts(const std::string &query, const std::string &language, std::size_t limit, int context)
+  {
+    Logger::instance().debug("Searching texts for query=" + query + ", language=" + language);
+    nlohmann::json search_info = nlohmann::json::array();
+
+    for (const text_index::SearchResult &result : text_index::get_text_index().search(query, language, limit, context))
+    {
+      nlohmann::json matches = nlohmann::json::array();
+      for (const text_index::Match &match : result.matches)
+      {
+        matches.push_back({{"position", match.position}, {"left", match.left}, {"match", match.match}, {"right", match.right}});
+      }
+      search_info.push_back({{"text_id", result.text_id},
+                             {"text_object_id", result.text_object_id},
+                             {"language", result.language},
+                             {"hits", result.hits},
+                             {"matches", std::move(matches)}});
+    }
+    return search_info;
+  }
+
+public:
+  SearchHandler(ConnectionPool &connection_pool) : pool(connection_pool)
+  {
+  }
+
+  std::string get_endpoint() const override
+  {
+    return "/search";
+  }
+
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get};
+  }
+
+  http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
+  {
+    Logger::instance().info("Search endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/search", 50))
+    {
+      return request::make_too_many_requests_response("Too many requests", req);
+    }
+    if (req.method() == http::verb::get)
+    {
+      Logger::instance().debug("GET search requested");
+      /**
+       * GET texts matching a query.
+       */
+      std::optional<std::string> query_param = request::parse_from_request(req, "q");
+      std::optional<std::string> language_param = request::parse_from_request(req, "language");
+      std::optional<std::string> limit_param = request::parse_from_request(req, "limit");
+      std::optional<std::string> context_param = request::parse_from_request(req, "context");
+
+      if (!query_param || query_param.value().empty())
+      {
+        return request::make_bad_request_response("Missing parameter q", req);
+      }
+
+      int limit = 20, context = 5;
+
+      try
+      {
+        if (limit_param)
+        {
+          limit = std::stoi(limit_param.value());
+        }
+        if (context_param)
+        {
+          context = std::stoi(context_param.value());
+        }
+      }
+      catch (const std::invalid_argument &)
+      {
+        return request::make_bad_request_response("Invalid numeric value for limit | context", req);
+      }
+      catch (const std::out_of_range &)
+      {
+        return request::make_bad_request_response("Number out of range for limit | context", req);
+      }
+
+      if (limit < 1 || limit > 100)
+      {
+        return request::make_bad_request_response("limit must be between 1 and 100", req);
+      }
+      if (context < 0 || context > 20)
+      {
+        return request::make_bad_request_response("context must be between 0 and 20", req);
+      }
+
+      nlohmann::json search_info = search_texts(request::url_decode(query_param.value()), language_param.value_or(""), limit, context);
+      Logger::instance().info("Search returned " + std::to_string(search_info.size()) + " texts");
+
+      return request::make_json_request_response(search_info, req);
+    }
+    else
+    {
+      Logger::instance().info("Invalid method for search endpoint");
+      return request::make_bad_request_response("Invalid request method", req);
+    }
+  }
+};
+
+extern "C" RequestHandler *create_search_handler()
+{
+  return new SearchHandler(get_connection_pool());
+}
@@ -0,0 +1,114 @@
+#include "api.hpp"
+#include "../index/title_index.hpp"
+
+using namespace postgres;
+using namespace utils;
+
+class SuggestHandler : public RequestHandler
+{
+private:
+  ConnectionPool &pool;
+
+  /**
+   * Suggest titles for a prefix typed by the reader. This is answered from the
+   * in-memory title automaton, so it never touches the database or the cache.
+   * The prefix may match the start of any word in a title, ignoring case and accents.
+   *
+   * @param prefix Text typed so far.
+   * @param limit Maximum number of titles to return.
+   * @return JSON of suggested titles with their level and group ID.
+   */
+  nlohmann::json suggest_titles(const std::string &prefix, std::size_t limit)
+  {
+    Logger::instance().debug("Suggesting titles for prefix=" + prefix);
+    nlohmann::json suggest_info = nlohmann::json::array();
+
+    std::shared_ptr<const title_index::TitleAutomaton> automaton = title_index::get_title_index().get();
+    if (!automaton)
+    {
+      return suggest_info;
+    }
+
+    for (const title_index::Title *title : automaton->suggest(prefix, limit))
+    {
+      suggest_info.push_back({{"id", title->id},
+                              {"title", title->title},
+                              {"level", title->level},
+                              {"group_id", title->group_id ? nlohmann::json(*title->group_id) : nlohmann::json()}});
+    }
+    return suggest_info;
+  }
+
+public:
+  SuggestHandler(ConnectionPool &connection_pool) : pool(connection_pool)
+  {
+  }
+
+  std::string get_endpoint() const override
+  {
+    return "/titles/suggest";
+  }
+
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get};
+  }
+
+  http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
+  {
+    Logger::instance().info("Suggest endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/titles/suggest", 100))
+    {
+      return request::make_too_many_requests_response("Too many requests", req);
+    }
+    if (req.method() == http::verb::get)
+    {
+      Logger::instance().debug("GET title suggestions requested");
+      /**
+       * GET title suggestions for a prefix.
+       */
+      std::optional<std::string> prefix_param = request::parse_from_request(req, "q");
+      std::optional<std::string> limit_param = request::parse_from_request(req, "limit");
+
+      if (!prefix_param)
+      {
+        return request::make_bad_request_response("Missing parameter q", req);
+      }
+
+      int limit = 10;
+      try
+      {
+        if (limit_param)
+        {
+          limit = std::stoi(limit_param.value());
+        }
+      }
+      catch (const std::invalid_argument &)
+      {
+        return request::make_bad_request_response("Invalid numeric value for limit", req);
+      }
+      catch (const std::out_of_range &)
+      {
+        return request::make_bad_request_response("Number out of range for limit", req);
+      }
+
+      if (limit < 1 || limit > 50)
+      {
+        return request::make_bad_request_response("limit must be between 1 and 50", req);
+      }
+
+      nlohmann::json suggest_info = suggest_titles(request::url_decode(prefix_param.value()), limit);
+      return request::make_json_request_response(suggest_info, req);
+    }
+    else
+    {
+      Logger::instance().info("Invalid method for suggest endpoint");
+      return request::make_bad_request_response("Invalid request method", req);
+    }
+  }
+};
+
+extern "C" RequestHandler *create_suggest_handler()
+{
+  return new SuggestHandler(get_connection_pool());
+}
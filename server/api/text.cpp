@@ -1,4 +1,7 @@
 #include "api.hpp"
+#include "../db/pgasync.hpp"
+#include "../cache/annotation_cache.hpp"
+#include "../cache/local_cache.hpp"
 
 using namespace postgres;
 using namespace utils;
@@ -10,56 +13,91 @@ private:
 
   /**
    * Select annotation positions for a text. This will return the start and end
-   * positions of each annotation in the text along with its ID.
+   * positions of each annotation in the text along with its ID. The text ID and
+   * the list are both cached, and the list is invalidated whenever an annotation
+   * is added to or removed from the text, so repeat reads do not touch the database.
    *
    * @param text_object_id ID of the text object to select annotations for.
    * @param language Language of the text object to select annotations for.
+   * @return Serialised JSON array of annotation positions.
    */
-  nlohmann::json select_annotations(int text_object_id, std::string language)
+  std::string select_annotations(int text_object_id, std::string language)
   {
     Logger::instance().debug("Selecting annotations for text_object_id=" + std::to_string(text_object_id) + ", language=" + language);
-    nlohmann::json text_data = nlohmann::json::array();
 
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result text_id_result = txn.exec_prepared(
-          "select_text_id",
-          std::to_string(text_object_id), language);
-
-      if (text_id_result.empty())
+      std::optional<int> text_id = annotation_cache::select_text_id(text_object_id, language);
+      if (!text_id)
       {
-        return text_data;
+        return "[]";
       }
+      return annotation_cache::select_annotations(*text_id);
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error executing query: ") + e.what());
+    }
+    catch (...)
+    {
+      utils::Logger::instance().error("Unknown error while executing query");
+    }
+    return "[]";
+  }
 
-      int text_id = text_id_result[0][0].as<int>();
-
+  /**
+   * Make the database load of a serialised text payload. The load owns its
+   * arguments, as it may run in the background to refresh a stale payload, and
+   * reads from the primary, as it refills payloads right after they are purged.
+   *
+   * @param statement Prepared statement selecting the payload.
+   * @param text_object_id ID of the text object to select.
+   * @param language Language of the text object to select.
+   * @return Load of the payload, returning nothing if the text object does not exist.
+   */
+  static local_cache::Loader make_text_loader(std::string statement, int text_object_id, std::string language)
+  {
+    return [statement = std::move(statement), text_object_id, language = std::move(language)]() -> std::optional<std::string>
+    {
+      request::PooledTxn txn = request::begin_transaction(get_connection_pool());
       pqxx::result r = txn.exec_prepared(
-          "select_annotations",
-          std::to_string(text_id));
-
+          statement,
+          std::to_string(text_object_id), language);
       try
       {
         txn.commit();
       }
       catch (const std::exception &e)
       {
-        utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
         throw;
       }
 
-      if (r.empty())
+      if (r.empty() || r[0][0].is_null())
       {
-        return text_data;
+        return std::nullopt;
       }
+      return r[0][0].as<std::string>();
+    };
+  }
 
-      if (r[0][0].is_null())
-      {
-      }
-      else
-      {
-        text_data = nlohmann::json::parse(r[0][0].as<std::string>());
-      }
+  /**
+   * Select a serialised text payload, reading through the local cache and Redis
+   * before querying the database. Hot texts are served from memory without a
+   * network round trip or parsing, and concurrent misses on the same payload
+   * share a single query. Payloads past their 1 hour soft TTL are still
+   * served while they are refreshed in the background.
+   *
+   * @param cache_key Cache key of the payload.
+   * @param statement Prepared statement selecting the payload.
+   * @param text_object_id ID of the text object to select.
+   * @param language Language of the text object to select.
+   * @return Serialised JSON payload, or nullptr if the text object does not exist.
+   */
+  local_cache::LocalCache::Value select_text_payload(const std::string &cache_key, const std::string &statement, int text_object_id, const std::string &language)
+  {
+    try
+    {
+      return local_cache::load_through(cache_key, local_cache::generation_key(cache_key), std::chrono::seconds(3600), make_text_loader(statement, text_object_id, language)); // 1 hour
     }
     catch (const std::exception &e)
     {
@@ -67,127 +105,343 @@ private:
     }
     catch (...)
     {
-      utils::Logger::instance().error("Unknown error while executing query");
     }
-    return text_data;
+    return nullptr;
   }
 
   /**
    * Select text data from the database. This will return the text and language of a text object.
-   * @param text__object_id ID of the text object to select.
+   * @param text_object_id ID of the text object to select.
    * @param language Language of the text object to select.
-   * @return JSON of text data.
+   * @return Serialised JSON of text data, or nullptr if there is no such text.
    */
-  nlohmann::json select_text_data(int text_object_id, std::string language)
+  local_cache::LocalCache::Value select_text_data(int text_object_id, std::string language)
   {
     Logger::instance().debug("Selecting text data for text_object_id=" + std::to_string(text_object_id) + ", language=" + language);
-    nlohmann::json text_data = nlohmann::json::array();
-    std::string cache_key = "text:" + std::to_string(text_object_id) + ":" + language;
-    sw::redis::Redis &redis = Redis::get_instance();
+    return select_text_payload("text:" + std::to_string(text_object_id) + ":" + language, "select_text_details", text_object_id, language);
+  }
 
-    try
+  /**
+   * Select brief text data from the database. This will return the text title
+   * and author of a text object, along with some other metadata.
+   *
+   * @param text_object_id ID of the text object to select.
+   * @param language Language of the text object to select.
+   * @return Serialised JSON of brief text data, or nullptr if there is no such text.
+   */
+  local_cache::LocalCache::Value select_text_brief(int text_object_id, std::string language)
+  {
+    Logger::instance().debug("Selecting text brief for text_object_id=" + std::to_string(text_object_id) + ", language=" + language);
+    return select_text_payload("text:" + std::to_string(text_object_id) + ":" + language + ":brief", "select_text_brief", text_object_id, language);
+  }
+
+  /**
+   * Select brief text data for many text objects at once. Briefs in the local
+   * cache are used as they are, the rest are read from Redis with one MGET, every
+   * miss or stale brief is fetched with one query, and the fetched briefs are
+   * written back to the cache in one pipeline, under the generation read before
+   * the query. Briefs share their cache entries with select_text_brief.
+   *
+   * @param text_object_ids IDs of the text objects to select.
+   * @param language Language of the text objects to select.
+   * @return JSON object of brief text data keyed by text object ID.
+   */
+  nlohmann::json select_text_briefs(const std::vector<int> &text_object_ids, const std::string &language)
+  {
+    Logger::instance().debug("Selecting text briefs for " + std::to_string(text_object_ids.size()) + " text objects, language=" + language);
+    nlohmann::json text_data = nlohmann::json::object();
+    local_cache::LocalCache &local = local_cache::get_local_cache();
+
+    std::vector<std::string> cache_keys;
+    std::vector<std::string> generation_keys;
+    for (int text_object_id : text_object_ids)
     {
-      std::optional<std::string> cache_result = redis.get(cache_key);
+      cache_keys.push_back("text:" + std::to_string(text_object_id) + ":" + language + ":brief");
+      generation_keys.push_back(local_cache::generation_key(cache_keys.back()));
+    }
 
-      if (cache_result)
-      {
-        return nlohmann::json::parse(*cache_result);
-      }
+    // Stale briefs and briefs of an older generation are refetched with the misses
+    std::vector<local_cache::Lookup> lookups = local_cache::find_fresh(cache_keys, generation_keys);
 
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result r = txn.exec_prepared(
-          "select_text_details",
-          std::to_string(text_object_id), language);
-      try
+    std::string missing;
+    std::unordered_map<int, std::size_t> missing_index;
+    for (std::size_t i = 0; i < text_object_ids.size(); ++i)
+    {
+      std::string id = std::to_string(text_object_ids[i]);
+      if (lookups[i].value)
       {
-        txn.commit();
+        text_data[id] = nlohmann::json::parse(*lookups[i].value);
+        continue;
       }
-      catch (const std::exception &e)
+      text_data[id] = nlohmann::json::array();
+      missing += (missing.empty() ? "" : ",") + id;
+      missing_index.emplace(text_object_ids[i], i);
+    }
+
+    if (missing.empty())
+    {
+      return text_data;
+    }
+
+    // Read from the primary, as misses are refilled right after briefs are purged
+    pqxx::result r;
+    try
+    {
+      request::PooledTxn txn = request::begin_transaction(get_connection_pool());
+      r = txn.exec_prepared(
+          "select_text_briefs",
+          "{" + missing + "}", language);
+      txn.commit();
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error executing query: ") + e.what());
+      return text_data;
+    }
+
+    std::vector<std::pair<std::size_t, std::string>> fetched;
+    for (const auto &row : r)
+    {
+      int text_object_id = row[0].as<int>();
+      std::string payload = row[1].as<std::string>();
+      text_data[std::to_string(text_object_id)] = nlohmann::json::parse(payload);
+      auto index = missing_index.find(text_object_id);
+      if (index != missing_index.end())
       {
-        throw;
+        fetched.emplace_back(index->second, std::move(payload));
       }
+    }
 
-      if (r.empty())
+    try
+    {
+      sw::redis::Pipeline pipeline = Redis::get_instance().pipeline(false);
+      for (const auto &[i, payload] : fetched)
       {
-        return text_data;
+        local_cache::queue_write(pipeline, cache_keys[i], lookups[i].version, payload, std::chrono::seconds(3600)); // 1 hour
       }
-
-      text_data = nlohmann::json::parse(r[0][0].as<std::string>());
-      redis.set(cache_key, text_data.dump(), std::chrono::seconds(300)); // 5 minutes
+      pipeline.exec();
     }
     catch (const std::exception &e)
     {
-      Logger::instance().error(std::string("Error executing query: ") + e.what());
+      Logger::instance().error(std::string("Error writing briefs to Redis: ") + e.what());
     }
-    catch (...)
+
+    for (auto &[i, payload] : fetched)
     {
+      local.put_if_unchanged(cache_keys[i], std::make_shared<const std::string>(std::move(payload)), lookups[i].version.epoch);
     }
     return text_data;
   }
 
+public:
+  TextHandler(ConnectionPool &connection_pool) : pool(connection_pool)
+  {
+  }
+
+  std::string get_endpoint() const override
+  {
+    return "/text";
+  }
+
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get};
+  }
+
   /**
-   * Select brief text data from the database. This will return the text title
-   * and author of a text object, along with some other metadata.
+   * @brief Parts of a type=all response found in the cache.
+   */
+  struct CachedTextAll
+  {
+    local_cache::LocalCache::Value text;
+    local_cache::Version text_version;
+    std::optional<int> text_id;
+    annotation_cache::Lookup annotations;
+  };
+
+  /**
+   * Look up the text and its annotation list in the cache without querying the
+   * database. The text ID comes from the cached text, or from the cached ID
+   * mapping when the text itself has expired, so the annotation generation is
+   * known before anything is loaded.
    *
    * @param text_object_id ID of the text object to select.
    * @param language Language of the text object to select.
-   * @return JSON of brief text data.
+   * @return Cached parts of the response.
    */
-  nlohmann::json select_text_brief(int text_object_id, std::string language)
+  static CachedTextAll find_cached_text_all(int text_object_id, const std::string &language)
   {
-    Logger::instance().debug("Selecting text brief for text_object_id=" + std::to_string(text_object_id) + ", language=" + language);
-    nlohmann::json text_data = nlohmann::json::array();
-    std::string cache_key = "text:" + std::to_string(text_object_id) + ":" + language + ":brief";
-    sw::redis::Redis &redis = Redis::get_instance();
+    CachedTextAll cached;
+    std::string cache_key = "text:" + std::to_string(text_object_id) + ":" + language;
+    local_cache::Lookup text = local_cache::find(cache_key, local_cache::generation_key(cache_key), std::chrono::seconds(3600), make_text_loader("select_text_details", text_object_id, language)); // 1 hour
+    cached.text = std::move(text.value);
+    cached.text_version = std::move(text.version);
+    if (cached.text)
+    {
+      nlohmann::json text_data = nlohmann::json::parse(*cached.text, nullptr, false);
+      if (text_data.is_array() && !text_data.empty() && text_data[0].contains("id"))
+      {
+        cached.text_id = text_data[0]["id"].get<int>();
+      }
+    }
+    else
+    {
+      cached.text_id = annotation_cache::find_text_id(text_object_id, language);
+    }
 
-    try
+    if (cached.text_id)
     {
-      std::optional<std::string> cache_result = redis.get(cache_key);
+      cached.annotations = annotation_cache::find_annotations(*cached.text_id);
+    }
+    return cached;
+  }
 
-      if (cache_result)
+  /**
+   * Select text data and annotations for a text object. Both are read from the
+   * cache first; whatever is missing is sent in one pipeline on the async
+   * driver and written back to the cache. The text and annotation list are only
+   * cached under the generations read before the pipeline ran, which runs on
+   * the primary.
+   *
+   * @param text_object_id ID of the text object to select.
+   * @param language Language of the text object to select.
+   * @return Pair of text data and annotation JSON.
+   */
+  net::awaitable<std::pair<nlohmann::json, nlohmann::json>> select_text_all_async(int text_object_id, std::string language)
+  {
+    std::string cache_key = "text:" + std::to_string(text_object_id) + ":" + language;
+    CachedTextAll cached = co_await executor::run_blocking([text_object_id, &language]
+                                                            { return find_cached_text_all(text_object_id, language); });
+
+    nlohmann::json text_data = cached.text ? nlohmann::json::parse(*cached.text) : nlohmann::json::array();
+    nlohmann::json annotations = cached.annotations.payload ? nlohmann::json::parse(*cached.annotations.payload) : nlohmann::json::array();
+    if (cached.text && cached.annotations.payload)
+    {
+      co_return std::make_pair(std::move(text_data), std::move(annotations));
+    }
+
+    Pipeline pipeline;
+    if (!cached.text)
+    {
+      pipeline.exec_prepared("select_text_details", text_object_id, language);
+    }
+    if (!cached.annotations.payload)
+    {
+      pipeline.exec_prepared("select_annotations_by_text_object", text_object_id, language);
+    }
+
+    AsyncPool &async_pool = get_async_pool(co_await net::this_coro::executor);
+    AsyncLease lease = co_await async_pool.acquire();
+    std::vector<AsyncResult> results = co_await lease.run(pipeline);
+
+    std::size_t result_index = 0;
+    std::optional<std::string> text_payload;
+    if (!cached.text)
+    {
+      const AsyncResult &text_result = results[result_index++];
+      if (text_result.rows() > 0 && !text_result.is_null(0, 0))
       {
-        return nlohmann::json::parse(*cache_result);
+        text_payload = std::string(text_result.value(0, 0));
+        text_data = nlohmann::json::parse(*text_payload);
       }
+    }
 
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result r = txn.exec_prepared(
-          "select_text_brief",
-          std::to_string(text_object_id), language);
-      try
+    std::optional<std::string> annotation_payload;
+    if (!cached.annotations.payload)
+    {
+      const AsyncResult &annotation_result = results[result_index++];
+      annotation_payload = annotation_result.rows() > 0 && !annotation_result.is_null(0, 0) ? std::string(annotation_result.value(0, 0)) : "[]";
+      annotations = nlohmann::json::parse(*annotation_payload);
+    }
+
+    co_await executor::run_blocking([&cache_key, &cached, &text_payload, &annotation_payload]
+                                    {
+      if (text_payload)
       {
-        txn.commit();
+        local_cache::write_through(cache_key, cached.text_version, std::move(*text_payload), std::chrono::seconds(3600)); // 1 hour
       }
-      catch (const std::exception &e)
+      if (annotation_payload && cached.text_id && cached.annotations.generation)
       {
-        throw;
+        annotation_cache::store_annotations(*cached.text_id, *cached.annotations.generation, *annotation_payload);
       }
+      return true; });
+
+    co_return std::make_pair(std::move(text_data), std::move(annotations));
+  }
+
+  /**
+   * GET with type=all needs both the text and its annotations, so whichever of the
+   * two is not cached is sent in a single pipeline on the async driver. If that fails, fall back to running
+   * the two lookups concurrently on the blocking executor. Every other request
+   * goes through the synchronous handler.
+   */
+  net::awaitable<http::response<http::string_body>> handle_route_async(const http::request<http::string_body> &req, const std::string &ip_address, const router::RouteParams &params) override
+  {
+    std::optional<std::string> type_param = request::parse_from_request(req, "type");
+    std::optional<std::string> text_object_id_param = request::parse_from_request(req, "text_object_id");
+    std::optional<std::string> language_param = request::parse_from_request(req, "language");
 
-      if (r.empty())
+    int text_object_id = 0;
+    bool valid_id = false;
+    if (text_object_id_param)
+    {
+      try
+      {
+        text_object_id = std::stoi(text_object_id_param.value());
+        valid_id = true;
+      }
+      catch (const std::exception &)
       {
-        return text_data;
       }
+    }
+
+    if (!type_param || type_param.value() != "all" || !valid_id || !language_param)
+    {
+      co_return co_await RequestHandler::handle_route_async(req, ip_address, params);
+    }
 
-      text_data = nlohmann::json::parse(r[0][0].as<std::string>());
-      redis.set(cache_key, text_data.dump(), std::chrono::seconds(300)); // 5 minutes
+    Logger::instance().info("Text endpoint called: " + std::string(req.method_string()));
+    if (middleware::rate_limited(ip_address, "/text", 20))
+    {
+      co_return request::make_too_many_requests_response("Too many requests", req);
+    }
+
+    std::string language = language_param.value();
+    nlohmann::json text_info;
+    nlohmann::json annotations;
+    bool pipelined = false;
+
+    try
+    {
+      std::tie(text_info, annotations) = co_await select_text_all_async(text_object_id, language);
+      pipelined = true;
     }
     catch (const std::exception &e)
     {
-      Logger::instance().error(std::string("Error executing query: ") + e.what());
+      Logger::instance().error(std::string("Error executing pipelined query: ") + e.what());
     }
-    catch (...)
+
+    if (!pipelined)
     {
+      std::tie(text_info, annotations) = co_await executor::run_blocking_all(
+          [this, text_object_id, &language]
+          {
+            local_cache::LocalCache::Value payload = select_text_data(text_object_id, language);
+            return payload ? nlohmann::json::parse(*payload) : nlohmann::json::array();
+          },
+          [this, text_object_id, &language]
+          { return nlohmann::json::parse(select_annotations(text_object_id, language)); });
     }
-    return text_data;
-  }
 
-public:
-  TextHandler(ConnectionPool &connection_pool) : pool(connection_pool)
-  {
-  }
+    if (text_info.empty())
+    {
+      Logger::instance().info("No text found for text_object_id=" + std::to_string(text_object_id));
+      co_return request::make_bad_request_response("No text found", req);
+    }
 
-  std::string get_endpoint() const override
-  {
-    return "/text";
+    text_info[0]["annotations"] = annotations;
+    Logger::instance().info("Text data returned for text_object_id=" + std::to_string(text_object_id));
+    co_return request::make_json_request_response(text_info, req);
   }
 
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
@@ -204,9 +458,51 @@ public:
        * GET text details.
        */
       std::optional<std::string> text_object_id_param = request::parse_from_request(req, "text_object_id");
+      std::optional<std::string> text_object_ids_param = request::parse_from_request(req, "text_object_ids");
       std::optional<std::string> language_param = request::parse_from_request(req, "language");
       std::optional<std::string> type_param = request::parse_from_request(req, "type");
 
+      if (type_param.has_value() && type_param.value() == "brief" && text_object_ids_param.has_value())
+      {
+        if (!language_param.has_value())
+        {
+          return request::make_bad_request_response("Missing language parameter", req);
+        }
+
+        std::vector<int> text_object_ids;
+        std::string ids = request::url_decode(text_object_ids_param.value());
+        try
+        {
+          std::size_t start = 0;
+          while (start <= ids.size())
+          {
+            std::size_t end = std::min(ids.find(',', start), ids.size());
+            int text_object_id = std::stoi(ids.substr(start, end - start));
+            if (std::find(text_object_ids.begin(), text_object_ids.end(), text_object_id) == text_object_ids.end())
+            {
+              text_object_ids.push_back(text_object_id);
+            }
+            start = end + 1;
+          }
+        }
+        catch (const std::invalid_argument &)
+        {
+          return request::make_bad_request_response("Invalid numeric value for text_object_ids", req);
+        }
+        catch (const std::out_of_range &)
+        {
+          return request::make_bad_request_response("Number out of range for text_object_ids", req);
+        }
+
+        if (text_object_ids.size() > 100)
+        {
+          return request::make_bad_request_response("At most 100 text_object_ids per request", req);
+        }
+
+        nlohmann::json brief_text_data = select_text_briefs(text_object_ids, language_param.value());
+        return request::make_json_request_response(brief_text_data, req);
+      }
+
       if (!text_object_id_param.has_value() || !language_param.has_value())
       {
         return request::make_bad_request_response("Missing parameters text_object_id | language", req);
@@ -235,18 +531,22 @@ public:
 
       if (type_param.has_value() && type_param.value() == "brief")
       {
-        nlohmann::json brief_text_data = select_text_brief(text_object_id, language);
-        return request::make_json_request_response(brief_text_data, req);
+        local_cache::LocalCache::Value brief_text_data = select_text_brief(text_object_id, language);
+        if (!brief_text_data)
+        {
+          return request::make_json_request_response(nlohmann::json::array(), req);
+        }
+        return request::make_json_payload_response(*brief_text_data, req);
       }
 
       if (type_param.has_value() && type_param.value() == "annotations")
       {
-        nlohmann::json annotation_data = select_annotations(text_object_id, language);
-        return request::make_json_request_response(annotation_data, req);
+        std::string annotation_data = select_annotations(text_object_id, language);
+        return request::make_json_payload_response(annotation_data, req);
       }
 
-      nlohmann::json text_info = select_text_data(text_object_id, language);
-      if (text_info.empty())
+      local_cache::LocalCache::Value text_payload = select_text_data(text_object_id, language);
+      if (!text_payload)
       {
         Logger::instance().info("No text found for text_object_id=" + std::to_string(text_object_id));
         return request::make_bad_request_response("No text found", req);
@@ -254,12 +554,14 @@ public:
 
       if (type_param.has_value() && type_param.value() == "all")
       {
-        nlohmann::json annotations = select_annotations(text_object_id, language);
-        text_info[0]["annotations"] = annotations;
+        nlohmann::json text_info = nlohmann::json::parse(*text_payload);
+        text_info[0]["annotations"] = nlohmann::json::parse(select_annotations(text_object_id, language));
+        Logger::instance().info("Text data returned for text_object_id=" + std::to_string(text_object_id));
+        return request::make_json_request_response(text_info, req);
       }
 
       Logger::instance().info("Text data returned for text_object_id=" + std::to_string(text_object_id));
-      return request::make_json_request_response(text_info, req);
+      return request::make_json_payload_response(*text_payload, req);
     }
     else
     {
@@ -1,4 +1,5 @@
 #include "api.hpp"
+#include "../cache/local_cache.hpp"
 
 using namespace postgres;
 using namespace utils;
@@ -9,63 +10,217 @@ private:
   ConnectionPool &pool;
 
   /**
-   * Select title data from the database. This will return a list of text tiles
-   * along with their level and group ID. This is used for lazy loading on the
-   * front end as it takes page and page size params and the ID can be used
-   * later on to fetch more detailed information.
-   *
-   * @param page Page number to fetch.
-   * @param page_size Number of items to fetch.
-   * @param sort Sort order to use.
-   * @return JSON of title data.
+   * Position in the title listing. The sort order and filters travel with the
+   * cursor so every page of a listing is read the same way, and the last row
+   * of the previous page is the keyset to continue from.
    */
-  nlohmann::json select_title_data(int page, int page_size, int sort)
+  struct TitleCursor
   {
-    Logger::instance().debug("Selecting title data for page=" + std::to_string(page) + ", page_size=" + std::to_string(page_size) + ", sort=" + std::to_string(sort));
-    std::string sort_query;
-    nlohmann::json title_info = nlohmann::json::array();
+    int sort = 0;
+    std::optional<std::string> level;
+    std::optional<int> group_id;
+    std::optional<std::string> after_key;
+    std::optional<int> after_id;
+  };
 
-    std::string cache_key = "titles:" + std::to_string(page) + ":" +
-                            std::to_string(page_size) + ":" + std::to_string(sort);
-    sw::redis::Redis &redis = Redis::get_instance();
+  /**
+   * Encode bytes as unpadded base64url, so cursors can be sent in a query string.
+   * @param data Bytes to encode.
+   * @return Encoded string.
+   */
+  static std::string base64url_encode(const std::string &data)
+  {
+    std::string encoded(4 * ((data.size() + 2) / 3), '\0');
+    int length = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(encoded.data()),
+                                 reinterpret_cast<const unsigned char *>(data.data()), static_cast<int>(data.size()));
+    encoded.resize(length);
 
-    if (sort == 0)
+    while (!encoded.empty() && encoded.back() == '=')
     {
-      sort_query = "ORDER BY id";
+      encoded.pop_back();
     }
+    std::replace(encoded.begin(), encoded.end(), '+', '-');
+    std::replace(encoded.begin(), encoded.end(), '/', '_');
+    return encoded;
+  }
 
-    try
+  /**
+   * Decode an unpadded base64url string.
+   * @param encoded String to decode.
+   * @return Decoded bytes, or nothing if the string is not valid base64url.
+   */
+  static std::optional<std::string> base64url_decode(std::string encoded)
+  {
+    if (encoded.size() % 4 == 1)
     {
-      std::optional<std::string> cache_result = redis.get(cache_key);
+      return std::nullopt;
+    }
+    std::replace(encoded.begin(), encoded.end(), '-', '+');
+    std::replace(encoded.begin(), encoded.end(), '_', '/');
+    std::size_t padding = (4 - encoded.size() % 4) % 4;
+    encoded.append(padding, '=');
 
-      if (cache_result)
+    std::string decoded(3 * encoded.size() / 4, '\0');
+    int length = EVP_DecodeBlock(reinterpret_cast<unsigned char *>(decoded.data()),
+                                 reinterpret_cast<const unsigned char *>(encoded.data()), static_cast<int>(encoded.size()));
+    if (length < 0)
+    {
+      return std::nullopt;
+    }
+    decoded.resize(length - padding);
+    return decoded;
+  }
+
+  /**
+   * Encode a cursor as an opaque token.
+   * @param cursor Cursor to encode.
+   * @return Token to hand to the client.
+   */
+  static std::string encode_cursor(const TitleCursor &cursor)
+  {
+    nlohmann::json token = {
+        {"s", cursor.sort},
+        {"l", cursor.level ? nlohmann::json(*cursor.level) : nlohmann::json()},
+        {"g", cursor.group_id ? nlohmann::json(*cursor.group_id) : nlohmann::json()},
+        {"k", cursor.after_key ? nlohmann::json(*cursor.after_key) : nlohmann::json()},
+        {"i", cursor.after_id ? nlohmann::json(*cursor.after_id) : nlohmann::json()}};
+    return base64url_encode(token.dump());
+  }
+
+  /**
+   * Decode a token made by encode_cursor.
+   * @param token Token sent by the client.
+   * @return Cursor, or nothing if the token is malformed.
+   */
+  static std::optional<TitleCursor> decode_cursor(const std::string &token)
+  {
+    std::optional<std::string> decoded = base64url_decode(token);
+    if (!decoded)
+    {
+      return std::nullopt;
+    }
+
+    try
+    {
+      nlohmann::json json = nlohmann::json::parse(*decoded);
+      TitleCursor cursor;
+      cursor.sort = json.at("s").get<int>();
+      if (!json.at("l").is_null())
       {
-        Logger::instance().debug("Cache hit for " + cache_key);
-        return nlohmann::json::parse(*cache_result);
+        cursor.level = json.at("l").get<std::string>();
       }
-
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result r = txn.exec_prepared(
-          "select_titles",
-          std::to_string(page_size), std::to_string(page * page_size));
-      try
+      if (!json.at("g").is_null())
+      {
+        cursor.group_id = json.at("g").get<int>();
+      }
+      if (!json.at("k").is_null())
       {
-        txn.commit();
+        cursor.after_key = json.at("k").get<std::string>();
       }
-      catch (const std::exception &e)
+      if (!json.at("i").is_null())
       {
-        utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
-        throw;
+        cursor.after_id = json.at("i").get<int>();
       }
+      return cursor;
+    }
+    catch (const std::exception &)
+    {
+      return std::nullopt;
+    }
+  }
+
+  /**
+   * Query one page of titles and build its response body. One extra row is
+   * fetched to tell whether there is a next page. Pages are read from the
+   * primary, as they are reloaded right after the listing is refreshed there.
+   *
+   * @param cursor Cursor of the page to fetch.
+   * @param page_size Number of items to fetch.
+   * @return Serialised response body, or nothing if the page is empty.
+   */
+  static std::optional<std::string> load_title_page(const TitleCursor &cursor, int page_size)
+  {
+    request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+    pqxx::result r;
+    if (cursor.sort == 0)
+    {
+      r = txn.exec_prepared(
+          "select_titles",
+          page_size + 1, cursor.level, cursor.group_id, cursor.after_id);
+    }
+    else
+    {
+      r = txn.exec_prepared(
+          cursor.sort == 1 ? "select_titles_by_title" : "select_titles_by_level",
+          page_size + 1, cursor.level, cursor.group_id, cursor.after_key, cursor.after_id);
+    }
+    try
+    {
+      txn.commit();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
+      throw;
+    }
 
-      if (r.empty() || r[0][0].is_null())
+    if (r.empty() || r[0][0].is_null())
+    {
+      Logger::instance().debug("No titles found");
+      return std::nullopt;
+    }
+
+    nlohmann::json title_info = {{"status", "ok"}, {"next_cursor", nullptr}};
+    nlohmann::json titles = nlohmann::json::parse(r[0][0].as<std::string>());
+    if (titles.size() > static_cast<std::size_t>(page_size))
+    {
+      titles.erase(titles.begin() + page_size, titles.end());
+
+      const nlohmann::json &last = titles.back();
+      TitleCursor next = cursor;
+      next.after_id = last["id"].get<int>();
+      if (cursor.sort == 1)
       {
-        Logger::instance().debug("No titles found");
-        return title_info;
+        next.after_key = last["title"].get<std::string>();
       }
+      else if (cursor.sort == 2)
+      {
+        next.after_key = last["level"].get<std::string>();
+      }
+      title_info["next_cursor"] = encode_cursor(next);
+    }
+    title_info["message"] = std::move(titles);
+    return title_info.dump();
+  }
+
+  /**
+   * Select title data from the database. This will return a page of text titles
+   * along with their level and group ID, read from the mv_textobject_list view.
+   * This is used for lazy loading on the front end, and the ID can be used
+   * later on to fetch more detailed information.
+   *
+   * Pages are keyset based: the next page starts after the last row of this one,
+   * so pages stay correct when IDs have gaps. Each page is cached as a complete
+   * response body under a key derived from its cursor, so a cached page is sent
+   * without being parsed. Concurrent misses on the same page share one query,
+   * and a page past its soft TTL is served while it is refreshed in the background.
+   *
+   * @param cursor Cursor of the page to fetch.
+   * @param page_size Number of items to fetch.
+   * @return Serialised response body with the titles of the page and the cursor
+   * of the next page, or nullptr if the page is empty.
+   */
+  local_cache::LocalCache::Value select_title_data(const TitleCursor &cursor, int page_size)
+  {
+    std::string token = encode_cursor(cursor);
+    Logger::instance().debug("Selecting title data for cursor=" + token + ", page_size=" + std::to_string(page_size));
+
+    std::string cache_key = "titles:page:" + std::to_string(page_size) + ":" + token;
 
-      title_info = nlohmann::json::parse(r[0][0].as<std::string>());
-      redis.set(cache_key, title_info.dump(), std::chrono::seconds(300)); // 5 minutes
+    try
+    {
+      return local_cache::load_through(cache_key, local_cache::generation_key("titles:page"), std::chrono::seconds(3600), [cursor, page_size] // 1 hour
+                                       { return load_title_page(cursor, page_size); });
     }
     catch (const std::exception &e)
     {
@@ -75,7 +230,7 @@ private:
     {
       utils::Logger::instance().error("Unknown error while executing query");
     }
-    return title_info;
+    return nullptr;
   }
 
 public:
@@ -88,6 +243,11 @@ public:
     return "/titles";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Titles endpoint called: " + std::string(req.method_string()));
@@ -99,47 +259,88 @@ public:
     {
       Logger::instance().debug("GET titles requested");
       /**
-       * GET text titles
+       * GET text titles. The first page is requested with optional sort, level and
+       * group_id parameters; later pages pass the next_cursor of the previous page,
+       * which carries the sort and filters with it.
        */
       std::optional<std::string> page_param = request::parse_from_request(req, "page");
       std::optional<std::string> page_size_param = request::parse_from_request(req, "page_size");
       std::optional<std::string> sort_param = request::parse_from_request(req, "sort");
+      std::optional<std::string> level_param = request::parse_from_request(req, "level");
+      std::optional<std::string> group_id_param = request::parse_from_request(req, "group_id");
+      std::optional<std::string> cursor_param = request::parse_from_request(req, "cursor");
 
-      if (!page_param || !page_size_param)
+      if (!page_size_param)
       {
-        return request::make_bad_request_response("Missing parameters page | page_size", req);
+        return request::make_bad_request_response("Missing parameter page_size", req);
       }
 
-      int page, page_size, sort = 0;
+      int page = 0, page_size;
+      TitleCursor cursor;
 
       try
       {
-        page = std::stoi(page_param.value());
         page_size = std::stoi(page_size_param.value());
 
+        if (page_param)
+        {
+          page = std::stoi(page_param.value());
+        }
         if (sort_param)
         {
-          sort = std::stoi(sort_param.value());
+          cursor.sort = std::stoi(sort_param.value());
+        }
+        if (group_id_param)
+        {
+          cursor.group_id = std::stoi(group_id_param.value());
         }
       }
       catch (const std::invalid_argument &)
       {
-        return request::make_bad_request_response("Invalid numeric value for page | page_size | sort", req);
+        return request::make_bad_request_response("Invalid numeric value for page | page_size | sort | group_id", req);
       }
       catch (const std::out_of_range &)
       {
-        return request::make_bad_request_response("Number out of range for page | page_size | sort", req);
+        return request::make_bad_request_response("Number out of range for page | page_size | sort | group_id", req);
+      }
+
+      if (page_size < 1 || page_size > 1000)
+      {
+        return request::make_bad_request_response("page_size must be between 1 and 1000", req);
+      }
+      if (page != 0)
+      {
+        return request::make_bad_request_response("Use cursor to fetch pages after the first", req);
+      }
+      if (level_param)
+      {
+        cursor.level = level_param.value();
+      }
+
+      if (cursor_param)
+      {
+        std::optional<TitleCursor> decoded = decode_cursor(cursor_param.value());
+        if (!decoded)
+        {
+          return request::make_bad_request_response("Invalid cursor", req);
+        }
+        cursor = std::move(*decoded);
+      }
+
+      if (cursor.sort < 0 || cursor.sort > 2)
+      {
+        return request::make_bad_request_response("Invalid value for sort", req);
       }
 
-      nlohmann::json title_info = select_title_data(page, page_size, sort);
-      if (title_info.empty())
+      local_cache::LocalCache::Value title_info = select_title_data(cursor, page_size);
+      if (!title_info)
       {
-        Logger::instance().info("No titles found for page=" + std::to_string(page));
+        Logger::instance().info("No titles found");
         return request::make_bad_request_response("No titles found", req);
       }
-      Logger::instance().info("Titles data returned for page=" + std::to_string(page));
+      Logger::instance().info("Titles data returned");
 
-      return request::make_json_request_response(title_info, req);
+      return request::make_json_body_response(*title_info, req);
     }
     else
     {
@@ -152,4 +353,4 @@ public:
 extern "C" RequestHandler *create_titles_handler()
 {
   return new TitlesHandler(get_connection_pool());
-}
\ No newline at end of file
+}
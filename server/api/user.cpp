@@ -68,7 +68,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_user_id", username);
       try
@@ -108,7 +108,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_email", email);
       try
@@ -151,7 +151,7 @@ private:
 
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
 
       pqxx::result r = txn.exec_prepared(
           "select_user_data_by_id", id);
@@ -190,7 +190,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_username_by_id", id);
       try
@@ -228,7 +228,7 @@ private:
   {
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "select_user_password", username);
       try
@@ -271,7 +271,7 @@ private:
     try
     {
       int current_time = static_cast<int>(std::time(0));
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
           "insert_user",
           username, email, hashed_password, current_time);
@@ -326,6 +326,11 @@ public:
     return "/user";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get, http::verb::post, http::verb::put};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("User endpoint called: " + std::string(req.method_string()));
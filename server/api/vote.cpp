@@ -14,15 +14,16 @@ private:
    * the user ID that performed the interaction.
    *
    * @param annotation_id ID of the annotation to select interactions for.
+   * @param session_id Session of the reader, so their own recent writes are visible.
    * @return JSON of interaction data.
    */
-  nlohmann::json select_interaction_data(int annotation_id)
+  nlohmann::json select_interaction_data(int annotation_id, std::string_view session_id)
   {
     Logger::instance().debug("Selecting interaction data for annotation_id=" + std::to_string(annotation_id));
     nlohmann::json vote_info = nlohmann::json::array();
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_read_transaction(session_id);
       pqxx::result r = txn.exec_prepared(
           "select_interaction_data",
           annotation_id);
@@ -54,64 +55,31 @@ private:
   }
 
   /**
-   * Select the interaction type for a specific annotation and user.
-   * This is used to determine if the user has already liked or disliked an annotation.
+   * Toggle a user's interaction with an annotation in a single statement. Voting
+   * the same way again removes the vote; voting the other way replaces it. The
+   * annotation row is locked first, so concurrent votes on it apply one after
+   * the other and the toggle always sees the vote committed before it.
    *
-   * @param annotation_id ID of the annotation to select the interaction for.
-   * @param user_id ID of the user to select the interaction for.
-   * @return Interaction type (LIKE or DISLIKE) if found, empty string otherwise.
+   * @param annotation_id ID of the annotation to toggle the interaction for.
+   * @param user_id ID of the user toggling the interaction.
+   * @param interaction_type Type of interaction (LIKE or DISLIKE).
+   * @param session_id Session making the write, for read-your-writes.
+   * @return JSON of the user's new interaction (null if removed) and the
+   * annotation's like and dislike counts, empty on failure.
    */
-  std::string select_annotation_interaction_type(int annotation_id, int user_id)
+  nlohmann::json toggle_interaction(int annotation_id, int user_id, std::string interaction_type, std::string_view session_id)
   {
+    Logger::instance().debug("Toggling interaction for annotation_id=" + std::to_string(annotation_id) + ", user_id=" + std::to_string(user_id));
     try
     {
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result r = txn.exec_prepared(
-          "select_annotation_interaction_type",
-          annotation_id, user_id);
-      try
+      request::PooledTxn txn = request::begin_transaction(pool, session_id);
+      if (txn.exec_prepared("lock_annotation_votes", annotation_id).empty())
       {
-        txn.commit();
-      }
-      catch (const std::exception &e)
-      {
-        utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
-        throw;
-      }
-      if (r.empty())
-      {
-        utils::Logger::instance().debug("Annotation interaction not found");
-        return "";
+        utils::Logger::instance().error("Cannot toggle interaction on missing annotation " + std::to_string(annotation_id));
+        return nlohmann::json();
       }
-      return r[0][0].as<std::string>();
-    }
-    catch (const std::exception &e)
-    {
-      Logger::instance().error(std::string("Error executing query: ") + e.what());
-    }
-    catch (...)
-    {
-      utils::Logger::instance().error("Unknown error while executing query");
-    }
-    return "";
-  }
-
-  /**
-   * Insert a new interaction for a specific annotation and user.
-   *
-   * @param annotation_id ID of the annotation to insert the interaction for.
-   * @param user_id ID of the user to insert the interaction for.
-   * @param interaction_type Type of interaction (LIKE or DISLIKE).
-   * @return true if the interaction was inserted, false otherwise.
-   */
-  bool insert_interaction(int annotation_id, int user_id, std::string interaction_type)
-  {
-    Logger::instance().debug("Inserting interaction for annotation_id=" + std::to_string(annotation_id) + ", user_id=" + std::to_string(user_id));
-    try
-    {
-      pqxx::work &txn = request::begin_transaction(pool);
       pqxx::result r = txn.exec_prepared(
-          "insert_interaction",
+          "toggle_interaction",
           annotation_id, user_id, interaction_type);
       try
       {
@@ -122,55 +90,20 @@ private:
         utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
         throw;
       }
-      if (r.affected_rows() == 0)
+      if (r.empty() || r[0][0].is_null())
       {
-        utils::Logger::instance().error("Failed to insert interaction");
-        return false;
+        utils::Logger::instance().error("Failed to toggle interaction");
+        return nlohmann::json();
       }
-      return true;
-    }
-    catch (const std::exception &e)
-    {
-      Logger::instance().error(std::string("Error executing query: ") + e.what());
-    }
-    catch (...)
-    {
-      utils::Logger::instance().error("Unknown error while executing query");
-    }
-    return false;
-  }
-
-  /**
-   * Delete an interaction for a specific annotation and user.
-   *
-   * @param annotation_id ID of the annotation to delete the interaction for.
-   * @param user_id ID of the user to delete the interaction for.
-   * @return true if the interaction was deleted, false otherwise.
-   */
-  bool delete_interaction(int annotation_id, int user_id)
-  {
-    Logger::instance().debug("Deleting interaction for annotation_id=" + std::to_string(annotation_id) + ", user_id=" + std::to_string(user_id));
-    try
-    {
-      pqxx::work &txn = request::begin_transaction(pool);
-      pqxx::result r = txn.exec_prepared(
-          "delete_interaction",
-          annotation_id, user_id);
       try
       {
-        txn.commit();
+        Redis::get_instance().del("profile:" + std::to_string(user_id));
       }
       catch (const std::exception &e)
       {
-        utils::Logger::instance().error(std::string("Error committing transaction: ") + e.what());
-        throw;
-      }
-      if (r.affected_rows() == 0)
-      {
-        utils::Logger::instance().debug("Interaction not found");
-        return false;
+        Logger::instance().error(std::string("Error invalidating profile cache: ") + e.what());
       }
-      return true;
+      return nlohmann::json::parse(r[0][0].as<std::string>());
     }
     catch (const std::exception &e)
     {
@@ -180,7 +113,7 @@ private:
     {
       utils::Logger::instance().error("Unknown error while executing query");
     }
-    return false;
+    return nlohmann::json();
   }
 
 public:
@@ -193,6 +126,11 @@ public:
     return "/vote";
   }
 
+  std::vector<http::verb> get_methods() const override
+  {
+    return {http::verb::get, http::verb::post};
+  }
+
   http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address)
   {
     Logger::instance().info("Vote endpoint called: " + std::string(req.method_string()));
@@ -226,7 +164,7 @@ public:
         return request::make_bad_request_response("Number out of range for annotation_id", req);
       }
 
-      nlohmann::json vote_info = select_interaction_data(annotation_id);
+      nlohmann::json vote_info = select_interaction_data(annotation_id, request::get_session_id_from_cookie(req));
       if (vote_info.empty())
       {
         Logger::instance().info("No interactions found for annotation_id=" + std::to_string(annotation_id));
@@ -297,37 +235,16 @@ public:
         return request::make_unauthorized_response("User has not accepted the privacy policy", req);
       }
 
-      std::string interaction_type = select_annotation_interaction_type(annotation_id, user_id);
       std::string new_interaction_type = interaction == 1 ? "LIKE" : "DISLIKE";
-
-      if (interaction_type.empty())
-      {
-        // Insert the Interaction
-        if (!insert_interaction(annotation_id, user_id, new_interaction_type))
-        {
-          Logger::instance().error("Failed to insert interaction for annotation_id=" + std::to_string(annotation_id));
-          return request::make_bad_request_response("Failed to insert interaction", req);
-        }
-        Logger::instance().info("Interaction inserted for annotation_id=" + std::to_string(annotation_id));
-        return request::make_ok_request_response("Interaction inserted", req);
-      }
-
-      if (!delete_interaction(annotation_id, user_id))
-      {
-        return request::make_bad_request_response("Failed to delete interaction", req);
-      }
-      if (interaction_type == new_interaction_type)
-      {
-        return request::make_ok_request_response("Interaction removed", req);
-      }
-
-      // Insert the Interaction
-      if (!insert_interaction(annotation_id, user_id, new_interaction_type))
+      nlohmann::json vote_state = toggle_interaction(annotation_id, user_id, new_interaction_type, session_id);
+      if (vote_state.empty())
       {
-        return request::make_bad_request_response("Failed to insert interaction", req);
+        Logger::instance().error("Failed to toggle interaction for annotation_id=" + std::to_string(annotation_id));
+        return request::make_bad_request_response("Failed to toggle interaction", req);
       }
 
-      return request::make_ok_request_response("Interaction inserted", req);
+      Logger::instance().info("Interaction toggled for annotation_id=" + std::to_string(annotation_id));
+      return request::make_json_request_response(vote_state, req);
     }
     else
     {
@@ -0,0 +1,198 @@
+#include "annotation_cache.hpp"
+#include "local_cache.hpp"
+#include "../db/redis.hpp"
+#include "../index/annotation_index.hpp"
+#include "../request/request.hpp"
+#include "../utils.hpp"
+
+namespace annotation_cache
+{
+  namespace
+  {
+    std::string list_key(int text_id)
+    {
+      return "annotations:" + std::to_string(text_id);
+    }
+
+    std::string generation_key(int text_id)
+    {
+      return "annotations:" + std::to_string(text_id) + ":generation";
+    }
+
+    std::string text_id_key(int text_object_id, const std::string &language)
+    {
+      return "text_id:" + std::to_string(text_object_id) + ":" + language;
+    }
+
+    local_cache::Loader make_text_id_loader(int text_object_id, std::string language)
+    {
+      return [text_object_id, language]() -> std::optional<std::string>
+      {
+        request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+        pqxx::result r = txn.exec_prepared(
+            "select_text_id",
+            std::to_string(text_object_id), language);
+        txn.commit();
+
+        if (r.empty())
+        {
+          return std::nullopt;
+        }
+        return r[0][0].as<std::string>();
+      };
+    }
+  }
+
+  /**
+   * Select the ID of a text from its text object and language. The mapping does
+   * not change while the text exists, so it is cached for TEXT_ID_TTL_SEC.
+   *
+   * @param text_object_id ID of the text object of the text.
+   * @param language Language of the text.
+   * @return ID of the text, or nothing if there is no such text.
+   */
+  std::optional<int> select_text_id(int text_object_id, const std::string &language)
+  {
+    local_cache::LocalCache::Value text_id = local_cache::load_through(text_id_key(text_object_id, language), local_cache::generation_key(text_id_key(text_object_id, language)), std::chrono::seconds(TEXT_ID_TTL_SEC), make_text_id_loader(text_object_id, language));
+    if (!text_id)
+    {
+      return std::nullopt;
+    }
+    return std::stoi(*text_id);
+  }
+
+  /**
+   * Look up the cached ID of a text without querying the database.
+   * @param text_object_id ID of the text object of the text.
+   * @param language Language of the text.
+   * @return ID of the text, or nothing if it is not cached.
+   */
+  std::optional<int> find_text_id(int text_object_id, const std::string &language)
+  {
+    local_cache::LocalCache::Value text_id = local_cache::read_through(text_id_key(text_object_id, language), local_cache::generation_key(text_id_key(text_object_id, language)), std::chrono::seconds(TEXT_ID_TTL_SEC), make_text_id_loader(text_object_id, language));
+    if (!text_id)
+    {
+      return std::nullopt;
+    }
+    return std::stoi(*text_id);
+  }
+
+  /**
+   * Look up the cached annotation list of a text, along with the text's current
+   * generation, in one MGET. A list stored under an older generation is a miss.
+   *
+   * @param text_id ID of the text.
+   * @return Current generation, and the list if it is cached and current. The
+   * generation is empty if Redis could not be read.
+   */
+  Lookup find_annotations(int text_id)
+  {
+    Lookup lookup;
+    try
+    {
+      std::vector<std::string> keys = {generation_key(text_id), list_key(text_id)};
+      std::vector<sw::redis::OptionalString> cache_results;
+      cache_results.reserve(keys.size());
+      Redis::get_instance().mget(keys.begin(), keys.end(), std::back_inserter(cache_results));
+      if (cache_results.size() != keys.size())
+      {
+        return lookup;
+      }
+
+      lookup.generation = cache_results[0].value_or("0");
+      const std::string prefix = *lookup.generation + "\n";
+      if (cache_results[1] && cache_results[1]->compare(0, prefix.size(), prefix) == 0)
+      {
+        lookup.payload = cache_results[1]->substr(prefix.size());
+      }
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error reading annotation list from Redis: ") + e.what());
+    }
+    return lookup;
+  }
+
+  /**
+   * Cache the annotation list of a text. The list must have been read from the
+   * primary after the generation was read, so it reflects every write counted
+   * by that generation.
+   *
+   * @param text_id ID of the text.
+   * @param generation Generation read before the list was loaded.
+   * @param payload Serialised annotation list.
+   */
+  void store_annotations(int text_id, const std::string &generation, const std::string &payload)
+  {
+    try
+    {
+      Redis::get_instance().set(list_key(text_id), generation + "\n" + payload, std::chrono::seconds(LIST_TTL_SEC));
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error writing annotation list to Redis: ") + e.what());
+    }
+  }
+
+  /**
+   * Select the annotation list of a text, loading it from the primary on a miss.
+   * Concurrent misses on the same text and generation share one load.
+   *
+   * Example result:
+   * [{"end":10,"id":1,"start":0,"text_id":1}]
+   *
+   * @param text_id ID of the text.
+   * @return Serialised JSON array of annotation positions, ordered by start.
+   */
+  std::string select_annotations(int text_id)
+  {
+    Lookup lookup = find_annotations(text_id);
+    if (lookup.payload)
+    {
+      return *lookup.payload;
+    }
+
+    // A caller that saw a newer generation must not join a load started under an
+    // older one, which may predate the write that moved the generation on.
+    std::string flight_key = list_key(text_id) + ":" + lookup.generation.value_or("");
+    local_cache::LocalCache::Value payload = local_cache::get_single_flight().run(flight_key, [text_id, &lookup]
+                                                                                  {
+      std::vector<annotation_index::Interval> intervals = annotation_index::get_annotation_index().all(text_id);
+
+      nlohmann::json annotations = nlohmann::json::array();
+      for (const annotation_index::Interval &interval : intervals)
+      {
+        annotations.push_back({{"id", interval.id}, {"start", interval.start}, {"end", interval.end}, {"text_id", text_id}});
+      }
+
+      std::string serialised = annotations.dump();
+      if (lookup.generation)
+      {
+        store_annotations(text_id, *lookup.generation, serialised);
+      }
+      return std::make_shared<const std::string>(std::move(serialised)); });
+    return *payload;
+  }
+
+  /**
+   * Invalidate the cached annotation list of a text. Called after a write to the
+   * text's annotations has committed: the generation moves on, so any list read
+   * before the write is ignored even if it is stored afterwards.
+   *
+   * @param text_id ID of the text.
+   */
+  void invalidate(int text_id)
+  {
+    try
+    {
+      sw::redis::Pipeline pipeline = Redis::get_instance().pipeline(false);
+      pipeline.incr(generation_key(text_id));
+      pipeline.del(list_key(text_id));
+      pipeline.exec();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error invalidating annotation list: ") + e.what());
+    }
+  }
+}
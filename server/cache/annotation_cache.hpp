@@ -0,0 +1,34 @@
+#ifndef ANNOTATION_CACHE_HPP
+#define ANNOTATION_CACHE_HPP
+
+#include <optional>
+#include <string>
+
+namespace annotation_cache
+{
+  const int LIST_TTL_SEC = 3600;
+  const int TEXT_ID_TTL_SEC = 86400;
+
+  /**
+   * @brief Annotation list of a text as found in Redis.
+   *
+   * Every list is stored with the generation of its text at the time it was
+   * read from the database. Writers bump the generation after committing, so a
+   * list that was read before a write can never be mistaken for a current one.
+   */
+  struct Lookup
+  {
+    std::optional<std::string> generation;
+    std::optional<std::string> payload;
+  };
+
+  std::optional<int> select_text_id(int text_object_id, const std::string &language);
+  std::optional<int> find_text_id(int text_object_id, const std::string &language);
+
+  Lookup find_annotations(int text_id);
+  void store_annotations(int text_id, const std::string &generation, const std::string &payload);
+  std::string select_annotations(int text_id);
+  void invalidate(int text_id);
+}
+
+#endif
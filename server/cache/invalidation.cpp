@@ -0,0 +1,657 @@
+#include "invalidation.hpp"
+#include "annotation_cache.hpp"
+#include "local_cache.hpp"
+#include "../db/redis.hpp"
+#include "../index/annotation_index.hpp"
+#include "../index/text_index.hpp"
+#include "../index/title_index.hpp"
+#include "../request/request.hpp"
+#include "../utils.hpp"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <set>
+#include <utility>
+
+namespace invalidation
+{
+  static Listener *global_listener = nullptr;
+
+  // Number of the listener's current connection, 0 while it is disconnected.
+  static std::atomic<std::uint64_t> current_epoch{0};
+
+  namespace
+  {
+    using TextKey = std::pair<int, std::string>;
+
+    /**
+     * @brief Cached data touched by a batch of change notifications.
+     */
+    struct Changes
+    {
+      std::set<TextKey> texts;
+      std::set<TextKey> briefs;
+      std::set<int> text_ids;
+      std::set<int> text_object_ids;
+      std::set<int> group_ids;
+      std::set<int> audio_ids;
+      std::set<int> annotated_text_ids;
+      std::set<long long> title_txids;
+      bool titles_refreshed = false;
+
+      bool empty() const
+      {
+        return texts.empty() && briefs.empty() && text_ids.empty() && text_object_ids.empty() &&
+               group_ids.empty() && audio_ids.empty() && annotated_text_ids.empty() &&
+               title_txids.empty() && !titles_refreshed;
+      }
+    };
+
+    std::string text_key(const TextKey &key)
+    {
+      return "text:" + std::to_string(key.first) + ":" + key.second;
+    }
+
+    std::string to_array(const std::set<int> &ids)
+    {
+      std::string array;
+      for (int id : ids)
+      {
+        array += (array.empty() ? "" : ",") + std::to_string(id);
+      }
+      return "{" + array + "}";
+    }
+
+    /**
+     * Record what one notification touches.
+     *
+     * Example payload:
+     * {"table":"Text","txid":1234,"id":1,"text_object_id":1,"language":"GR"}
+     *
+     * @param changes Changes of the current batch.
+     * @param payload Payload of the notification.
+     */
+    void add_notification(Changes &changes, const char *payload)
+    {
+      nlohmann::json data = nlohmann::json::parse(payload, nullptr, false);
+      if (!data.is_object() || !data.contains("table") || !data["table"].is_string() ||
+          (data.contains("id") && !data["id"].is_number_integer()))
+      {
+        utils::Logger::instance().error(std::string("Ignoring malformed cache invalidation: ") + payload);
+        return;
+      }
+
+      std::string table = data["table"].get<std::string>();
+      if (table == "mv_textobject_list")
+      {
+        changes.titles_refreshed = true;
+        return;
+      }
+      if (!data.contains("id"))
+      {
+        return;
+      }
+
+      int id = data["id"].get<int>();
+      if (table == "Text")
+      {
+        changes.text_ids.insert(id);
+        if (data.contains("text_object_id") && data["text_object_id"].is_number_integer() &&
+            data.contains("language") && data["language"].is_string())
+        {
+          // Briefs list the languages of their text object, so every brief of
+          // the text object changes along with the text.
+          TextKey key{data["text_object_id"].get<int>(), data["language"].get<std::string>()};
+          changes.texts.insert(key);
+          changes.briefs.insert(key);
+          changes.text_object_ids.insert(key.first);
+        }
+      }
+      else if (table == "TextObject")
+      {
+        changes.text_object_ids.insert(id);
+        changes.title_txids.insert(data.contains("txid") && data["txid"].is_number_integer() ? data["txid"].get<long long>() : 0LL);
+      }
+      else if (table == "TextGroup")
+      {
+        changes.group_ids.insert(id);
+      }
+      else if (table == "Audio")
+      {
+        changes.audio_ids.insert(id);
+      }
+      else if (table == "Annotation" && data.contains("text_id") && data["text_id"].is_number_integer())
+      {
+        changes.annotated_text_ids.insert(data["text_id"].get<int>());
+      }
+    }
+
+    /**
+     * Find the texts whose cached payloads embed a changed text object, group or
+     * audio file.
+     * @param changes Changes of the current batch, given the texts found.
+     */
+    void resolve_texts(Changes &changes)
+    {
+      if (changes.text_object_ids.empty() && changes.group_ids.empty() && changes.audio_ids.empty())
+      {
+        return;
+      }
+
+      request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+      pqxx::result r = txn.exec_prepared(
+          "select_invalidated_texts",
+          to_array(changes.text_object_ids), to_array(changes.group_ids), to_array(changes.audio_ids));
+      txn.commit();
+
+      for (const auto &row : r)
+      {
+        TextKey key{row[0].as<int>(), row[1].as<std::string>()};
+        changes.briefs.insert(key);
+        if (row[2].as<bool>())
+        {
+          changes.texts.insert(key);
+        }
+      }
+    }
+
+    /**
+     * Purge the cached details, briefs and text IDs of changed texts from Redis
+     * and the local cache. Their generations are bumped, so a load that started
+     * before the change is not stored, and soft TTL markers are dropped with
+     * their payloads.
+     *
+     * @param changes Changes of the current batch.
+     */
+    void purge_texts(const Changes &changes)
+    {
+      std::vector<std::string> keys;
+      for (const TextKey &key : changes.texts)
+      {
+        keys.push_back(text_key(key));
+        keys.push_back("text_id:" + std::to_string(key.first) + ":" + key.second);
+      }
+      for (const TextKey &key : changes.briefs)
+      {
+        keys.push_back(text_key(key) + ":brief");
+      }
+      if (keys.empty())
+      {
+        return;
+      }
+
+      local_cache::LocalCache &local = local_cache::get_local_cache();
+      for (const std::string &key : keys)
+      {
+        local.erase(key);
+      }
+
+      try
+      {
+        sw::redis::Pipeline pipeline = Redis::get_instance().pipeline(false);
+        for (const std::string &key : keys)
+        {
+          local_cache::queue_invalidate(pipeline, key, local_cache::generation_key(key));
+        }
+        pipeline.exec();
+      }
+      catch (const std::exception &e)
+      {
+        utils::Logger::instance().error(std::string("Error purging texts from Redis: ") + e.what());
+      }
+    }
+
+    /**
+     * Find every Redis key matching a pattern.
+     * @param redis Redis client.
+     * @param pattern Glob-style pattern.
+     * @param keys Keys found, appended to.
+     */
+    void scan_keys(sw::redis::Redis &redis, const std::string &pattern, std::vector<std::string> &keys)
+    {
+      long long cursor = 0;
+      do
+      {
+        cursor = redis.scan(cursor, pattern, 100, std::back_inserter(keys));
+      } while (cursor != 0);
+    }
+
+    /**
+     * Purge every cached title page. Pages are keyed by cursor, so they are
+     * found with SCAN. They share one generation, which is bumped first so no
+     * page loaded before the purge is stored afterwards.
+     */
+    void purge_titles()
+    {
+      local_cache::get_local_cache().erase_prefix("titles:page:");
+
+      try
+      {
+        sw::redis::Redis &redis = Redis::get_instance();
+        const std::string generation_key = local_cache::generation_key("titles:page");
+        redis.incr(generation_key);
+
+        std::vector<std::string> keys;
+        scan_keys(redis, "titles:page:*", keys);
+        scan_keys(redis, local_cache::fresh_key("titles:page:*"), keys);
+        std::erase(keys, generation_key);
+        if (!keys.empty())
+        {
+          redis.del(keys.begin(), keys.end());
+        }
+      }
+      catch (const std::exception &e)
+      {
+        utils::Logger::instance().error(std::string("Error purging title pages from Redis: ") + e.what());
+      }
+    }
+
+    /**
+     * Refresh the title listing after text object changes, once across all
+     * servers. The server that takes the lease on a changing transaction
+     * refreshes the view and announces it in the same transaction; every server
+     * drops its title pages when the announcement arrives, so no page is purged
+     * before the view has caught up.
+     *
+     * @param txids Transactions that changed text objects.
+     */
+    void refresh_titles(const std::set<long long> &txids)
+    {
+      bool leased = false;
+      try
+      {
+        sw::redis::Redis &redis = Redis::get_instance();
+        for (long long txid : txids)
+        {
+          leased = redis.set("titles:refresh:" + std::to_string(txid), "1", std::chrono::seconds(TITLES_REFRESH_LEASE_SEC), sw::redis::UpdateType::NOT_EXIST) || leased;
+        }
+      }
+      catch (const std::exception &e)
+      {
+        utils::Logger::instance().error(std::string("Error leasing title refresh: ") + e.what());
+        leased = true;
+      }
+      if (!leased)
+      {
+        return;
+      }
+
+      request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+      txn.exec_prepared("refresh_textobject_list");
+      txn.exec_prepared("notify_cache_invalidation", nlohmann::json{{"table", "mv_textobject_list"}}.dump());
+      txn.commit();
+    }
+
+    /**
+     * Apply a batch of changes. Each step runs on its own, so one failing does
+     * not leave the rest of the batch unapplied.
+     * @param changes Changes of the current batch.
+     */
+    void apply_changes(Changes &changes)
+    {
+      auto attempt = [](const char *step, auto &&fn)
+      {
+        try
+        {
+          fn();
+        }
+        catch (const std::exception &e)
+        {
+          utils::Logger::instance().error(std::string("Error ") + step + ": " + e.what());
+        }
+      };
+
+      attempt("resolving invalidated texts", [&changes]
+              { resolve_texts(changes); });
+      purge_texts(changes);
+
+      for (int text_id : changes.annotated_text_ids)
+      {
+        annotation_cache::invalidate(text_id);
+        annotation_index::get_annotation_index().invalidate(text_id);
+      }
+
+      for (int text_id : changes.text_ids)
+      {
+        attempt("reloading text into search index", [text_id]
+                { text_index::reload_text(text_id); });
+      }
+
+      if (!changes.title_txids.empty())
+      {
+        attempt("rebuilding title suggester", []
+                { title_index::load_titles(); });
+        attempt("refreshing title listing", [&changes]
+                { refresh_titles(changes.title_txids); });
+      }
+
+      if (changes.titles_refreshed)
+      {
+        purge_titles();
+      }
+
+      utils::Logger::instance().info("Invalidated " + std::to_string(changes.texts.size()) + " texts, " +
+                                     std::to_string(changes.briefs.size()) + " briefs and " +
+                                     std::to_string(changes.annotated_text_ids.size()) + " annotation lists");
+    }
+
+    /**
+     * Wait until the connection has input.
+     * @return Positive if there is input, 0 on timeout, negative on error.
+     */
+    int wait_readable(PGconn *conn, int timeout_ms)
+    {
+      pollfd fd{PQsocket(conn), POLLIN, 0};
+      int ready = poll(&fd, 1, timeout_ms);
+      return ready < 0 && errno == EINTR ? 0 : ready;
+    }
+
+    /**
+     * Read pending input and record every notification in it.
+     * @return False if the connection failed.
+     */
+    bool drain(PGconn *conn, Changes &changes)
+    {
+      if (!PQconsumeInput(conn))
+      {
+        utils::Logger::instance().error(std::string("Cache invalidation listener lost its connection: ") + PQerrorMessage(conn));
+        return false;
+      }
+      while (PGnotify *notify = PQnotifies(conn))
+      {
+        try
+        {
+          add_notification(changes, notify->extra);
+        }
+        catch (const std::exception &e)
+        {
+          utils::Logger::instance().error(std::string("Ignoring cache invalidation ") + notify->extra + ": " + e.what());
+        }
+        PQfreemem(notify);
+      }
+      return true;
+    }
+
+    bool listen(PGconn *conn)
+    {
+      PGresult *r = PQexec(conn, "LISTEN cache_invalidation");
+      bool ok = PQresultStatus(r) == PGRES_COMMAND_OK;
+      PQclear(r);
+      return ok;
+    }
+
+    long long now_ms()
+    {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * Check whether another server's listener has been connected since before
+     * a point in time and still is. Its connection time is compared with a
+     * margin of HEARTBEAT_TTL_SEC to allow for clock skew between servers.
+     *
+     * @param own_key Heartbeat key of this server, which is skipped.
+     * @param since Time in milliseconds since the epoch.
+     * @return true if some other listener received every notification since then.
+     */
+    bool listened_throughout(const std::string &own_key, long long since)
+    {
+      try
+      {
+        sw::redis::Redis &redis = Redis::get_instance();
+        std::vector<std::string> keys;
+        scan_keys(redis, "invalidation:listener:*", keys);
+        for (const std::string &key : keys)
+        {
+          if (key == own_key)
+          {
+            continue;
+          }
+          sw::redis::OptionalString value = redis.get(key);
+          if (value && std::stoll(*value) <= since - HEARTBEAT_TTL_SEC * 1000LL)
+          {
+            return true;
+          }
+        }
+      }
+      catch (const std::exception &e)
+      {
+        utils::Logger::instance().error(std::string("Error reading listener heartbeats: ") + e.what());
+      }
+      return false;
+    }
+
+    /**
+     * Purge every cached text, brief, text ID, title page and annotation list
+     * from Redis. Generations are bumped rather than deleted, so a value loaded
+     * before the purge can never be stored under a current generation.
+     */
+    void purge_all()
+    {
+      try
+      {
+        sw::redis::Redis &redis = Redis::get_instance();
+        std::vector<std::string> scanned;
+        for (const std::string &prefix : {std::string("text:"), std::string("text_id:"), std::string("titles:page:")})
+        {
+          scan_keys(redis, prefix + "*", scanned);
+          scan_keys(redis, local_cache::fresh_key(prefix + "*"), scanned);
+        }
+        scan_keys(redis, "annotations:*", scanned);
+
+        const std::string generation_suffix = ":generation";
+        std::vector<std::string> keys;
+        sw::redis::Pipeline pipeline = redis.pipeline(false);
+        for (const std::string &key : scanned)
+        {
+          if (key.size() > generation_suffix.size() &&
+              key.compare(key.size() - generation_suffix.size(), generation_suffix.size(), generation_suffix) == 0)
+          {
+            pipeline.incr(key);
+          }
+          else
+          {
+            keys.push_back(key);
+          }
+        }
+        if (!keys.empty())
+        {
+          pipeline.del(keys.begin(), keys.end());
+        }
+        pipeline.exec();
+        utils::Logger::instance().info("Purged " + std::to_string(keys.size()) + " cached keys from Redis after reconnecting");
+      }
+      catch (const std::exception &e)
+      {
+        utils::Logger::instance().error(std::string("Error purging Redis after reconnecting: ") + e.what());
+      }
+    }
+
+    /**
+     * Recover from a dropped connection. Notifications sent while disconnected
+     * are lost, so the local cache is dropped and the indexes rebuilt.
+     * Annotation ranges reload on their own, as they are tied to the listener's
+     * previous connection. Redis is shared, and the listeners of other servers
+     * purge it for every change; it is only purged here if none of them
+     * listened throughout the gap.
+     *
+     * @param heartbeat_key Heartbeat key of this server.
+     * @param disconnected_at Last time the previous connection was known to be up.
+     */
+    void recover(const std::string &heartbeat_key, long long disconnected_at)
+    {
+      if (!listened_throughout(heartbeat_key, disconnected_at))
+      {
+        utils::Logger::instance().info("No other cache invalidation listener covered the gap, purging Redis");
+        purge_all();
+      }
+      local_cache::get_local_cache().clear();
+      try
+      {
+        text_index::load_texts();
+        title_index::load_titles();
+      }
+      catch (const std::exception &e)
+      {
+        utils::Logger::instance().error(std::string("Error rebuilding indexes after reconnecting: ") + e.what());
+      }
+    }
+  }
+
+  /**
+   * Start listening on a dedicated thread.
+   */
+  Listener::Listener() : heartbeat_key("invalidation:listener:" + session::generate_session_id())
+  {
+    thread = std::thread([this]
+                         { run(); });
+  }
+
+  /**
+   * Stop the listener. The thread notices within POLL_TIMEOUT_MS.
+   */
+  Listener::~Listener()
+  {
+    stopped = true;
+    cv.notify_all();
+    if (thread.joinable())
+    {
+      thread.join();
+    }
+  }
+
+  /**
+   * Refresh this server's heartbeat if HEARTBEAT_INTERVAL_MS has passed.
+   */
+  void Listener::heartbeat()
+  {
+    long long now = now_ms();
+    if (now - last_heartbeat < HEARTBEAT_INTERVAL_MS)
+    {
+      return;
+    }
+    try
+    {
+      Redis::get_instance().set(heartbeat_key, std::to_string(connected_since), std::chrono::seconds(HEARTBEAT_TTL_SEC));
+      last_heartbeat = now;
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error refreshing listener heartbeat: ") + e.what());
+    }
+  }
+
+  /**
+   * Sleep until the backoff has passed or the listener stops.
+   */
+  void Listener::sleep_for(int ms)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, std::chrono::milliseconds(ms), [this]
+                { return stopped.load(); });
+  }
+
+  /**
+   * Connect, listen and receive notifications until the listener stops,
+   * reconnecting with exponential backoff whenever the connection fails.
+   */
+  void Listener::run()
+  {
+    int backoff_ms = RECONNECT_MIN_MS;
+    bool connected_before = false;
+    std::uint64_t epoch = 0;
+    while (!stopped)
+    {
+      PGconn *conn = PQconnectdb(postgres::connection_string().c_str());
+      if (PQstatus(conn) != CONNECTION_OK || !listen(conn))
+      {
+        utils::Logger::instance().error(std::string("Cache invalidation listener could not connect: ") + PQerrorMessage(conn));
+        PQfinish(conn);
+        sleep_for(backoff_ms);
+        backoff_ms = std::min(backoff_ms * 2, RECONNECT_MAX_MS);
+        continue;
+      }
+
+      backoff_ms = RECONNECT_MIN_MS;
+      current_epoch = ++epoch;
+      long long disconnected_at = last_heartbeat;
+      connected_since = now_ms();
+      last_heartbeat = 0;
+      heartbeat();
+      if (connected_before)
+      {
+        recover(heartbeat_key, disconnected_at);
+      }
+      connected_before = true;
+      utils::Logger::instance().info("Cache invalidation listener connected");
+
+      receive(conn);
+      current_epoch = 0;
+      PQfinish(conn);
+    }
+  }
+
+  /**
+   * Receive notifications until the connection fails or the listener stops.
+   * Imports commit many rows at once, so after the first notification of a
+   * batch the listener waits BATCH_WINDOW_MS for the rest before applying it.
+   */
+  void Listener::receive(PGconn *conn)
+  {
+    while (!stopped)
+    {
+      heartbeat();
+      int ready = wait_readable(conn, POLL_TIMEOUT_MS);
+      if (ready < 0)
+      {
+        return;
+      }
+      if (ready == 0)
+      {
+        continue;
+      }
+
+      Changes changes;
+      bool healthy = drain(conn, changes);
+      if (healthy && !changes.empty() && wait_readable(conn, BATCH_WINDOW_MS) > 0)
+      {
+        healthy = drain(conn, changes);
+      }
+      if (!changes.empty())
+      {
+        apply_changes(changes);
+      }
+      if (!healthy)
+      {
+        return;
+      }
+    }
+  }
+
+  /**
+   * Start the process-wide cache invalidation listener.
+   */
+  void init_listener()
+  {
+    if (!global_listener)
+    {
+      global_listener = new Listener();
+    }
+    std::cout << "Cache invalidation listener started." << std::endl;
+  }
+
+  /**
+   * Identify the listener's current connection. Data loaded under an epoch is
+   * kept current by the notifications received on that connection, and must
+   * be reloaded once the epoch changes, since notifications sent while the
+   * listener was away are lost.
+   *
+   * @return Number of the current connection, 0 while the listener is not connected.
+   */
+  std::uint64_t listening_epoch()
+  {
+    return current_epoch;
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef INVALIDATION_HPP
+#define INVALIDATION_HPP
+
+#include <libpq-fe.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace invalidation
+{
+  const int POLL_TIMEOUT_MS = 1000;
+  const int BATCH_WINDOW_MS = 50;
+  const int RECONNECT_MIN_MS = 500;
+  const int RECONNECT_MAX_MS = 30000;
+  const int TITLES_REFRESH_LEASE_SEC = 300;
+  const int HEARTBEAT_INTERVAL_MS = 2000;
+  const int HEARTBEAT_TTL_SEC = 10;
+
+  /**
+   * @brief Dedicated connection listening for the change notifications sent by
+   * the schema's notify_cache_invalidation() trigger.
+   *
+   * Every server runs one listener. Notifications arriving together are applied
+   * as one batch: the affected Redis keys and local cache entries are purged and
+   * the in-memory indexes reloaded. The listener reconnects with backoff when the
+   * connection drops.
+   *
+   * While connected, each listener keeps a heartbeat key in Redis holding the
+   * time its connection was made. A listener that reconnects uses them to tell
+   * whether another server listened throughout its gap and so already purged
+   * Redis for every change it missed.
+   */
+  class Listener
+  {
+    std::string heartbeat_key;
+    long long connected_since = 0;
+    long long last_heartbeat = 0;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<bool> stopped{false};
+
+    void run();
+    void receive(PGconn *conn);
+    void heartbeat();
+    void sleep_for(int ms);
+
+  public:
+    Listener();
+    ~Listener();
+
+    Listener(const Listener &) = delete;
+    Listener &operator=(const Listener &) = delete;
+  };
+
+  void init_listener();
+  std::uint64_t listening_epoch();
+}
+
+#endif
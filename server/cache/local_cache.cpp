@@ -0,0 +1,879 @@
+#include "local_cache.hpp"
+#include "../db/redis.hpp"
+#include "../executor.hpp"
+#include "../utils.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace local_cache
+{
+  namespace
+  {
+    // Bookkeeping cost of an entry on top of its key and value
+    const std::size_t ENTRY_OVERHEAD = 128;
+    // Typical payload size, used to size the frequency sketch from a byte budget
+    const std::size_t EXPECTED_ENTRY_BYTES = 2048;
+    // Values of a freshness marker: set with a fresh value, or taken as a refresh lease once it is stale
+    const char *const FRESH_MARKER = "1";
+    const char *const LEASE_MARKER = "0";
+
+    const std::uint64_t SEEDS[4] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+
+    std::uint64_t mix(std::uint64_t hash)
+    {
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdULL;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb9fe1a85ec53ULL;
+      hash ^= hash >> 33;
+      return hash;
+    }
+  }
+
+  /**
+   * Create a sketch sized for a number of entries. Each 64-bit slot holds
+   * sixteen 4-bit counters.
+   *
+   * @param expected_entries Number of entries the cache is expected to hold.
+   */
+  FrequencySketch::FrequencySketch(std::size_t expected_entries)
+  {
+    std::size_t slots = 1;
+    while (slots < std::max<std::size_t>(expected_entries / 4, 64))
+    {
+      slots <<= 1;
+    }
+    table.assign(slots, 0);
+    sample_size = 10 * std::max<std::size_t>(expected_entries, 64);
+  }
+
+  /**
+   * Find the counter of a hash in one row of the sketch.
+   * @param hash Hash of the key.
+   * @param row Row of the sketch, 0 to 3.
+   * @return Index of the counter, as slot * 16 + nibble.
+   */
+  std::size_t FrequencySketch::index_of(std::uint64_t hash, int row) const
+  {
+    std::uint64_t h = mix(hash + SEEDS[row]);
+    std::size_t slot = h & (table.size() - 1);
+    std::size_t nibble = (h >> 32) & 15;
+    return slot * 16 + nibble;
+  }
+
+  /**
+   * Halve every counter, so the sketch tracks recent popularity.
+   */
+  void FrequencySketch::reset()
+  {
+    for (std::uint64_t &slot : table)
+    {
+      slot = (slot >> 1) & 0x7777777777777777ULL;
+    }
+    additions /= 2;
+  }
+
+  /**
+   * Record an access to a key. Counters saturate at 15.
+   * @param hash Hash of the key.
+   */
+  void FrequencySketch::increment(std::uint64_t hash)
+  {
+    bool added = false;
+    for (int row = 0; row < 4; ++row)
+    {
+      std::size_t index = index_of(hash, row);
+      std::uint64_t &slot = table[index / 16];
+      int shift = static_cast<int>(index % 16) * 4;
+      if (((slot >> shift) & 15) < 15)
+      {
+        slot += std::uint64_t(1) << shift;
+        added = true;
+      }
+    }
+
+    if (added && ++additions >= sample_size)
+    {
+      reset();
+    }
+  }
+
+  /**
+   * Estimate how often a key has been accessed recently.
+   * @param hash Hash of the key.
+   * @return Smallest of the key's counters, 0 to 15.
+   */
+  int FrequencySketch::frequency(std::uint64_t hash) const
+  {
+    int frequency = 15;
+    for (int row = 0; row < 4; ++row)
+    {
+      std::size_t index = index_of(hash, row);
+      frequency = std::min(frequency, static_cast<int>((table[index / 16] >> ((index % 16) * 4)) & 15));
+    }
+    return frequency;
+  }
+
+  /**
+   * Create a shard. The window gets 1% of the budget and the protected segment
+   * 80% of the rest, as recommended for W-TinyLFU.
+   *
+   * @param budget Memory budget of the shard in bytes.
+   */
+  Shard::Shard(std::size_t budget)
+      : window_budget(std::max<std::size_t>(budget / 100, 1)),
+        protected_budget((budget - window_budget) * 4 / 5),
+        main_budget(budget - window_budget),
+        sketch(budget / EXPECTED_ENTRY_BYTES)
+  {
+  }
+
+  Shard::List &Shard::list(Segment segment)
+  {
+    return lists[static_cast<std::size_t>(segment)];
+  }
+
+  /**
+   * Move an entry to the most recently used end of a segment.
+   * @param it Entry to move.
+   * @param segment Segment to move it to.
+   */
+  void Shard::move_to(List::iterator it, Segment segment)
+  {
+    list_bytes[static_cast<std::size_t>(it->segment)] -= it->charge;
+    list_bytes[static_cast<std::size_t>(segment)] += it->charge;
+    list(segment).splice(list(segment).begin(), list(it->segment), it);
+    it->segment = segment;
+  }
+
+  /**
+   * Drop an entry from the shard.
+   * @param it Entry to drop.
+   */
+  void Shard::remove(List::iterator it)
+  {
+    list_bytes[static_cast<std::size_t>(it->segment)] -= it->charge;
+    entries.erase(std::string_view(it->key));
+    list(it->segment).erase(it);
+  }
+
+  /**
+   * Move entries out of an overfull window. Each one becomes a candidate for the
+   * main segments: while they are full, the candidate is compared with the least
+   * recently used probation entry, and whichever has been requested less is evicted.
+   */
+  void Shard::evict_window()
+  {
+    List &window = list(Segment::Window);
+    while (list_bytes[static_cast<std::size_t>(Segment::Window)] > window_budget && !window.empty())
+    {
+      List::iterator candidate = std::prev(window.end());
+      move_to(candidate, Segment::Probation);
+
+      List &probation = list(Segment::Probation);
+      while (list_bytes[static_cast<std::size_t>(Segment::Probation)] + list_bytes[static_cast<std::size_t>(Segment::Protected)] > main_budget)
+      {
+        List::iterator victim = std::prev(probation.end());
+        if (victim == candidate)
+        {
+          // Only the candidate is left on probation, so it competes with the protected segment
+          List &protected_list = list(Segment::Protected);
+          if (protected_list.empty())
+          {
+            remove(candidate);
+            break;
+          }
+          victim = std::prev(protected_list.end());
+        }
+
+        if (sketch.frequency(candidate->hash) > sketch.frequency(victim->hash))
+        {
+          remove(victim);
+        }
+        else
+        {
+          remove(candidate);
+          break;
+        }
+      }
+    }
+  }
+
+  /**
+   * Demote the least recently used protected entries to probation while the
+   * protected segment is over its budget.
+   */
+  void Shard::evict_protected()
+  {
+    List &protected_list = list(Segment::Protected);
+    while (list_bytes[static_cast<std::size_t>(Segment::Protected)] > protected_budget && !protected_list.empty())
+    {
+      move_to(std::prev(protected_list.end()), Segment::Probation);
+    }
+  }
+
+  /**
+   * Look up a key, counting the access for admission.
+   * @param key Key to look up.
+   * @param hash Hash of the key.
+   * @return Cached value, or nullptr on a miss or an expired entry.
+   */
+  Shard::Value Shard::get(const std::string &key, std::uint64_t hash)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    sketch.increment(hash);
+
+    auto found = entries.find(std::string_view(key));
+    if (found == entries.end())
+    {
+      return nullptr;
+    }
+
+    List::iterator it = found->second;
+    if (it->expires_at <= std::chrono::steady_clock::now())
+    {
+      remove(it);
+      return nullptr;
+    }
+
+    switch (it->segment)
+    {
+    case Segment::Window:
+      move_to(it, Segment::Window);
+      break;
+    case Segment::Probation:
+    case Segment::Protected:
+      move_to(it, Segment::Protected);
+      evict_protected();
+      break;
+    }
+    return it->value;
+  }
+
+  /**
+   * Store a value, replacing any previous value for the key. Values larger than
+   * half of the main segments are not cached, as they would displace most of the shard.
+   *
+   * @param key Key to store.
+   * @param hash Hash of the key.
+   * @param value Value to store.
+   * @param ttl Time until the entry expires.
+   */
+  void Shard::put(const std::string &key, std::uint64_t hash, Value value, std::chrono::seconds ttl)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    put_locked(key, hash, std::move(value), ttl);
+  }
+
+  /**
+   * Store a value unless the shard has had an erasure since an epoch was taken.
+   * @param key Key to store.
+   * @param hash Hash of the key.
+   * @param value Value to store.
+   * @param ttl Time until the entry expires.
+   * @param epoch Epoch taken before the value was loaded.
+   * @return Whether the value was offered to the shard.
+   */
+  bool Shard::put_if_unchanged(const std::string &key, std::uint64_t hash, Value value, std::chrono::seconds ttl, std::uint64_t epoch)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (epoch != erasures)
+    {
+      return false;
+    }
+    put_locked(key, hash, std::move(value), ttl);
+    return true;
+  }
+
+  /**
+   * Store a value. The caller must hold the shard's lock.
+   */
+  void Shard::put_locked(const std::string &key, std::uint64_t hash, Value value, std::chrono::seconds ttl)
+  {
+    std::size_t charge = key.size() + value->size() + ENTRY_OVERHEAD;
+    std::chrono::steady_clock::time_point expires_at = std::chrono::steady_clock::now() + ttl;
+
+    auto found = entries.find(std::string_view(key));
+    if (found != entries.end())
+    {
+      remove(found->second);
+    }
+    if (charge > main_budget / 2)
+    {
+      return;
+    }
+
+    List &window = list(Segment::Window);
+    window.push_front(Node{key, hash, std::move(value), expires_at, charge, Segment::Window});
+    list_bytes[static_cast<std::size_t>(Segment::Window)] += charge;
+    entries.emplace(std::string_view(window.front().key), window.begin());
+    evict_window();
+  }
+
+  /**
+   * Drop a key. The erasure counts even if the key is not cached, as a load of
+   * it may be in flight.
+   *
+   * @param key Key to drop.
+   * @return Whether the key was cached.
+   */
+  bool Shard::erase(const std::string &key)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++erasures;
+    auto found = entries.find(std::string_view(key));
+    if (found == entries.end())
+    {
+      return false;
+    }
+    remove(found->second);
+    return true;
+  }
+
+  /**
+   * Drop every key starting with a prefix.
+   * @param prefix Prefix of the keys to drop.
+   * @return Number of keys dropped.
+   */
+  std::size_t Shard::erase_prefix(std::string_view prefix)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++erasures;
+    std::size_t erased = 0;
+    for (List &segment : lists)
+    {
+      for (List::iterator it = segment.begin(); it != segment.end();)
+      {
+        List::iterator next = std::next(it);
+        if (std::string_view(it->key).substr(0, prefix.size()) == prefix)
+        {
+          remove(it);
+          ++erased;
+        }
+        it = next;
+      }
+    }
+    return erased;
+  }
+
+  void Shard::clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++erasures;
+    entries.clear();
+    for (List &segment : lists)
+    {
+      segment.clear();
+    }
+    list_bytes.fill(0);
+  }
+
+  /**
+   * Get the number of erasures made on the shard so far.
+   */
+  std::uint64_t Shard::epoch() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return erasures;
+  }
+
+  std::size_t Shard::bytes() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return list_bytes[0] + list_bytes[1] + list_bytes[2];
+  }
+
+  /**
+   * Create a cache.
+   * @param shard_count Number of shards.
+   * @param budget Memory budget of the whole cache in bytes.
+   */
+  LocalCache::LocalCache(std::size_t shard_count, std::size_t budget)
+  {
+    shards.reserve(shard_count);
+    for (std::size_t i = 0; i < shard_count; ++i)
+    {
+      shards.push_back(std::make_unique<Shard>(budget / shard_count));
+    }
+  }
+
+  Shard &LocalCache::shard_for(std::uint64_t hash)
+  {
+    return *shards[mix(hash) % shards.size()];
+  }
+
+  /**
+   * Look up a key.
+   * @param key Key to look up.
+   * @return Cached value, or nullptr if the key is not cached.
+   */
+  LocalCache::Value LocalCache::get(const std::string &key)
+  {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+    return shard_for(hash).get(key, hash);
+  }
+
+  /**
+   * Store a value. The cache may decline to keep it if the key is requested
+   * less often than the entries it would displace.
+   *
+   * @param key Key to store.
+   * @param value Value to store.
+   * @param ttl Time until the entry expires.
+   */
+  void LocalCache::put(const std::string &key, Value value, std::chrono::seconds ttl)
+  {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+    shard_for(hash).put(key, hash, std::move(value), ttl);
+  }
+
+  void LocalCache::put(const std::string &key, std::string value, std::chrono::seconds ttl)
+  {
+    put(key, std::make_shared<const std::string>(std::move(value)), ttl);
+  }
+
+  /**
+   * Store a value unless the key's shard has had an erasure since an epoch was taken.
+   * @param key Key to store.
+   * @param value Value to store.
+   * @param epoch Epoch of the key, taken before the value was loaded.
+   * @param ttl Time until the entry expires.
+   * @return Whether the value was offered to the cache.
+   */
+  bool LocalCache::put_if_unchanged(const std::string &key, Value value, std::uint64_t epoch, std::chrono::seconds ttl)
+  {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+    return shard_for(hash).put_if_unchanged(key, hash, std::move(value), ttl, epoch);
+  }
+
+  /**
+   * Get the epoch of a key, to be taken before its value is read or loaded.
+   * @param key Key to get the epoch of.
+   * @return Number of erasures made on the key's shard so far.
+   */
+  std::uint64_t LocalCache::epoch(const std::string &key)
+  {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+    return shard_for(hash).epoch();
+  }
+
+  void LocalCache::erase(const std::string &key)
+  {
+    std::uint64_t hash = std::hash<std::string>{}(key);
+    shard_for(hash).erase(key);
+  }
+
+  /**
+   * Drop every key starting with a prefix, in every shard.
+   * @param prefix Prefix of the keys to drop.
+   */
+  void LocalCache::erase_prefix(std::string_view prefix)
+  {
+    for (std::unique_ptr<Shard> &shard : shards)
+    {
+      shard->erase_prefix(prefix);
+    }
+  }
+
+  void LocalCache::clear()
+  {
+    for (std::unique_ptr<Shard> &shard : shards)
+    {
+      shard->clear();
+    }
+  }
+
+  std::size_t LocalCache::bytes() const
+  {
+    std::size_t total = 0;
+    for (const std::unique_ptr<Shard> &shard : shards)
+    {
+      total += shard->bytes();
+    }
+    return total;
+  }
+
+  /**
+   * Run a load for a key, or wait for the load already in flight for it.
+   * @param key Key being loaded.
+   * @param load Load to run if none is in flight.
+   * @return Value of the load.
+   */
+  LocalCache::Value SingleFlight::run(const std::string &key, const std::function<LocalCache::Value()> &load)
+  {
+    std::promise<LocalCache::Value> promise;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto found = calls.find(key);
+      if (found != calls.end())
+      {
+        std::shared_future<LocalCache::Value> call = found->second;
+        lock.unlock();
+        return call.get();
+      }
+      calls.emplace(key, promise.get_future().share());
+    }
+
+    try
+    {
+      LocalCache::Value value = load();
+      promise.set_value(value);
+      std::lock_guard<std::mutex> lock(mutex);
+      calls.erase(key);
+      return value;
+    }
+    catch (...)
+    {
+      promise.set_exception(std::current_exception());
+      std::lock_guard<std::mutex> lock(mutex);
+      calls.erase(key);
+      throw;
+    }
+  }
+
+  /**
+   * Get the Redis key marking a cached value as fresh. The marker expires after
+   * the value's soft TTL, while the value itself stays for CACHE_STALE_SEC more.
+   *
+   * @param key Key of the cached value.
+   * @return Key of its freshness marker.
+   */
+  std::string fresh_key(const std::string &key)
+  {
+    return "fresh:" + key;
+  }
+
+  /**
+   * Get the Redis key holding the generation of a cached value, or of a family
+   * of values that are invalidated together. A missing generation reads as "0".
+   *
+   * @param key Key of the cached value or family.
+   * @return Key of its generation.
+   */
+  std::string generation_key(const std::string &key)
+  {
+    return key + ":generation";
+  }
+
+  /**
+   * Check a freshness marker read alongside its value. A missing marker means
+   * the value is past its soft TTL; a refresh lease means it is stale and being
+   * refreshed.
+   *
+   * @param marker Marker read from Redis.
+   * @return true if the value is within its soft TTL.
+   */
+  static bool is_fresh(const sw::redis::OptionalString &marker)
+  {
+    return marker && *marker == FRESH_MARKER;
+  }
+
+  /**
+   * Take the payload out of a value read from Redis if it was stored under the
+   * current generation.
+   * @param value Value read from Redis, "<generation>\n<payload>".
+   * @param generation Current generation of the key.
+   * @return Payload, or nothing if the value is missing or from an older generation.
+   */
+  static std::optional<std::string> current_payload(sw::redis::OptionalString &value, const std::string &generation)
+  {
+    std::string prefix = generation + "\n";
+    if (!value || value->compare(0, prefix.size(), prefix) != 0)
+    {
+      return std::nullopt;
+    }
+    return value->substr(prefix.size());
+  }
+
+  /**
+   * Queue a value and its freshness marker on a Redis pipeline. Values whose
+   * generation is unknown are not written, as they could not be told apart
+   * from values loaded before an invalidation.
+   *
+   * @param pipeline Pipeline to queue the writes on.
+   * @param key Key to store.
+   * @param version Version the value was loaded in.
+   * @param value Value to store.
+   * @param ttl Soft TTL of the value.
+   */
+  void queue_write(sw::redis::Pipeline &pipeline, const std::string &key, const Version &version, const std::string &value, std::chrono::seconds ttl)
+  {
+    if (!version.generation)
+    {
+      return;
+    }
+    pipeline.set(key, *version.generation + "\n" + value, ttl + std::chrono::seconds(CACHE_STALE_SEC));
+    pipeline.set(fresh_key(key), FRESH_MARKER, ttl);
+  }
+
+  /**
+   * Queue the invalidation of a value on a Redis pipeline: its generation moves
+   * on, so a load already in flight is ignored once written, and the value and
+   * its freshness marker are dropped.
+   *
+   * @param pipeline Pipeline to queue the writes on.
+   * @param key Key of the value.
+   * @param generation_key Key of the value's generation.
+   */
+  void queue_invalidate(sw::redis::Pipeline &pipeline, const std::string &key, const std::string &generation_key)
+  {
+    pipeline.incr(generation_key);
+    pipeline.del(key);
+    pipeline.del(fresh_key(key));
+  }
+
+  /**
+   * Store a value in Redis and the local cache, under the version it was loaded in.
+   * @param key Key to store.
+   * @param version Version taken before the value was loaded.
+   * @param value Value to store.
+   * @param ttl Soft TTL of the value. The local entry expires after at most
+   * CACHE_TTL_SEC.
+   * @return Stored value.
+   */
+  LocalCache::Value write_through(const std::string &key, const Version &version, std::string value, std::chrono::seconds ttl)
+  {
+    try
+    {
+      sw::redis::Pipeline pipeline = Redis::get_instance().pipeline(false);
+      queue_write(pipeline, key, version, value, ttl);
+      pipeline.exec();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error writing to Redis: ") + e.what());
+    }
+
+    LocalCache::Value stored = std::make_shared<const std::string>(std::move(value));
+    get_local_cache().put_if_unchanged(key, stored, version.epoch, std::min(ttl, std::chrono::seconds(CACHE_TTL_SEC)));
+    return stored;
+  }
+
+  /**
+   * Reload a stale value on the blocking executor. A value that no longer exists
+   * is dropped from both caches. If the executor is full the refresh is skipped,
+   * and the next read retries once the refresh lease has expired.
+   *
+   * @param key Key to refresh.
+   * @param generation Generation the stale value was read in.
+   * @param ttl Soft TTL of the refreshed value.
+   * @param loader Load of the value.
+   */
+  static void refresh_in_background(const std::string &key, const std::string &generation, std::chrono::seconds ttl, const Loader &loader)
+  {
+    bool queued = false;
+    try
+    {
+      queued = executor::get_executor().try_post([key, generation, ttl, loader]
+                                                 { get_single_flight().run(key + ":" + generation, [&key, &generation, ttl, &loader]() -> LocalCache::Value
+                                                                           {
+        Version version{generation, get_local_cache().epoch(key)};
+        std::optional<std::string> loaded = loader();
+        if (!loaded)
+        {
+          Redis::get_instance().del(key);
+          get_local_cache().erase(key);
+          return nullptr;
+        }
+        return write_through(key, version, std::move(*loaded), ttl); }); });
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error scheduling cache refresh: ") + e.what());
+    }
+
+    if (!queued)
+    {
+      utils::Logger::instance().debug("Skipped refresh of " + key);
+    }
+  }
+
+  /**
+   * Look up many keys at once. Keys missing from the local cache are read from
+   * Redis with one MGET, along with their generations and freshness markers.
+   * Only fresh values of the current generation are returned; the caller loads
+   * the rest and stores them under the versions returned.
+   *
+   * @param keys Keys to look up.
+   * @param generation_keys Key of the generation of each key.
+   * @return Lookup of each key, in order. A Redis error leaves the
+   * generations unknown.
+   */
+  std::vector<Lookup> find_fresh(const std::vector<std::string> &keys, const std::vector<std::string> &generation_keys)
+  {
+    LocalCache &cache = get_local_cache();
+    std::vector<Lookup> lookups(keys.size());
+    std::vector<std::size_t> remote;
+    std::vector<std::string> remote_keys;
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+      lookups[i].version.epoch = cache.epoch(keys[i]);
+      lookups[i].value = cache.get(keys[i]);
+      if (!lookups[i].value)
+      {
+        remote.push_back(i);
+        remote_keys.push_back(generation_keys[i]);
+        remote_keys.push_back(keys[i]);
+        remote_keys.push_back(fresh_key(keys[i]));
+      }
+    }
+    if (remote.empty())
+    {
+      return lookups;
+    }
+
+    try
+    {
+      std::vector<sw::redis::OptionalString> cache_results;
+      cache_results.reserve(remote_keys.size());
+      Redis::get_instance().mget(remote_keys.begin(), remote_keys.end(), std::back_inserter(cache_results));
+      if (cache_results.size() != remote_keys.size())
+      {
+        return lookups;
+      }
+
+      for (std::size_t r = 0; r < remote.size(); ++r)
+      {
+        Lookup &lookup = lookups[remote[r]];
+        lookup.version.generation = cache_results[3 * r].value_or("0");
+        std::optional<std::string> payload = current_payload(cache_results[3 * r + 1], *lookup.version.generation);
+        if (payload && is_fresh(cache_results[3 * r + 2]))
+        {
+          lookup.value = std::make_shared<const std::string>(std::move(*payload));
+          cache.put_if_unchanged(keys[remote[r]], lookup.value, lookup.version.epoch);
+        }
+      }
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error reading from Redis: ") + e.what());
+    }
+    return lookups;
+  }
+
+  /**
+   * Look up a key in the local cache, falling back to Redis. A value found in
+   * Redis is kept locally for CACHE_TTL_SEC, which bounds how long this server
+   * can serve a value after another server has replaced it.
+   *
+   * A value past its soft TTL is still returned, and one refresh is started in
+   * the background. The refresh takes a lease on the freshness marker, so only
+   * one server refreshes a value at a time.
+   *
+   * @param key Key to read.
+   * @param generation_key Key of the value's generation.
+   * @param ttl Soft TTL of a refreshed value.
+   * @param loader Load of the value, used to refresh it. It may run after the
+   * caller has returned, so it must own everything it captures.
+   * @return Cached value, or nullptr if neither cache holds the key or Redis is
+   * unavailable, and the version to store a loaded value under.
+   */
+  Lookup find(const std::string &key, const std::string &generation_key, std::chrono::seconds ttl, const Loader &loader)
+  {
+    LocalCache &cache = get_local_cache();
+    Lookup lookup;
+    lookup.version.epoch = cache.epoch(key);
+    lookup.value = cache.get(key);
+    if (lookup.value)
+    {
+      return lookup;
+    }
+
+    try
+    {
+      sw::redis::Redis &redis = Redis::get_instance();
+      std::vector<std::string> keys = {generation_key, key, fresh_key(key)};
+      std::vector<sw::redis::OptionalString> cache_results;
+      cache_results.reserve(keys.size());
+      redis.mget(keys.begin(), keys.end(), std::back_inserter(cache_results));
+      if (cache_results.size() != keys.size())
+      {
+        return lookup;
+      }
+
+      lookup.version.generation = cache_results[0].value_or("0");
+      std::optional<std::string> payload = current_payload(cache_results[1], *lookup.version.generation);
+      if (!payload)
+      {
+        return lookup;
+      }
+
+      lookup.value = std::make_shared<const std::string>(std::move(*payload));
+      cache.put_if_unchanged(key, lookup.value, lookup.version.epoch);
+
+      if (!cache_results[2] && redis.set(keys[2], LEASE_MARKER, std::chrono::seconds(REFRESH_LEASE_SEC), sw::redis::UpdateType::NOT_EXIST))
+      {
+        refresh_in_background(key, *lookup.version.generation, ttl, loader);
+      }
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error reading from Redis: ") + e.what());
+    }
+    return lookup;
+  }
+
+  /**
+   * Read a key from the local cache, falling back to Redis, as find does.
+   * @return Cached value, or nullptr if neither cache holds the key or Redis is unavailable.
+   */
+  LocalCache::Value read_through(const std::string &key, const std::string &generation_key, std::chrono::seconds ttl, const Loader &loader)
+  {
+    return find(key, generation_key, ttl, loader).value;
+  }
+
+  /**
+   * Read a key through the local cache and Redis, loading it on a miss. Only one
+   * load per key and generation runs at a time in this process: concurrent
+   * misses wait for it and share its value, so an expired hot key costs one
+   * query. Stale values are served and refreshed in the background, as with
+   * read_through. A loaded value is stored under the version read before the
+   * load, so a load that raced with an invalidation is never served.
+   *
+   * @param key Key to read.
+   * @param generation_key Key of the value's generation.
+   * @param ttl Soft TTL of a loaded value.
+   * @param loader Load of the value, returning nothing if there is no value to
+   * cache. It must own everything it captures and read from the primary, as it
+   * refills values right after they are invalidated.
+   * @return Cached or loaded value, or nullptr if the loader returned nothing.
+   */
+  LocalCache::Value load_through(const std::string &key, const std::string &generation_key, std::chrono::seconds ttl, const Loader &loader)
+  {
+    Lookup lookup = find(key, generation_key, ttl, loader);
+    if (lookup.value)
+    {
+      return lookup.value;
+    }
+
+    return get_single_flight().run(key + ":" + lookup.version.generation.value_or(""), [&key, &lookup, ttl, &loader]() -> LocalCache::Value
+                                   {
+      std::optional<std::string> loaded = loader();
+      if (!loaded)
+      {
+        return nullptr;
+      }
+      return write_through(key, lookup.version, std::move(*loaded), ttl); });
+  }
+
+  /**
+   * Get the process-wide local cache.
+   * @return Local cache.
+   */
+  LocalCache &get_local_cache()
+  {
+    static LocalCache cache(CACHE_SHARDS, CACHE_BUDGET_BYTES);
+    return cache;
+  }
+
+  /**
+   * Get the process-wide table of loads in flight.
+   * @return Single flight table.
+   */
+  SingleFlight &get_single_flight()
+  {
+    static SingleFlight single_flight;
+    return single_flight;
+  }
+}
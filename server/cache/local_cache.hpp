@@ -0,0 +1,196 @@
+#ifndef LOCAL_CACHE_HPP
+#define LOCAL_CACHE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sw/redis++/redis++.h>
+
+namespace local_cache
+{
+  const std::size_t CACHE_SHARDS = 16;
+  const std::size_t CACHE_BUDGET_BYTES = 64 * 1024 * 1024;
+  const int CACHE_TTL_SEC = 30;
+  const int CACHE_STALE_SEC = 3600;
+  const int REFRESH_LEASE_SEC = 30;
+
+  /**
+   * @brief Count-min sketch of 4-bit access counters, used to estimate how often
+   * a key has been requested recently. Every counter is halved once the sketch
+   * has seen enough accesses, so old popularity fades.
+   */
+  class FrequencySketch
+  {
+    std::vector<std::uint64_t> table;
+    std::size_t additions = 0;
+    std::size_t sample_size = 0;
+
+    std::size_t index_of(std::uint64_t hash, int row) const;
+    void reset();
+
+  public:
+    explicit FrequencySketch(std::size_t expected_entries);
+
+    void increment(std::uint64_t hash);
+    int frequency(std::uint64_t hash) const;
+  };
+
+  /**
+   * @brief One shard of the local cache, with its own lock and memory budget.
+   *
+   * Entries follow W-TinyLFU: new entries enter a small LRU window, and an entry
+   * leaving the window only makes it into the main segmented LRU if it has been
+   * requested more often than the entry it would evict. Entries that are hit in
+   * the main probation segment are promoted to the protected segment.
+   */
+  class Shard
+  {
+  public:
+    using Value = std::shared_ptr<const std::string>;
+
+    explicit Shard(std::size_t budget);
+
+    Value get(const std::string &key, std::uint64_t hash);
+    void put(const std::string &key, std::uint64_t hash, Value value, std::chrono::seconds ttl);
+    bool put_if_unchanged(const std::string &key, std::uint64_t hash, Value value, std::chrono::seconds ttl, std::uint64_t epoch);
+    bool erase(const std::string &key);
+    std::size_t erase_prefix(std::string_view prefix);
+    void clear();
+    std::uint64_t epoch() const;
+    std::size_t bytes() const;
+
+  private:
+    enum class Segment
+    {
+      Window,
+      Probation,
+      Protected
+    };
+
+    struct Node
+    {
+      std::string key;
+      std::uint64_t hash;
+      Value value;
+      std::chrono::steady_clock::time_point expires_at;
+      std::size_t charge;
+      Segment segment;
+    };
+
+    using List = std::list<Node>;
+
+    mutable std::mutex mutex;
+    std::size_t window_budget;
+    std::size_t protected_budget;
+    std::size_t main_budget;
+    std::array<List, 3> lists;
+    std::array<std::size_t, 3> list_bytes{};
+    std::unordered_map<std::string_view, List::iterator> entries;
+    FrequencySketch sketch;
+    std::uint64_t erasures = 0;
+
+    List &list(Segment segment);
+    void move_to(List::iterator it, Segment segment);
+    void remove(List::iterator it);
+    void evict_window();
+    void evict_protected();
+    void put_locked(const std::string &key, std::uint64_t hash, Value value, std::chrono::seconds ttl);
+  };
+
+  /**
+   * @brief Process-wide in-memory cache of ready-to-send payloads, in front of Redis.
+   *
+   * Keys are spread over CACHE_SHARDS shards that each get an equal part of
+   * CACHE_BUDGET_BYTES, so lookups on different keys rarely contend.
+   *
+   * Each shard counts the erasures made on it. A value loaded after taking a
+   * key's epoch is only stored if no erasure has hit the key's shard since, so
+   * a load that raced with an invalidation cannot put the old value back.
+   */
+  class LocalCache
+  {
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    Shard &shard_for(std::uint64_t hash);
+
+  public:
+    using Value = Shard::Value;
+
+    LocalCache(std::size_t shard_count, std::size_t budget);
+
+    Value get(const std::string &key);
+    void put(const std::string &key, Value value, std::chrono::seconds ttl = std::chrono::seconds(CACHE_TTL_SEC));
+    void put(const std::string &key, std::string value, std::chrono::seconds ttl = std::chrono::seconds(CACHE_TTL_SEC));
+    bool put_if_unchanged(const std::string &key, Value value, std::uint64_t epoch, std::chrono::seconds ttl = std::chrono::seconds(CACHE_TTL_SEC));
+    std::uint64_t epoch(const std::string &key);
+    void erase(const std::string &key);
+    void erase_prefix(std::string_view prefix);
+    void clear();
+    std::size_t bytes() const;
+  };
+
+  /**
+   * @brief Deduplicates concurrent loads of the same key.
+   *
+   * The first caller for a key runs the load; callers arriving while it is in
+   * flight wait on the same shared future and receive its value or exception.
+   */
+  class SingleFlight
+  {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_future<LocalCache::Value>> calls;
+
+  public:
+    LocalCache::Value run(const std::string &key, const std::function<LocalCache::Value()> &load);
+  };
+
+  using Loader = std::function<std::optional<std::string>()>;
+
+  /**
+   * @brief Version of a cached key, taken before its value is read or loaded.
+   *
+   * Values are stored in Redis prefixed with the generation of their key, and
+   * invalidating a key moves its generation on, so a value loaded before an
+   * invalidation is never served after it. Locally, the epoch of the key's
+   * shard plays the same part.
+   */
+  struct Version
+  {
+    // Generation read from Redis, or nothing if Redis could not be read
+    std::optional<std::string> generation;
+    std::uint64_t epoch = 0;
+  };
+
+  /**
+   * @brief Value of a key found in the cache, and the version it was looked up in.
+   */
+  struct Lookup
+  {
+    LocalCache::Value value;
+    Version version;
+  };
+
+  std::string fresh_key(const std::string &key);
+  std::string generation_key(const std::string &key);
+  void queue_write(sw::redis::Pipeline &pipeline, const std::string &key, const Version &version, const std::string &value, std::chrono::seconds ttl);
+  void queue_invalidate(sw::redis::Pipeline &pipeline, const std::string &key, const std::string &generation_key);
+  std::vector<Lookup> find_fresh(const std::vector<std::string> &keys, const std::vector<std::string> &generation_keys);
+  Lookup find(const std::string &key, const std::string &generation_key, std::chrono::seconds ttl, const Loader &loader);
+  LocalCache::Value read_through(const std::string &key, const std::string &generation_key, std::chrono::seconds ttl, const Loader &loader);
+  LocalCache::Value write_through(const std::string &key, const Version &version, std::string value, std::chrono::seconds ttl);
+  LocalCache::Value load_through(const std::string &key, const std::string &generation_key, std::chrono::seconds ttl, const Loader &loader);
+  LocalCache &get_local_cache();
+  SingleFlight &get_single_flight();
+}
+
+#endif
@@ -27,6 +27,38 @@ CREATE TYPE public."InteractionType" AS ENUM (
 );
 
 
+--
+-- Name: notify_cache_invalidation(); Type: FUNCTION; Schema: public; Owner: -
+--
+
+CREATE FUNCTION public.notify_cache_invalidation() RETURNS trigger
+    LANGUAGE plpgsql
+    AS $$
+DECLARE
+    changed_row jsonb;
+BEGIN
+    -- Announce the cache keys of the old and the new row. Identical payloads
+    -- within a transaction are delivered once, so an update that keeps its keys
+    -- sends a single notification.
+    FOREACH changed_row IN ARRAY ARRAY[
+        CASE WHEN TG_OP <> 'INSERT' THEN to_jsonb(OLD) - 'text' END,
+        CASE WHEN TG_OP <> 'DELETE' THEN to_jsonb(NEW) - 'text' END
+    ] LOOP
+        CONTINUE WHEN changed_row IS NULL;
+        PERFORM pg_notify('cache_invalidation', jsonb_strip_nulls(jsonb_build_object(
+            'table', TG_TABLE_NAME,
+            'txid', txid_current(),
+            'id', changed_row->'id',
+            'text_object_id', changed_row->'text_object_id',
+            'language', changed_row->'language',
+            'text_id', changed_row->'text_id'
+        ))::text);
+    END LOOP;
+    RETURN NULL;
+END;
+$$;
+
+
 SET default_tablespace = '';
 
 SET default_table_access_method = heap;
@@ -42,7 +74,9 @@ CREATE TABLE public."Annotation" (
     description text NOT NULL,
     text_id integer NOT NULL,
     created_at integer NOT NULL,
-    user_id integer NOT NULL
+    user_id integer NOT NULL,
+    likes integer DEFAULT 0 NOT NULL,
+    dislikes integer DEFAULT 0 NOT NULL
 );
 
 
@@ -248,6 +282,18 @@ CREATE SEQUENCE public."UserAnnotationInteraction_id_seq"
 ALTER SEQUENCE public."UserAnnotationInteraction_id_seq" OWNED BY public."UserAnnotationInteraction".id;
 
 
+--
+-- Name: UserStats; Type: TABLE; Schema: public; Owner: -
+--
+
+CREATE TABLE public."UserStats" (
+    user_id integer NOT NULL,
+    annotation_count integer DEFAULT 0 NOT NULL,
+    like_count integer DEFAULT 0 NOT NULL,
+    dislike_count integer DEFAULT 0 NOT NULL
+);
+
+
 --
 -- Name: User_id_seq; Type: SEQUENCE; Schema: public; Owner: -
 --
@@ -387,6 +433,14 @@ ALTER TABLE ONLY public."User"
     ADD CONSTRAINT "User_pkey" PRIMARY KEY (id);
 
 
+--
+-- Name: UserStats UserStats_pkey; Type: CONSTRAINT; Schema: public; Owner: -
+--
+
+ALTER TABLE ONLY public."UserStats"
+    ADD CONSTRAINT "UserStats_pkey" PRIMARY KEY (user_id);
+
+
 --
 -- Name: Text_audioId_key; Type: INDEX; Schema: public; Owner: -
 --
@@ -457,6 +511,62 @@ CREATE INDEX idx_user_annotation_interaction_user_id ON public."UserAnnotationIn
 CREATE UNIQUE INDEX mv_textobject_list_id_idx ON public.mv_textobject_list USING btree (id);
 
 
+--
+-- Name: mv_textobject_list_group_id_idx; Type: INDEX; Schema: public; Owner: -
+--
+
+CREATE INDEX mv_textobject_list_group_id_idx ON public.mv_textobject_list USING btree (group_id, id);
+
+
+--
+-- Name: mv_textobject_list_level_idx; Type: INDEX; Schema: public; Owner: -
+--
+
+CREATE INDEX mv_textobject_list_level_idx ON public.mv_textobject_list USING btree (level, id);
+
+
+--
+-- Name: mv_textobject_list_title_idx; Type: INDEX; Schema: public; Owner: -
+--
+
+CREATE INDEX mv_textobject_list_title_idx ON public.mv_textobject_list USING btree (title, id);
+
+
+--
+-- Name: Annotation annotation_cache_invalidation; Type: TRIGGER; Schema: public; Owner: -
+--
+
+CREATE TRIGGER annotation_cache_invalidation AFTER INSERT OR DELETE OR UPDATE OF start, "end", text_id ON public."Annotation" FOR EACH ROW EXECUTE FUNCTION public.notify_cache_invalidation();
+
+
+--
+-- Name: Audio audio_cache_invalidation; Type: TRIGGER; Schema: public; Owner: -
+--
+
+CREATE TRIGGER audio_cache_invalidation AFTER INSERT OR DELETE OR UPDATE ON public."Audio" FOR EACH ROW EXECUTE FUNCTION public.notify_cache_invalidation();
+
+
+--
+-- Name: Text text_cache_invalidation; Type: TRIGGER; Schema: public; Owner: -
+--
+
+CREATE TRIGGER text_cache_invalidation AFTER INSERT OR DELETE OR UPDATE ON public."Text" FOR EACH ROW EXECUTE FUNCTION public.notify_cache_invalidation();
+
+
+--
+-- Name: TextGroup textgroup_cache_invalidation; Type: TRIGGER; Schema: public; Owner: -
+--
+
+CREATE TRIGGER textgroup_cache_invalidation AFTER INSERT OR DELETE OR UPDATE ON public."TextGroup" FOR EACH ROW EXECUTE FUNCTION public.notify_cache_invalidation();
+
+
+--
+-- Name: TextObject textobject_cache_invalidation; Type: TRIGGER; Schema: public; Owner: -
+--
+
+CREATE TRIGGER textobject_cache_invalidation AFTER INSERT OR DELETE OR UPDATE ON public."TextObject" FOR EACH ROW EXECUTE FUNCTION public.notify_cache_invalidation();
+
+
 --
 -- Name: Text Text_audioId_fkey; Type: FK CONSTRAINT; Schema: public; Owner: -
 --
@@ -497,6 +607,14 @@ ALTER TABLE ONLY public."UserAnnotationInteraction"
     ADD CONSTRAINT "UserAnnotationInteraction_userId_fkey" FOREIGN KEY (user_id) REFERENCES public."User"(id) ON UPDATE CASCADE ON DELETE RESTRICT;
 
 
+--
+-- Name: UserStats UserStats_userId_fkey; Type: FK CONSTRAINT; Schema: public; Owner: -
+--
+
+ALTER TABLE ONLY public."UserStats"
+    ADD CONSTRAINT "UserStats_userId_fkey" FOREIGN KEY (user_id) REFERENCES public."User"(id) ON UPDATE CASCADE ON DELETE CASCADE;
+
+
 --
 -- Name: TextObject group_id; Type: FK CONSTRAINT; Schema: public; Owner: -
 --
@@ -521,6 +639,13 @@ ALTER TABLE ONLY public."Annotation"
     ADD CONSTRAINT user_id FOREIGN KEY (user_id) REFERENCES public."User"(id) NOT VALID;
 
 
+--
+-- Name: mv_textobject_list; Type: MATERIALIZED VIEW DATA; Schema: public; Owner: -
+--
+
+REFRESH MATERIALIZED VIEW public.mv_textobject_list;
+
+
 --
 -- PostgreSQL database dump complete
 --
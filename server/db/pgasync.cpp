@@ -0,0 +1,504 @@
+#include "pgasync.hpp"
+#include "postgres.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/this_coro.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+namespace postgres
+{
+  // Async connections open across every pool of the process, and acquirers
+  // waiting because that count has reached ASYNC_CONNECTION_BUDGET.
+  static std::atomic<int> budget_used{0};
+  static std::atomic<int> budget_waiters{0};
+
+  /**
+   * Take one connection from the process-wide budget.
+   * @return False if the budget is spent.
+   */
+  static bool reserve_budget()
+  {
+    int used = budget_used.load();
+    while (used < ASYNC_CONNECTION_BUDGET)
+    {
+      if (budget_used.compare_exchange_weak(used, used + 1))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  AsyncResult::AsyncResult(PGresult *result) : result_(result) {}
+
+  bool AsyncResult::empty() const
+  {
+    return rows() == 0;
+  }
+
+  int AsyncResult::rows() const
+  {
+    return result_ ? PQntuples(result_.get()) : 0;
+  }
+
+  int AsyncResult::columns() const
+  {
+    return result_ ? PQnfields(result_.get()) : 0;
+  }
+
+  bool AsyncResult::is_null(int row, int column) const
+  {
+    return !result_ || PQgetisnull(result_.get(), row, column);
+  }
+
+  /**
+   * Get a field value as text. The view is valid for the lifetime of the result.
+   * @param row Row index.
+   * @param column Column index.
+   * @return Text value of the field.
+   */
+  std::string_view AsyncResult::value(int row, int column) const
+  {
+    if (!result_)
+    {
+      return {};
+    }
+    return std::string_view(PQgetvalue(result_.get(), row, column),
+                            static_cast<std::size_t>(PQgetlength(result_.get(), row, column)));
+  }
+
+  long AsyncResult::affected_rows() const
+  {
+    if (!result_)
+    {
+      return 0;
+    }
+    const char *tuples = PQcmdTuples(result_.get());
+    return tuples && *tuples ? std::stol(tuples) : 0;
+  }
+
+  const std::vector<Pipeline::Query> &Pipeline::queries() const
+  {
+    return queries_;
+  }
+
+  std::size_t Pipeline::size() const
+  {
+    return queries_.size();
+  }
+
+  bool Pipeline::empty() const
+  {
+    return queries_.empty();
+  }
+
+  AsyncConnection::AsyncConnection(net::any_io_executor executor) : socket_(executor) {}
+
+  /**
+   * Close the connection. The descriptor is released first because libpq owns
+   * the socket and closes it in PQfinish.
+   */
+  AsyncConnection::~AsyncConnection()
+  {
+    if (socket_.is_open())
+    {
+      socket_.release();
+    }
+    if (conn_)
+    {
+      PQfinish(conn_);
+    }
+  }
+
+  /**
+   * Point the stream descriptor at the current libpq socket, which may change
+   * while a connection is being established.
+   */
+  void AsyncConnection::bind_socket()
+  {
+    int fd = PQsocket(conn_);
+    if (fd < 0)
+    {
+      throw std::runtime_error("PostgreSQL connection has no socket: " + last_error());
+    }
+    if (socket_.is_open())
+    {
+      if (socket_.native_handle() == fd)
+      {
+        return;
+      }
+      socket_.release();
+    }
+    socket_.assign(fd);
+  }
+
+  std::string AsyncConnection::last_error() const
+  {
+    return conn_ ? PQerrorMessage(conn_) : "no connection";
+  }
+
+  net::awaitable<void> AsyncConnection::wait(net::posix::stream_descriptor::wait_type type)
+  {
+    co_await socket_.async_wait(type, net::use_awaitable);
+  }
+
+  /**
+   * Open the connection without blocking, then switch it to nonblocking
+   * pipeline mode.
+   *
+   * @param conninfo libpq connection string.
+   */
+  net::awaitable<void> AsyncConnection::connect(const std::string &conninfo)
+  {
+    conn_ = PQconnectStart(conninfo.c_str());
+    if (!conn_ || PQstatus(conn_) == CONNECTION_BAD)
+    {
+      throw std::runtime_error("Failed to start PostgreSQL connection: " + last_error());
+    }
+
+    PostgresPollingStatusType status = PGRES_POLLING_WRITING;
+    while (status != PGRES_POLLING_OK)
+    {
+      if (status == PGRES_POLLING_FAILED)
+      {
+        throw std::runtime_error("Failed to open PostgreSQL connection: " + last_error());
+      }
+      bind_socket();
+      co_await wait(status == PGRES_POLLING_READING
+                        ? net::posix::stream_descriptor::wait_read
+                        : net::posix::stream_descriptor::wait_write);
+      status = PQconnectPoll(conn_);
+    }
+
+    bind_socket();
+    if (PQsetnonblocking(conn_, 1) != 0)
+    {
+      throw std::runtime_error("Failed to set PostgreSQL connection nonblocking: " + last_error());
+    }
+    if (PQenterPipelineMode(conn_) != 1)
+    {
+      throw std::runtime_error("Failed to enter pipeline mode: " + last_error());
+    }
+  }
+
+  /**
+   * Send everything libpq has buffered, waiting for the socket to become writable.
+   */
+  net::awaitable<void> AsyncConnection::flush()
+  {
+    while (true)
+    {
+      int rc = PQflush(conn_);
+      if (rc == 0)
+      {
+        co_return;
+      }
+      if (rc < 0)
+      {
+        throw std::runtime_error("Failed to flush PostgreSQL pipeline: " + last_error());
+      }
+      co_await wait(net::posix::stream_descriptor::wait_write);
+    }
+  }
+
+  /**
+   * Wait for the next result. A null result marks the end of one statement's results.
+   */
+  net::awaitable<PGresult *> AsyncConnection::next_result()
+  {
+    while (PQisBusy(conn_))
+    {
+      co_await wait(net::posix::stream_descriptor::wait_read);
+      if (!PQconsumeInput(conn_))
+      {
+        throw std::runtime_error("Failed to read PostgreSQL results: " + last_error());
+      }
+    }
+    co_return PQgetResult(conn_);
+  }
+
+  /**
+   * Run a pipeline of prepared statements in one round trip. Statements not yet
+   * prepared on this connection are prepared in the same pipeline.
+   *
+   * @param pipeline Statements to run.
+   * @return One result per statement, in pipeline order.
+   */
+  net::awaitable<std::vector<AsyncResult>> AsyncConnection::run(const Pipeline &pipeline)
+  {
+    struct Slot
+    {
+      const std::string *statement;
+      bool prepare;
+    };
+
+    // Until the sync result is read the protocol state is unknown, so an
+    // exception before then leaves the connection marked unusable.
+    in_flight_ = true;
+
+    auto &pool = get_connection_pool();
+    std::vector<Slot> slots;
+    std::unordered_set<std::string> preparing;
+
+    for (const Pipeline::Query &query : pipeline.queries())
+    {
+      if (!prepared_.count(query.statement) && !preparing.count(query.statement))
+      {
+        const std::string &sql = pool.get_statement(query.statement);
+        if (!PQsendPrepare(conn_, query.statement.c_str(), sql.c_str(), 0, nullptr))
+        {
+          throw std::runtime_error("Failed to queue prepare for " + query.statement + ": " + last_error());
+        }
+        preparing.insert(query.statement);
+        slots.push_back({&query.statement, true});
+      }
+
+      std::vector<const char *> values;
+      values.reserve(query.params.size());
+      for (const auto &param : query.params)
+      {
+        values.push_back(param ? param->c_str() : nullptr);
+      }
+
+      if (!PQsendQueryPrepared(conn_, query.statement.c_str(), static_cast<int>(values.size()),
+                               values.data(), nullptr, nullptr, 0))
+      {
+        throw std::runtime_error("Failed to queue " + query.statement + ": " + last_error());
+      }
+      slots.push_back({&query.statement, false});
+    }
+
+    if (!PQpipelineSync(conn_))
+    {
+      throw std::runtime_error("Failed to sync PostgreSQL pipeline: " + last_error());
+    }
+    co_await flush();
+
+    std::vector<AsyncResult> results;
+    results.reserve(pipeline.size());
+    std::string error;
+    std::size_t slot = 0;
+
+    while (true)
+    {
+      PGresult *raw = co_await next_result();
+      if (!raw)
+      {
+        continue;
+      }
+
+      AsyncResult result(raw);
+      ExecStatusType status = PQresultStatus(raw);
+      if (status == PGRES_PIPELINE_SYNC)
+      {
+        break;
+      }
+      if (slot >= slots.size())
+      {
+        continue;
+      }
+
+      const Slot &current = slots[slot++];
+      bool ok = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+      if (!ok && error.empty())
+      {
+        error = status == PGRES_PIPELINE_ABORTED ? "pipeline aborted" : PQresultErrorMessage(raw);
+      }
+
+      if (current.prepare)
+      {
+        if (ok)
+        {
+          prepared_.insert(*current.statement);
+        }
+      }
+      else
+      {
+        results.push_back(std::move(result));
+      }
+    }
+
+    in_flight_ = false;
+    if (!error.empty())
+    {
+      throw std::runtime_error("PostgreSQL pipeline failed: " + error);
+    }
+    co_return results;
+  }
+
+  bool AsyncConnection::is_healthy() const
+  {
+    return conn_ && !in_flight_ && PQstatus(conn_) == CONNECTION_OK &&
+           PQpipelineStatus(conn_) == PQ_PIPELINE_ON;
+  }
+
+  AsyncLease::AsyncLease(AsyncPool &pool, std::unique_ptr<AsyncConnection> conn)
+      : pool_(&pool), conn_(std::move(conn))
+  {
+  }
+
+  /**
+   * Return the connection to its pool.
+   */
+  AsyncLease::~AsyncLease()
+  {
+    if (pool_ && conn_)
+    {
+      pool_->release(std::move(conn_));
+    }
+  }
+
+  AsyncLease::AsyncLease(AsyncLease &&other) noexcept
+      : pool_(std::exchange(other.pool_, nullptr)), conn_(std::move(other.conn_))
+  {
+  }
+
+  net::awaitable<std::vector<AsyncResult>> AsyncLease::run(const Pipeline &pipeline)
+  {
+    co_return co_await conn_->run(pipeline);
+  }
+
+  AsyncPool::AsyncPool(net::any_io_executor executor, std::string conninfo)
+      : executor_(std::move(executor)), conninfo_(std::move(conninfo))
+  {
+  }
+
+  /**
+   * Acquire a connection, opening a new one if both the pool and the
+   * process-wide budget allow it. When every connection is in use, the
+   * coroutine backs off on a timer instead of blocking its thread. While it
+   * waits on the budget, other pools close connections they release instead of
+   * keeping them idle, so a shard is never starved by idle connections held
+   * elsewhere.
+   *
+   * @return Lease on an open connection.
+   */
+  net::awaitable<AsyncLease> AsyncPool::acquire()
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ASYNC_ACQUIRE_TIMEOUT_MS);
+    auto backoff = std::chrono::milliseconds(1);
+
+    while (true)
+    {
+      std::unique_ptr<AsyncConnection> conn;
+      bool open_new = false;
+      bool over_budget = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty())
+        {
+          conn = std::move(idle_.back());
+          idle_.pop_back();
+        }
+        else if (open_connections_ < ASYNC_POOL_SIZE)
+        {
+          open_new = reserve_budget();
+          over_budget = !open_new;
+          if (open_new)
+          {
+            ++open_connections_;
+          }
+        }
+      }
+
+      if (conn)
+      {
+        co_return AsyncLease(*this, std::move(conn));
+      }
+
+      if (open_new)
+      {
+        conn = std::make_unique<AsyncConnection>(executor_);
+        try
+        {
+          co_await conn->connect(conninfo_);
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          --open_connections_;
+          --budget_used;
+          throw;
+        }
+        co_return AsyncLease(*this, std::move(conn));
+      }
+
+      if (std::chrono::steady_clock::now() > deadline)
+      {
+        throw std::runtime_error("Async connection pool timeout");
+      }
+
+      if (over_budget)
+      {
+        ++budget_waiters;
+      }
+      net::steady_timer timer(co_await net::this_coro::executor, backoff);
+      co_await timer.async_wait(net::use_awaitable);
+      if (over_budget)
+      {
+        --budget_waiters;
+      }
+      backoff = std::min(backoff * 2, std::chrono::milliseconds(50));
+    }
+  }
+
+  /**
+   * Return a connection to the pool. Connections left mid-pipeline or broken
+   * by an error are closed instead of reused, as are connections another pool
+   * is waiting on the budget for.
+   *
+   * @param conn Connection to return.
+   */
+  void AsyncPool::release(std::unique_ptr<AsyncConnection> conn)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!conn->is_healthy() || budget_waiters > 0)
+    {
+      --open_connections_;
+      --budget_used;
+      return;
+    }
+    idle_.push_back(std::move(conn));
+  }
+
+  /**
+   * Get the async pool for the io_context behind an executor, creating it on
+   * first use. Each io_context (one per core in sharded mode) gets its own pool,
+   * so connection sockets are only ever watched by the reactor that owns them.
+   *
+   * @param executor Executor of the calling coroutine.
+   * @return Async pool for the executor's io_context.
+   */
+  AsyncPool &get_async_pool(const net::any_io_executor &executor)
+  {
+    static std::mutex pools_mutex;
+    static std::unordered_map<net::io_context *, std::unique_ptr<AsyncPool>> pools;
+
+    net::io_context *io_context = nullptr;
+    if (auto *inner = executor.target<net::io_context::executor_type>())
+    {
+      io_context = &inner->context();
+    }
+    else if (auto *strand = executor.target<net::strand<net::io_context::executor_type>>())
+    {
+      io_context = &strand->get_inner_executor().context();
+    }
+    if (!io_context)
+    {
+      throw std::runtime_error("Async PostgreSQL pool requires an io_context executor");
+    }
+
+    std::lock_guard<std::mutex> lock(pools_mutex);
+    auto &pool = pools[io_context];
+    if (!pool)
+    {
+      pool = std::make_unique<AsyncPool>(io_context->get_executor(), connection_string());
+    }
+    return *pool;
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef PGASYNC_HPP
+#define PGASYNC_HPP
+
+#include <utility>
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <libpq-fe.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "config.h"
+
+namespace net = boost::asio;
+
+namespace postgres
+{
+  const int ASYNC_POOL_SIZE = 4;
+  const int ASYNC_CONNECTION_BUDGET = 16;
+  const int ASYNC_ACQUIRE_TIMEOUT_MS = 5000;
+
+  /**
+   * @brief Owning wrapper around a PGresult returned by the async driver.
+   */
+  class AsyncResult
+  {
+    struct Deleter
+    {
+      void operator()(PGresult *r) const { PQclear(r); }
+    };
+    std::unique_ptr<PGresult, Deleter> result_;
+
+  public:
+    AsyncResult() = default;
+    explicit AsyncResult(PGresult *result);
+
+    bool empty() const;
+    int rows() const;
+    int columns() const;
+    bool is_null(int row, int column) const;
+    std::string_view value(int row, int column) const;
+    long affected_rows() const;
+  };
+
+  /**
+   * @brief Batch of prepared statements sent to the server in one round trip.
+   *
+   * Statements are queued in order with exec_prepared and run by
+   * AsyncConnection::run, which returns one result per statement.
+   */
+  class Pipeline
+  {
+  public:
+    struct Query
+    {
+      std::string statement;
+      std::vector<std::optional<std::string>> params;
+    };
+
+    template <typename... Args>
+    Pipeline &exec_prepared(std::string statement, Args &&...args)
+    {
+      Query query{std::move(statement), {}};
+      query.params.reserve(sizeof...(Args));
+      (query.params.push_back(to_param(std::forward<Args>(args))), ...);
+      queries_.push_back(std::move(query));
+      return *this;
+    }
+
+    const std::vector<Query> &queries() const;
+    std::size_t size() const;
+    bool empty() const;
+
+  private:
+    std::vector<Query> queries_;
+
+    static std::optional<std::string> to_param(const std::string &value) { return value; }
+    static std::optional<std::string> to_param(std::string_view value) { return std::string(value); }
+    static std::optional<std::string> to_param(const char *value) { return std::string(value); }
+    static std::optional<std::string> to_param(bool value) { return std::string(value ? "t" : "f"); }
+    static std::optional<std::string> to_param(std::nullptr_t) { return std::nullopt; }
+    template <typename T>
+    static std::optional<std::string> to_param(const std::optional<T> &value)
+    {
+      return value ? to_param(*value) : std::nullopt;
+    }
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+    static std::optional<std::string> to_param(T value)
+    {
+      return std::to_string(value);
+    }
+  };
+
+  /**
+   * @brief Nonblocking libpq connection in pipeline mode, driven by asio.
+   *
+   * The connection socket is watched through a posix::stream_descriptor, so a
+   * coroutine awaiting a query suspends instead of blocking its thread. Prepared
+   * statements are looked up in the statement registry and prepared on first use,
+   * inside the same pipeline as the query that needs them.
+   */
+  class AsyncConnection
+  {
+    PGconn *conn_ = nullptr;
+    net::posix::stream_descriptor socket_;
+    std::unordered_set<std::string> prepared_;
+    bool in_flight_ = false;
+
+    void bind_socket();
+    net::awaitable<void> wait(net::posix::stream_descriptor::wait_type type);
+    net::awaitable<void> flush();
+    net::awaitable<PGresult *> next_result();
+    std::string last_error() const;
+
+  public:
+    explicit AsyncConnection(net::any_io_executor executor);
+    ~AsyncConnection();
+
+    AsyncConnection(const AsyncConnection &) = delete;
+    AsyncConnection &operator=(const AsyncConnection &) = delete;
+
+    net::awaitable<void> connect(const std::string &conninfo);
+    net::awaitable<std::vector<AsyncResult>> run(const Pipeline &pipeline);
+    bool is_healthy() const;
+  };
+
+  class AsyncPool;
+
+  /**
+   * @brief Lease on an async connection, returned to its pool on destruction.
+   */
+  class AsyncLease
+  {
+    AsyncPool *pool_;
+    std::unique_ptr<AsyncConnection> conn_;
+
+  public:
+    AsyncLease(AsyncPool &pool, std::unique_ptr<AsyncConnection> conn);
+    ~AsyncLease();
+
+    AsyncLease(AsyncLease &&other) noexcept;
+    AsyncLease &operator=(AsyncLease &&) = delete;
+    AsyncLease(const AsyncLease &) = delete;
+    AsyncLease &operator=(const AsyncLease &) = delete;
+
+    net::awaitable<std::vector<AsyncResult>> run(const Pipeline &pipeline);
+  };
+
+  /**
+   * @brief Small pool of async connections bound to one io_context.
+   *
+   * Each pool opens at most ASYNC_POOL_SIZE connections, and all pools of the
+   * process together at most ASYNC_CONNECTION_BUDGET, so a process never holds
+   * more than ASYNC_CONNECTION_BUDGET async backends whatever its shard count.
+   * These come on top of the primary and replica pools.
+   */
+  class AsyncPool
+  {
+    net::any_io_executor executor_;
+    std::string conninfo_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AsyncConnection>> idle_;
+    int open_connections_ = 0;
+
+  public:
+    AsyncPool(net::any_io_executor executor, std::string conninfo);
+
+    net::awaitable<AsyncLease> acquire();
+    void release(std::unique_ptr<AsyncConnection> conn);
+  };
+
+  AsyncPool &get_async_pool(const net::any_io_executor &executor);
+}
+
+#endif
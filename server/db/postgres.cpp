@@ -1,356 +1,795 @@
 #include "postgres.hpp"
 
+#include <charconv>
+
 namespace postgres
 {
   static ConnectionPool *global_pool = nullptr;
-  std::unordered_map<pqxx::connection *, ConnectionMetadata> connection_metadata;
+  static ConnectionPool *replica_pool = nullptr;
 
   /**
-   * Create a new connection for the connection pool.
-   * @return New connection.
+   * Add a statement to the registry.
+   * @param name Name of the statement.
+   * @param access Whether the statement only reads, and may run on a replica.
+   * @param sql SQL of the statement.
    */
-  pqxx::connection *ConnectionPool::create_new_connection()
+  void ConnectionPool::add_statement(const std::string &name, StatementAccess access, std::string sql)
   {
-    auto c = new pqxx::connection(
-        "user=" + std::string(READER_DB_USERNAME) +
-        " password=" + std::string(READER_DB_PASSWORD) +
-        " host=" + std::string(READER_DB_HOST) +
-        " port=" + std::string(READER_DB_PORT) +
-        " dbname=" + std::string(READER_DB_NAME) +
-        " target_session_attrs=read-write" +
-        " keepalives=1" +
-        " keepalives_idle=30");
+    prepared_statements.emplace(name, Statement{std::move(sql), access});
+  }
 
-    if (!c->is_open())
-    {
-      delete c;
-      throw std::runtime_error("Failed to open PostgreSQL connection!");
-    }
+  /**
+   * Register the SQL for every prepared statement used by the handlers.
+   * Connections prepare their statements from this map. Read-only statements
+   * may be routed to a read replica.
+   */
+  void ConnectionPool::register_statements()
+  {
+    // Text queries
+    add_statement("select_text_id", StatementAccess::ReadOnly,
+                  "SELECT id "
+                  "FROM public.\"Text\" "
+                  "WHERE text_object_id = $1 "
+                  "AND language = $2");
 
-    pqxx::work txn(*c);
+    add_statement("select_annotations", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT id::integer,"
+                  "         start::integer,"
+                  "         \"end\"::integer,"
+                  "         text_id::integer"
+                  "  FROM public.\"Annotation\" "
+                  "  WHERE text_id = $1"
+                  ") t");
 
-    // Text queries
-    txn.conn().prepare("select_text_id",
-                       "SELECT id "
-                       "FROM public.\"Text\" "
-                       "WHERE text_object_id = $1 "
-                       "AND language = $2");
-
-    txn.conn().prepare("select_annotations",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT id::integer,"
-                       "         start::integer,"
-                       "         \"end\"::integer,"
-                       "         text_id::integer"
-                       "  FROM public.\"Annotation\" "
-                       "  WHERE text_id = $1"
-                       ") t");
-
-    txn.conn().prepare("select_text_details",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT id::integer,"
-                       "         text::text,"
-                       "         language::text,"
-                       "         text_object_id::integer,"
-                       "         (SELECT row_to_json(a) "
-                       "          FROM ("
-                       "            SELECT id, audio_file, vtt_file, submission_group, submission_url "
-                       "            FROM public.\"Audio\" "
-                       "            WHERE id = t.audio_id"
-                       "          ) a"
-                       "         ) as audio"
-                       "  FROM public.\"Text\" t"
-                       "  WHERE text_object_id = $1"
-                       "  AND language = $2"
-                       ") t");
-
-    txn.conn().prepare("select_text_brief",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT t.id::integer,"
-                       "         tobj.title::text,"
-                       "         tobj.brief::text,"
-                       "         tobj.level::text,"
-                       "         t.audio_id::integer,"
-                       "         json_build_object("
-                       "           'id', tg.id,"
-                       "           'group_name', tg.group_name,"
-                       "           'group_url', tg.group_url"
-                       "         ) as \"group\","
-                       "         CASE WHEN t.author_id IS NOT NULL THEN json_build_object("
-                       "           'id', u.id,"
-                       "           'username', u.username,"
-                       "           'discord_id', u.discord_id,"
-                       "           'avatar', u.avatar,"
-                       "           'nickname', u.nickname,"
-                       "           'discord_status', u.discord_status"
-                       "         ) END as author,"
-                       "         (SELECT array_agg(language) FROM public.\"Text\" WHERE text_object_id = t.text_object_id) as languages"
-                       "  FROM public.\"Text\" t"
-                       "  LEFT JOIN public.\"TextObject\" tobj ON t.text_object_id = tobj.id"
-                       "  LEFT JOIN public.\"TextGroup\" tg ON tobj.group_id = tg.id"
-                       "  LEFT JOIN public.\"User\" u ON t.author_id = u.id"
-                       "  WHERE t.text_object_id = $1"
-                       "  AND t.language = $2"
-                       ") t");
+    add_statement("select_annotations_by_text_object", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT a.id::integer,"
+                  "         a.start::integer,"
+                  "         a.\"end\"::integer,"
+                  "         a.text_id::integer"
+                  "  FROM public.\"Annotation\" a"
+                  "  JOIN public.\"Text\" tx ON tx.id = a.text_id"
+                  "  WHERE tx.text_object_id = $1"
+                  "  AND tx.language = $2"
+                  "  ORDER BY a.start, a.id"
+                  ") t");
+
+    add_statement("select_text_details", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT id::integer,"
+                  "         text::text,"
+                  "         language::text,"
+                  "         text_object_id::integer,"
+                  "         (SELECT row_to_json(a) "
+                  "          FROM ("
+                  "            SELECT id, audio_file, vtt_file, submission_group, submission_url "
+                  "            FROM public.\"Audio\" "
+                  "            WHERE id = t.audio_id"
+                  "          ) a"
+                  "         ) as audio"
+                  "  FROM public.\"Text\" t"
+                  "  WHERE text_object_id = $1"
+                  "  AND language = $2"
+                  ") t");
+
+    add_statement("select_text_brief", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT t.id::integer,"
+                  "         tobj.title::text,"
+                  "         tobj.brief::text,"
+                  "         tobj.level::text,"
+                  "         t.audio_id::integer,"
+                  "         json_build_object("
+                  "           'id', tg.id,"
+                  "           'group_name', tg.group_name,"
+                  "           'group_url', tg.group_url"
+                  "         ) as \"group\","
+                  "         CASE WHEN t.author_id IS NOT NULL THEN json_build_object("
+                  "           'id', u.id,"
+                  "           'username', u.username,"
+                  "           'discord_id', u.discord_id,"
+                  "           'avatar', u.avatar,"
+                  "           'nickname', u.nickname,"
+                  "           'discord_status', u.discord_status"
+                  "         ) END as author,"
+                  "         (SELECT array_agg(language) FROM public.\"Text\" WHERE text_object_id = t.text_object_id) as languages"
+                  "  FROM public.\"Text\" t"
+                  "  LEFT JOIN public.\"TextObject\" tobj ON t.text_object_id = tobj.id"
+                  "  LEFT JOIN public.\"TextGroup\" tg ON tobj.group_id = tg.id"
+                  "  LEFT JOIN public.\"User\" u ON t.author_id = u.id"
+                  "  WHERE t.text_object_id = $1"
+                  "  AND t.language = $2"
+                  ") t");
+
+    // Same payload as select_text_brief for many text objects at once, one row
+    // per text object. $1 is an integer array literal of text object IDs.
+    add_statement("select_text_briefs", StatementAccess::ReadOnly,
+                  "SELECT t.text_object_id, array_to_json(array_agg(row_to_json(t)::jsonb - 'text_object_id')) "
+                  "FROM ("
+                  "  SELECT t.text_object_id::integer,"
+                  "         t.id::integer,"
+                  "         tobj.title::text,"
+                  "         tobj.brief::text,"
+                  "         tobj.level::text,"
+                  "         t.audio_id::integer,"
+                  "         json_build_object("
+                  "           'id', tg.id,"
+                  "           'group_name', tg.group_name,"
+                  "           'group_url', tg.group_url"
+                  "         ) as \"group\","
+                  "         CASE WHEN t.author_id IS NOT NULL THEN json_build_object("
+                  "           'id', u.id,"
+                  "           'username', u.username,"
+                  "           'discord_id', u.discord_id,"
+                  "           'avatar', u.avatar,"
+                  "           'nickname', u.nickname,"
+                  "           'discord_status', u.discord_status"
+                  "         ) END as author,"
+                  "         (SELECT array_agg(language) FROM public.\"Text\" WHERE text_object_id = t.text_object_id) as languages"
+                  "  FROM public.\"Text\" t"
+                  "  LEFT JOIN public.\"TextObject\" tobj ON t.text_object_id = tobj.id"
+                  "  LEFT JOIN public.\"TextGroup\" tg ON tobj.group_id = tg.id"
+                  "  LEFT JOIN public.\"User\" u ON t.author_id = u.id"
+                  "  WHERE t.text_object_id = ANY($1::integer[])"
+                  "  AND t.language = $2"
+                  ") t "
+                  "GROUP BY t.text_object_id");
 
     // Title queries
-    txn.conn().prepare("select_titles",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT id::integer,"
-                       "         title::text,"
-                       "         level::text,"
-                       "         group_id::integer "
-                       "  FROM public.\"TextObject\" "
-                       "  WHERE id > $2 "
-                       "  ORDER BY id "
-                       "  LIMIT $1"
-                       ") t");
+    // Title listing, one statement per sort order. Pages are fetched with a keyset
+    // cursor: $4 (and $5 for the non-unique sorts) hold the last row of the previous
+    // page, or NULL for the first page. $2 and $3 filter by level and group ID.
+    add_statement("select_titles", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT id::integer,"
+                  "         title::text,"
+                  "         level::text,"
+                  "         group_id::integer "
+                  "  FROM public.mv_textobject_list "
+                  "  WHERE ($2::text IS NULL OR level = $2) "
+                  "  AND ($3::integer IS NULL OR group_id = $3) "
+                  "  AND ($4::integer IS NULL OR id > $4) "
+                  "  ORDER BY id "
+                  "  LIMIT $1"
+                  ") t");
+
+    add_statement("select_titles_by_title", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT id::integer,"
+                  "         title::text,"
+                  "         level::text,"
+                  "         group_id::integer "
+                  "  FROM public.mv_textobject_list "
+                  "  WHERE ($2::text IS NULL OR level = $2) "
+                  "  AND ($3::integer IS NULL OR group_id = $3) "
+                  "  AND ($4::text IS NULL OR (title, id) > ($4, $5::integer)) "
+                  "  ORDER BY title, id "
+                  "  LIMIT $1"
+                  ") t");
+
+    add_statement("select_titles_by_level", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT id::integer,"
+                  "         title::text,"
+                  "         level::text,"
+                  "         group_id::integer "
+                  "  FROM public.mv_textobject_list "
+                  "  WHERE ($2::text IS NULL OR level = $2) "
+                  "  AND ($3::integer IS NULL OR group_id = $3) "
+                  "  AND ($4::text IS NULL OR (level, id) > ($4, $5::integer)) "
+                  "  ORDER BY level, id "
+                  "  LIMIT $1"
+                  ") t");
+
+    // Concurrent refreshes, which mv_textobject_list_id_idx allows, leave the
+    // listing readable while it is rebuilt.
+    add_statement("refresh_textobject_list", StatementAccess::ReadWrite,
+                  "REFRESH MATERIALIZED VIEW CONCURRENTLY public.mv_textobject_list");
+
+    add_statement("select_suggest_titles", StatementAccess::ReadOnly,
+                  "SELECT id::integer, title::text, level::text, group_id::integer "
+                  "FROM public.\"TextObject\"");
+
+    // Search index queries
+    add_statement("select_search_texts", StatementAccess::ReadOnly,
+                  "SELECT id::integer, text_object_id::integer, language::text, text::text "
+                  "FROM public.\"Text\"");
+
+    add_statement("select_search_text", StatementAccess::ReadOnly,
+                  "SELECT id::integer, text_object_id::integer, language::text, text::text "
+                  "FROM public.\"Text\" "
+                  "WHERE id = $1");
+
+    // Cache invalidation queries
+    // Texts whose cached briefs embed one of the text objects ($1) or groups ($2),
+    // flagged when their cached details embed one of the audio files ($3).
+    add_statement("select_invalidated_texts", StatementAccess::ReadOnly,
+                  "SELECT t.text_object_id::integer,"
+                  "       t.language::text,"
+                  "       COALESCE(t.audio_id = ANY($3::integer[]), false) "
+                  "FROM public.\"Text\" t "
+                  "LEFT JOIN public.\"TextObject\" tobj ON t.text_object_id = tobj.id "
+                  "WHERE t.text_object_id = ANY($1::integer[]) "
+                  "OR tobj.group_id = ANY($2::integer[]) "
+                  "OR t.audio_id = ANY($3::integer[])");
+
+    add_statement("notify_cache_invalidation", StatementAccess::ReadWrite,
+                  "SELECT pg_notify('cache_invalidation', $1)");
 
     // User queries
-    txn.conn().prepare("select_user_id",
-                       "SELECT id "
-                       "FROM public.\"User\" "
-                       "WHERE username = $1 "
-                       "LIMIT 1");
-
-    txn.conn().prepare("select_email",
-                       "SELECT email "
-                       "FROM public.\"User\" "
-                       "WHERE email = $1 "
-                       "LIMIT 1");
-
-    txn.conn().prepare("select_user_data_by_id",
-                       "SELECT row_to_json(t) "
-                       "FROM ("
-                       "  SELECT id, username, discord_id, avatar, nickname, accepted_policy "
-                       "  FROM public.\"User\" "
-                       "  WHERE id = $1 "
-                       "  LIMIT 1"
-                       ") t");
-
-    txn.conn().prepare("select_username_by_id",
-                       "SELECT username "
-                       "FROM public.\"User\" "
-                       "WHERE id = $1 "
-                       "LIMIT 1");
-
-    txn.conn().prepare("select_user_password",
-                       "SELECT password "
-                       "FROM public.\"User\" "
-                       "WHERE username = $1 "
-                       "LIMIT 1");
-
-    txn.conn().prepare("select_accepted_policy",
-                       "SELECT accepted_policy "
-                       "FROM public.\"User\" "
-                       "WHERE id = $1 "
-                       "LIMIT 1");
-
-    txn.conn().prepare("set_accepted_policy",
-                       "UPDATE public.\"User\" "
-                       "SET accepted_policy = $2 "
-                       "WHERE id = $1");
-
-    txn.conn().prepare("insert_user",
-                       "INSERT INTO public.\"User\" ("
-                       "username, email, password, levels, discord_id, account_creation_date, "
-                       "avatar, nickname"
-                       ") VALUES ("
-                       "$1, $2, $3, '{-1}', '-1', $4, '-1', $1"
-                       ")");
-
-    txn.conn().prepare("update_user_roles",
-                       "UPDATE public.\"User\" "
-                       "SET levels = $2 "
-                       "WHERE id = $1");
-
-    txn.conn().prepare("update_user_data",
-                       "UPDATE public.\"User\" "
-                       "SET avatar = $2, nickname = $3 "
-                       "WHERE id = $1");
+    add_statement("select_user_id", StatementAccess::ReadOnly,
+                  "SELECT id "
+                  "FROM public.\"User\" "
+                  "WHERE username = $1 "
+                  "LIMIT 1");
+
+    add_statement("select_email", StatementAccess::ReadOnly,
+                  "SELECT email "
+                  "FROM public.\"User\" "
+                  "WHERE email = $1 "
+                  "LIMIT 1");
+
+    add_statement("select_user_data_by_id", StatementAccess::ReadOnly,
+                  "SELECT row_to_json(t) "
+                  "FROM ("
+                  "  SELECT id, username, discord_id, avatar, nickname, accepted_policy "
+                  "  FROM public.\"User\" "
+                  "  WHERE id = $1 "
+                  "  LIMIT 1"
+                  ") t");
+
+    add_statement("select_username_by_id", StatementAccess::ReadOnly,
+                  "SELECT username "
+                  "FROM public.\"User\" "
+                  "WHERE id = $1 "
+                  "LIMIT 1");
+
+    add_statement("select_user_password", StatementAccess::ReadOnly,
+                  "SELECT password "
+                  "FROM public.\"User\" "
+                  "WHERE username = $1 "
+                  "LIMIT 1");
+
+    add_statement("select_accepted_policy", StatementAccess::ReadOnly,
+                  "SELECT accepted_policy "
+                  "FROM public.\"User\" "
+                  "WHERE id = $1 "
+                  "LIMIT 1");
+
+    add_statement("set_accepted_policy", StatementAccess::ReadWrite,
+                  "UPDATE public.\"User\" "
+                  "SET accepted_policy = $2 "
+                  "WHERE id = $1");
+
+    add_statement("insert_user", StatementAccess::ReadWrite,
+                  "INSERT INTO public.\"User\" ("
+                  "username, email, password, levels, discord_id, account_creation_date, "
+                  "avatar, nickname"
+                  ") VALUES ("
+                  "$1, $2, $3, '{-1}', '-1', $4, '-1', $1"
+                  ")");
+
+    add_statement("update_user_roles", StatementAccess::ReadWrite,
+                  "UPDATE public.\"User\" "
+                  "SET levels = $2 "
+                  "WHERE id = $1");
+
+    add_statement("update_user_data", StatementAccess::ReadWrite,
+                  "UPDATE public.\"User\" "
+                  "SET avatar = $2, nickname = $3 "
+                  "WHERE id = $1");
 
     // Discord user queries
-    txn.conn().prepare("select_user_id_by_discord_id",
-                       "SELECT id "
-                       "FROM public.\"User\" "
-                       "WHERE discord_id = $1 "
-                       "LIMIT 1");
-
-    txn.conn().prepare("register_with_discord",
-                       "INSERT INTO public.\"User\" ("
-                       "discord_id, username, avatar, account_creation_date"
-                       ") VALUES ("
-                       "$1, $2, $3, $4"
-                       ")");
-
-    txn.conn().prepare("link_user_to_discord",
-                       "UPDATE public.\"User\" "
-                       "SET discord_id = $2 "
-                       "WHERE id = $1");
-
-    txn.conn().prepare("validate_discord_status",
-                       "UPDATE public.\"User\" "
-                       "SET discord_status = true "
-                       "WHERE id = $1");
-
-    txn.conn().prepare("invalidate_discord_status",
-                       "UPDATE public.\"User\" "
-                       "SET discord_status = false "
-                       "WHERE id = $1");
+    add_statement("select_user_id_by_discord_id", StatementAccess::ReadOnly,
+                  "SELECT id "
+                  "FROM public.\"User\" "
+                  "WHERE discord_id = $1 "
+                  "LIMIT 1");
+
+    add_statement("register_with_discord", StatementAccess::ReadWrite,
+                  "INSERT INTO public.\"User\" ("
+                  "discord_id, username, avatar, account_creation_date"
+                  ") VALUES ("
+                  "$1, $2, $3, $4"
+                  ")");
+
+    add_statement("link_user_to_discord", StatementAccess::ReadWrite,
+                  "UPDATE public.\"User\" "
+                  "SET discord_id = $2 "
+                  "WHERE id = $1");
+
+    add_statement("validate_discord_status", StatementAccess::ReadWrite,
+                  "UPDATE public.\"User\" "
+                  "SET discord_status = true "
+                  "WHERE id = $1");
+
+    add_statement("invalidate_discord_status", StatementAccess::ReadWrite,
+                  "UPDATE public.\"User\" "
+                  "SET discord_status = false "
+                  "WHERE id = $1");
 
     // Profile queries
-    txn.conn().prepare("select_profile_data",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT json_build_object("
-                       "           'id', u.id,"
-                       "           'username', u.username,"
-                       "           'discord_id', u.discord_id,"
-                       "           'avatar', u.avatar,"
-                       "           'nickname', u.nickname,"
-                       "           'discord_status', u.discord_status"
-                       "         ) as user,"
-                       "         u.levels,"
-                       "         COUNT(DISTINCT a.id) as annotation_count,"
-                       "         COUNT(DISTINCT CASE WHEN uai.type = 'LIKE' THEN uai.id END) as like_count,"
-                       "         COUNT(DISTINCT CASE WHEN uai.type = 'DISLIKE' THEN uai.id END) as dislike_count"
-                       "  FROM public.\"User\" u"
-                       "  LEFT JOIN public.\"Annotation\" a ON a.user_id = u.id"
-                       "  LEFT JOIN public.\"UserAnnotationInteraction\" uai ON uai.user_id = u.id"
-                       "  WHERE u.id = $1"
-                       "  GROUP BY u.id, u.username, u.discord_id, u.avatar, u.nickname, u.discord_status, u.levels"
-                       ") t");
+    add_statement("select_profile_data", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT json_build_object("
+                  "           'id', u.id,"
+                  "           'username', u.username,"
+                  "           'discord_id', u.discord_id,"
+                  "           'avatar', u.avatar,"
+                  "           'nickname', u.nickname,"
+                  "           'discord_status', u.discord_status"
+                  "         ) as user,"
+                  "         u.levels,"
+                  "         COALESCE(s.annotation_count, 0) as annotation_count,"
+                  "         COALESCE(s.like_count, 0) as like_count,"
+                  "         COALESCE(s.dislike_count, 0) as dislike_count"
+                  "  FROM public.\"User\" u"
+                  "  LEFT JOIN public.\"UserStats\" s ON s.user_id = u.id"
+                  "  WHERE u.id = $1"
+                  ") t");
 
     // Annotation queries
-    txn.conn().prepare("select_annotation_data",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT json_build_object("
-                       "           'id', a.id::integer,"
-                       "           'start', a.start,"
-                       "           'end', a.\"end\","
-                       "           'text_id', a.text_id"
-                       "         ) as annotation,"
-                       "         a.description::text,"
-                       "         COALESCE(SUM(CASE WHEN uai.type = 'LIKE' THEN 1 ELSE 0 END), 0) as likes,"
-                       "         COALESCE(SUM(CASE WHEN uai.type = 'DISLIKE' THEN 1 ELSE 0 END), 0) as dislikes,"
-                       "         a.created_at::integer,"
-                       "         json_build_object("
-                       "           'id', u.id,"
-                       "           'username', u.username,"
-                       "           'discord_id', u.discord_id,"
-                       "           'avatar', u.avatar,"
-                       "           'discord_status', u.discord_status"
-                       "         ) as author "
-                       "  FROM public.\"Annotation\" a"
-                       "  LEFT JOIN public.\"User\" u ON a.user_id = u.id"
-                       "  LEFT JOIN public.\"UserAnnotationInteraction\" uai ON a.id = uai.annotation_id"
-                       "  WHERE a.text_id = $1 "
-                       "  AND a.start >= $2 "
-                       "  AND a.\"end\" <= $3"
-                       "  GROUP BY a.id, a.start, a.\"end\", a.text_id, a.description,"
-                       "  a.created_at, u.id, u.username, u.discord_id, u.discord_status, u.avatar"
-                       ") t");
-
-    txn.conn().prepare("select_annotation_ranges",
-                       "SELECT UNNEST(array_agg(start::integer)) as range_start, "
-                       "UNNEST(array_agg(\"end\"::integer)) as range_end "
-                       "FROM public.\"Annotation\" "
-                       "WHERE text_id = $1");
-
-    txn.conn().prepare("select_author_id_by_annotation",
-                       "SELECT user_id "
-                       "FROM public.\"Annotation\" "
-                       "WHERE id = $1");
-
-    txn.conn().prepare("insert_annotation",
-                       "INSERT INTO public.\"Annotation\" ("
-                       "text_id, user_id, start, \"end\", description, created_at"
-                       ") VALUES ("
-                       "$1, $2, $3, $4, $5, $6"
-                       ")");
-
-    txn.conn().prepare("update_annotation",
-                       "UPDATE public.\"Annotation\" "
-                       "SET description = $1 "
-                       "WHERE id = $2");
-
-    txn.conn().prepare("delete_annotation_interactions",
-                       "DELETE FROM public.\"UserAnnotationInteraction\" "
-                       "WHERE annotation_id = $1");
-
-    txn.conn().prepare("delete_annotation",
-                       "WITH deleted_interactions AS ("
-                       "  DELETE FROM public.\"UserAnnotationInteraction\" "
-                       "  WHERE annotation_id = $1"
-                       ")"
-                       "DELETE FROM public.\"Annotation\" "
-                       "WHERE id = $1");
+    // Details of annotations whose ranges were found in the annotation index.
+    add_statement("select_annotation_data", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT json_build_object("
+                  "           'id', a.id::integer,"
+                  "           'start', a.start,"
+                  "           'end', a.\"end\","
+                  "           'text_id', a.text_id"
+                  "         ) as annotation,"
+                  "         a.description::text,"
+                  "         a.likes,"
+                  "         a.dislikes,"
+                  "         a.created_at::integer,"
+                  "         json_build_object("
+                  "           'id', u.id,"
+                  "           'username', u.username,"
+                  "           'discord_id', u.discord_id,"
+                  "           'avatar', u.avatar,"
+                  "           'discord_status', u.discord_status"
+                  "         ) as author "
+                  "  FROM public.\"Annotation\" a"
+                  "  LEFT JOIN public.\"User\" u ON a.user_id = u.id"
+                  "  WHERE a.text_id = $1 "
+                  "  AND a.id = ANY($2::integer[]) "
+                  "  ORDER BY a.start, a.id"
+                  ") t");
+
+    add_statement("select_annotation_ranges", StatementAccess::ReadOnly,
+                  "SELECT id::integer, start::integer, \"end\"::integer "
+                  "FROM public.\"Annotation\" "
+                  "WHERE text_id = $1");
+
+    add_statement("select_author_id_by_annotation", StatementAccess::ReadOnly,
+                  "SELECT user_id "
+                  "FROM public.\"Annotation\" "
+                  "WHERE id = $1");
+
+    add_statement("insert_annotation", StatementAccess::ReadWrite,
+                  "WITH inserted AS ("
+                  "  INSERT INTO public.\"Annotation\" ("
+                  "  text_id, user_id, start, \"end\", description, created_at"
+                  "  ) VALUES ("
+                  "  $1, $2, $3, $4, $5, $6"
+                  "  ) "
+                  "  RETURNING id, user_id"
+                  "), stats AS ("
+                  "  INSERT INTO public.\"UserStats\" AS s (user_id, annotation_count) "
+                  "  SELECT user_id, 1 FROM inserted "
+                  "  ON CONFLICT (user_id) DO UPDATE SET annotation_count = s.annotation_count + 1"
+                  ") "
+                  "SELECT id FROM inserted");
+
+    add_statement("update_annotation", StatementAccess::ReadWrite,
+                  "UPDATE public.\"Annotation\" "
+                  "SET description = $1 "
+                  "WHERE id = $2");
+
+    add_statement("delete_annotation_interactions", StatementAccess::ReadWrite,
+                  "DELETE FROM public.\"UserAnnotationInteraction\" "
+                  "WHERE annotation_id = $1");
+
+    // Deleting an annotation takes it off its author's count and takes its votes
+    // off each voter's counts. Returns the text ID and the affected user IDs.
+    add_statement("delete_annotation", StatementAccess::ReadWrite,
+                  "WITH deleted_interactions AS ("
+                  "  DELETE FROM public.\"UserAnnotationInteraction\" "
+                  "  WHERE annotation_id = $1 "
+                  "  RETURNING user_id, type"
+                  "), deleted AS ("
+                  "  DELETE FROM public.\"Annotation\" "
+                  "  WHERE id = $1 "
+                  "  RETURNING text_id, user_id"
+                  "), changes AS ("
+                  "  SELECT user_id, 1 AS annotations, 0 AS likes, 0 AS dislikes FROM deleted "
+                  "  UNION ALL "
+                  "  SELECT user_id, 0, (type = 'LIKE')::integer, (type = 'DISLIKE')::integer FROM deleted_interactions"
+                  "), stats AS ("
+                  "  UPDATE public.\"UserStats\" s "
+                  "  SET annotation_count = s.annotation_count - c.annotations,"
+                  "      like_count = s.like_count - c.likes,"
+                  "      dislike_count = s.dislike_count - c.dislikes "
+                  "  FROM ("
+                  "    SELECT user_id, sum(annotations) AS annotations, sum(likes) AS likes, sum(dislikes) AS dislikes "
+                  "    FROM changes "
+                  "    GROUP BY user_id"
+                  "  ) c "
+                  "  WHERE s.user_id = c.user_id"
+                  ") "
+                  "SELECT d.text_id, (SELECT json_agg(DISTINCT user_id) FROM changes) "
+                  "FROM deleted d");
 
     // ... user annotation interaction queries ...
-    txn.conn().prepare("select_interaction_data",
-                       "SELECT array_to_json(array_agg(row_to_json(t))) "
-                       "FROM ("
-                       "  SELECT json_build_object("
-                       "           'user_id', uai.user_id,"
-                       "           'type', uai.type"
-                       "         ) as interaction "
-                       "  FROM public.\"UserAnnotationInteraction\" uai"
-                       "  WHERE uai.annotation_id = $1"
-                       ") t");
-
-    txn.conn().prepare("select_annotation_interaction_type",
-                       "SELECT type "
-                       "FROM public.\"UserAnnotationInteraction\" "
-                       "WHERE annotation_id = $1 "
-                       "AND user_id = $2");
-
-    txn.conn().prepare("insert_interaction",
-                       "INSERT INTO public.\"UserAnnotationInteraction\" ("
-                       "annotation_id, user_id, type"
-                       ") VALUES ("
-                       "$1, $2, $3"
-                       ")");
-
-    txn.conn().prepare("delete_interaction",
-                       "DELETE FROM public.\"UserAnnotationInteraction\" "
-                       "WHERE annotation_id = $1 "
-                       "AND user_id = $2");
-
-    txn.commit();
+    add_statement("select_interaction_data", StatementAccess::ReadOnly,
+                  "SELECT array_to_json(array_agg(row_to_json(t))) "
+                  "FROM ("
+                  "  SELECT json_build_object("
+                  "           'user_id', uai.user_id,"
+                  "           'type', uai.type"
+                  "         ) as interaction "
+                  "  FROM public.\"UserAnnotationInteraction\" uai"
+                  "  WHERE uai.annotation_id = $1"
+                  ") t");
+
+    // Votes a user has cast on the annotations of a text, keyed by annotation ID.
+    add_statement("select_reader_votes", StatementAccess::ReadOnly,
+                  "SELECT json_object_agg(uai.annotation_id, uai.type) "
+                  "FROM public.\"UserAnnotationInteraction\" uai "
+                  "JOIN public.\"Annotation\" a ON a.id = uai.annotation_id "
+                  "JOIN public.\"Text\" tx ON tx.id = a.text_id "
+                  "WHERE tx.text_object_id = $1 "
+                  "AND tx.language = $2 "
+                  "AND uai.user_id = $3");
+
+    // Serialise votes on an annotation. toggle_interaction works its counter
+    // deltas out from a snapshot of the user's previous vote, so that snapshot
+    // must be taken after any concurrent vote on the annotation has committed.
+    add_statement("lock_annotation_votes", StatementAccess::ReadWrite,
+                  "SELECT 1 "
+                  "FROM public.\"Annotation\" "
+                  "WHERE id = $1 "
+                  "FOR UPDATE");
+
+    // Toggle a user's vote in one statement: repeating the same vote removes it,
+    // a different vote replaces it. The counters on the annotation and the voter's
+    // stats move by the difference, and the new state and counts are returned.
+    // Run after lock_annotation_votes in the same transaction.
+    add_statement("toggle_interaction", StatementAccess::ReadWrite,
+                  "WITH previous AS ("
+                  "  SELECT type "
+                  "  FROM public.\"UserAnnotationInteraction\" "
+                  "  WHERE annotation_id = $1 "
+                  "  AND user_id = $2"
+                  "), removed AS ("
+                  "  DELETE FROM public.\"UserAnnotationInteraction\" "
+                  "  WHERE annotation_id = $1 "
+                  "  AND user_id = $2 "
+                  "  AND type = $3::public.\"InteractionType\" "
+                  "  RETURNING type"
+                  "), upserted AS ("
+                  "  INSERT INTO public.\"UserAnnotationInteraction\" (annotation_id, user_id, type) "
+                  "  SELECT $1, $2, $3::public.\"InteractionType\" "
+                  "  WHERE NOT EXISTS (SELECT 1 FROM removed) "
+                  "  ON CONFLICT (user_id, annotation_id) DO UPDATE SET type = EXCLUDED.type "
+                  "  RETURNING type"
+                  "), delta AS ("
+                  "  SELECT (SELECT count(*) FROM upserted WHERE type = 'LIKE')"
+                  "         - (SELECT count(*) FROM previous WHERE type = 'LIKE') AS like_delta,"
+                  "         (SELECT count(*) FROM upserted WHERE type = 'DISLIKE')"
+                  "         - (SELECT count(*) FROM previous WHERE type = 'DISLIKE') AS dislike_delta"
+                  "), voter AS ("
+                  "  INSERT INTO public.\"UserStats\" AS s (user_id, like_count, dislike_count) "
+                  "  SELECT $2, like_delta, dislike_delta FROM delta "
+                  "  ON CONFLICT (user_id) DO UPDATE "
+                  "  SET like_count = s.like_count + EXCLUDED.like_count,"
+                  "      dislike_count = s.dislike_count + EXCLUDED.dislike_count"
+                  "), counters AS ("
+                  "  UPDATE public.\"Annotation\" a "
+                  "  SET likes = a.likes + d.like_delta,"
+                  "      dislikes = a.dislikes + d.dislike_delta "
+                  "  FROM delta d "
+                  "  WHERE a.id = $1 "
+                  "  RETURNING a.likes, a.dislikes"
+                  ") "
+                  "SELECT json_build_object("
+                  "  'interaction', (SELECT type FROM upserted),"
+                  "  'likes', c.likes,"
+                  "  'dislikes', c.dislikes"
+                  ") "
+                  "FROM counters c");
+  }
+
+  /**
+   * Build the libpq connection string from the environment.
+   * @return Connection string for the primary database.
+   */
+  std::string connection_string()
+  {
+    return "user=" + std::string(READER_DB_USERNAME) +
+           " password=" + std::string(READER_DB_PASSWORD) +
+           " host=" + std::string(READER_DB_HOST) +
+           " port=" + std::string(READER_DB_PORT) +
+           " dbname=" + std::string(READER_DB_NAME) +
+           " target_session_attrs=read-write" +
+           " keepalives=1" +
+           " keepalives_idle=30";
+  }
+
+  /**
+   * Build the connection string for the read replica.
+   * @return Connection string, empty if no replica is configured.
+   */
+  std::string replica_connection_string()
+  {
+    if (std::string(READER_DB_REPLICA_HOST).empty())
+    {
+      return {};
+    }
+    std::string port = std::string(READER_DB_REPLICA_PORT).empty() ? std::string(READER_DB_PORT) : std::string(READER_DB_REPLICA_PORT);
+    return "user=" + std::string(READER_DB_USERNAME) +
+           " password=" + std::string(READER_DB_PASSWORD) +
+           " host=" + std::string(READER_DB_REPLICA_HOST) +
+           " port=" + port +
+           " dbname=" + std::string(READER_DB_NAME) +
+           " target_session_attrs=any" +
+           " keepalives=1" +
+           " keepalives_idle=30";
+  }
+
+  /**
+   * Parse a WAL position such as "16/B374D848" into a comparable integer.
+   * @param lsn WAL position in PostgreSQL's text format.
+   * @return WAL position as an integer, 0 if the text is malformed.
+   */
+  std::uint64_t parse_lsn(std::string_view lsn)
+  {
+    std::size_t slash = lsn.find('/');
+    if (slash == std::string_view::npos)
+    {
+      return 0;
+    }
+    std::uint64_t high = 0;
+    std::uint64_t low = 0;
+    auto [high_end, high_ec] = std::from_chars(lsn.data(), lsn.data() + slash, high, 16);
+    auto [low_end, low_ec] = std::from_chars(lsn.data() + slash + 1, lsn.data() + lsn.size(), low, 16);
+    if (high_ec != std::errc() || low_ec != std::errc())
+    {
+      return 0;
+    }
+    return (high << 32) | low;
+  }
+
+  /**
+   * Create a bounded free list. The capacity is rounded up to a power of two.
+   * @param capacity Minimum number of slots the list must hold.
+   */
+  FreeList::FreeList(std::size_t capacity)
+  {
+    std::size_t size = 2;
+    while (size < capacity)
+    {
+      size <<= 1;
+    }
+    cells.reset(new Cell[size]);
+    mask = size - 1;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+      cells[i].slot = nullptr;
+    }
+  }
+
+  /**
+   * Add an idle slot to the list.
+   * @param slot Slot to add.
+   * @return true if the slot was added, false if the list is full.
+   */
+  bool FreeList::push(PooledConnection *slot)
+  {
+    std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;)
+    {
+      cell = &cells[pos & mask];
+      std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+      if (diff == 0)
+      {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false;
+      }
+      else
+      {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->slot = slot;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Take an idle slot from the list.
+   * @return Slot, or nullptr if the list is empty.
+   */
+  PooledConnection *FreeList::pop()
+  {
+    std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;)
+    {
+      cell = &cells[pos & mask];
+      std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+      if (diff == 0)
+      {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        return nullptr;
+      }
+      else
+      {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    PooledConnection *slot = cell->slot;
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return slot;
+  }
+
+  // Slot this thread used last, reused first to keep its backend caches warm.
+  static thread_local PooledConnection *last_slot = nullptr;
+
+  /**
+   * Open a new connection to the database. Statements are not prepared here;
+   * each connection prepares a statement the first time a transaction uses it.
+   *
+   * @return New connection.
+   */
+  std::unique_ptr<pqxx::connection> ConnectionPool::create_new_connection()
+  {
+    auto c = std::make_unique<pqxx::connection>(conninfo);
 
+    if (!c->is_open())
+    {
+      throw std::runtime_error("Failed to open PostgreSQL connection!");
+    }
     return c;
   }
 
   /**
-   * Create a new connection pool with a given size.
-   * @param size Size of the connection pool.
+   * Replace the connection in a slot with a new one and reset its metadata.
+   * The caller must hold the slot.
+   *
+   * @param slot Slot to reconnect.
    */
-  ConnectionPool::ConnectionPool(int size) : max_size(size)
+  void ConnectionPool::reset_connection(PooledConnection &slot)
   {
-    for (int i = 0; i < size; ++i)
+    slot.conn.reset();
+    slot.metadata.prepared.clear();
+    slot.metadata.replayed_lsn = 0;
+    slot.metadata.is_healthy = false;
+
+    slot.conn = create_new_connection();
+    auto now = std::chrono::steady_clock::now();
+    slot.metadata.created = now;
+    slot.metadata.last_used = now;
+    slot.metadata.last_checked = now;
+    slot.metadata.is_healthy = true;
+  }
+
+  /**
+   * Open connections in parallel and add them to the free list.
+   * @param count Number of connections to open.
+   */
+  void ConnectionPool::open_connections(int count)
+  {
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<pqxx::connection>> opened(count);
+    std::mutex error_mutex;
+    std::string last_error;
+
+    workers.reserve(count);
+    for (int i = 0; i < count; ++i)
     {
-      pool.push(create_new_connection());
+      workers.emplace_back([this, i, &opened, &error_mutex, &last_error]
+                           {
+        try
+        {
+          opened[i] = create_new_connection();
+        }
+        catch (const std::exception &e)
+        {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          last_error = e.what();
+        } });
+    }
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto &c : opened)
+    {
+      if (!c)
+      {
+        continue;
+      }
+      PooledConnection &slot = slots[total_connections++];
+      slot.conn = std::move(c);
+      slot.metadata.created = now;
+      slot.metadata.last_used = now;
+      slot.metadata.last_checked = now;
+      slot.metadata.is_healthy = true;
+      slot.queued = true;
+      free_list.push(&slot);
+    }
+
+    if (total_connections == 0 && count > 0)
+    {
+      throw std::runtime_error("Failed to open PostgreSQL connections: " + last_error);
     }
   }
 
   /**
-   * Destroy the connection pool and free all connections.
+   * Create a new connection pool. The minimum number of connections is opened
+   * up front; the health checker opens more on demand, up to the maximum.
+   *
+   * @param min_size Number of connections to open at startup.
+   * @param max_size Maximum number of connections the pool may hold.
+   * @param conninfo Connection string for the pool's server.
+   */
+  ConnectionPool::ConnectionPool(int min_size, int max_size, std::string conninfo)
+      : conninfo(std::move(conninfo)),
+        slots(new PooledConnection[max_size]),
+        free_list(max_size),
+        min_size(std::min(min_size, max_size)),
+        max_size(max_size)
+  {
+    register_statements();
+    open_connections(this->min_size);
+    health_thread = std::thread([this]
+                                { health_check_loop(); });
+  }
+
+  /**
+   * Stop the health checker and destroy the connection pool. Connections are
+   * closed with their slots.
    */
   ConnectionPool::~ConnectionPool()
   {
-    std::lock_guard<std::mutex> lock(pool_mutex);
-    while (!pool.empty())
     {
-      auto c = pool.front();
-      pool.pop();
-      delete c;
+      std::lock_guard<std::mutex> lock(health_mutex);
+      health_stop = true;
+    }
+    health_cv.notify_all();
+    if (health_thread.joinable())
+    {
+      health_thread.join();
     }
-    connection_metadata.clear();
   }
 
   /**
@@ -359,9 +798,15 @@ namespace postgres
    */
   int ConnectionPool::validate_connection(pqxx::connection *c)
   {
+    if (!c || !c->is_open())
+    {
+      return false;
+    }
     try
     {
-      return c->is_open();
+      pqxx::nontransaction ping(*c);
+      ping.exec("SELECT 1");
+      return true;
     }
     catch (...)
     {
@@ -370,92 +815,295 @@ namespace postgres
   }
 
   /**
-   * Acquire a connection from the pool. This function will block until a connection is available.
-   * If a connection is not used for more than 1 minute, it will be released.
+   * Try to take an idle slot without blocking. The slot this thread used last
+   * is preferred; otherwise slots are taken from the free list.
    *
-   * @return Connection from the pool.
+   * A slot may be claimed through affinity while it is still queued, so popped
+   * slots that are already busy are skipped. Their holder queues them again on
+   * release. Slots without a healthy connection are left for the health checker.
+   *
+   * @return Slot now held by the caller, or nullptr if none is idle.
    */
-  pqxx::connection *ConnectionPool::acquire()
+  PooledConnection *ConnectionPool::try_acquire()
   {
-    pqxx::connection *c = nullptr;
-    auto now = std::chrono::steady_clock::now();
+    auto usable = [this](PooledConnection *slot)
+    {
+      bool expected = false;
+      if (!slot->busy.compare_exchange_strong(expected, true))
+      {
+        return false;
+      }
+      if (slot->conn && slot->metadata.is_healthy)
+      {
+        return true;
+      }
+      slot->busy = false;
+      request_refill();
+      return false;
+    };
 
+    PooledConnection *slot = last_slot;
+    if (slot && slot >= slots.get() && slot < slots.get() + max_size && usable(slot))
     {
-      std::unique_lock<std::mutex> lock(pool_mutex);
-      bool got_connection = pool_cv.wait_for(
-          lock, std::chrono::milliseconds(ACQUIRE_TIMEOUT_MS), [this]
-          { return !pool.empty(); });
+      return slot;
+    }
 
-      if (!got_connection)
+    while ((slot = free_list.pop()) != nullptr)
+    {
+      slot->queued = false;
+      if (usable(slot))
       {
-        failed_acquires++;
-        throw std::runtime_error("Connection pool timeout");
+        return slot;
       }
-
-      c = pool.front();
-      pool.pop();
-      active_connections++;
     }
+    return nullptr;
+  }
 
-    for (int retry = 0; retry < MAX_RETRIES; retry++)
+  /**
+   * Hand a held slot out to the caller.
+   * @param slot Slot held by the caller.
+   * @return The same slot.
+   */
+  PooledConnection *ConnectionPool::checkout(PooledConnection *slot)
+  {
+    active_connections++;
+    slot->metadata.last_used = std::chrono::steady_clock::now();
+    last_slot = slot;
+    return slot;
+  }
+
+  /**
+   * Acquire a connection from the pool. If no connection is idle, the health
+   * checker is asked to open another one (up to the maximum size) and this
+   * blocks until a connection is available.
+   *
+   * @return Slot holding the connection.
+   */
+  PooledConnection *ConnectionPool::acquire()
+  {
+    if (PooledConnection *slot = try_acquire())
     {
-      // Health check
-      ConnectionMetadata &metadata = connection_metadata[c];
-      const auto connection_age = std::chrono::duration_cast<std::chrono::minutes>(
-                                      now - metadata.last_used)
-                                      .count();
-      const auto last_health_check = std::chrono::duration_cast<std::chrono::seconds>(
-                                         now - metadata.last_checked)
-                                         .count();
+      return checkout(slot);
+    }
+    request_refill();
 
-      if (connection_age > CONNECTION_LIFETIME_MIN || last_health_check > HEALTH_CHECK_INTERVAL_SEC)
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ACQUIRE_TIMEOUT_MS);
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    waiters++;
+    for (;;)
+    {
+      // Check again after registering as a waiter so a release that did not
+      // see the waiter has already made its slot visible.
+      PooledConnection *slot = try_acquire();
+      if (slot || pool_cv.wait_until(lock, deadline) == std::cv_status::timeout)
       {
-        metadata.is_healthy = validate_connection(c);
-        metadata.last_checked = now;
-
-        if (!metadata.is_healthy)
+        waiters--;
+        if (!slot)
+        {
+          slot = try_acquire();
+        }
+        if (!slot)
         {
-          delete c;
-          try
-          {
-            // Attempt to create a new connection
-            c = create_new_connection();
-            connection_metadata[c] = {now, now, true};
-            return c;
-          }
-          catch (const std::exception &e)
-          {
-            if (retry == MAX_RETRIES - 1)
-            {
-              active_connections--;
-              throw;
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100 * (retry + 1)));
-            continue;
-          }
+          failed_acquires++;
+          throw std::runtime_error("Connection pool timeout");
         }
+        lock.unlock();
+        return checkout(slot);
       }
-      metadata.last_used = now;
-      return c;
     }
+  }
 
-    active_connections--;
-    throw std::runtime_error("Failed to acquire connection");
+  /**
+   * Return a held slot to the free list and wake a waiting thread.
+   * @param slot Slot to return.
+   */
+  void ConnectionPool::requeue(PooledConnection *slot)
+  {
+    slot->busy = false;
+    if (!slot->queued.exchange(true))
+    {
+      free_list.push(slot);
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters > 0)
+    {
+      std::lock_guard<std::mutex> lock(wait_mutex);
+      pool_cv.notify_one();
+    }
   }
 
   /**
-   * Release a connection back to the pool.
-   * @param c Connection to release.
+   * Release a connection back to the pool. A connection that was closed while
+   * in use is not queued; the health checker reconnects it.
+   *
+   * @param slot Slot to release.
    */
-  void ConnectionPool::release(pqxx::connection *c)
+  void ConnectionPool::release(PooledConnection *slot)
   {
-    std::lock_guard<std::mutex> lock(pool_mutex);
     if (active_connections > 0)
     {
       active_connections--;
     }
-    pool.push(c);
-    pool_cv.notify_one();
+
+    if (!slot->conn || !slot->conn->is_open())
+    {
+      slot->metadata.is_healthy = false;
+      slot->busy = false;
+      request_refill();
+      return;
+    }
+    requeue(slot);
+  }
+
+  /**
+   * Wake the health checker to repair broken slots and open connections for
+   * waiting threads.
+   */
+  void ConnectionPool::request_refill()
+  {
+    {
+      std::lock_guard<std::mutex> lock(health_mutex);
+      refill_requested = true;
+    }
+    health_cv.notify_one();
+  }
+
+  /**
+   * Open a connection in an unused slot and add it to the free list.
+   * @return true if a connection was opened, false if the pool is full or the
+   * connection failed.
+   */
+  bool ConnectionPool::open_slot()
+  {
+    int index = total_connections.load();
+    do
+    {
+      if (index >= max_size)
+      {
+        return false;
+      }
+    } while (!total_connections.compare_exchange_weak(index, index + 1));
+
+    PooledConnection &slot = slots[index];
+    slot.busy = true;
+    try
+    {
+      reset_connection(slot);
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "Failed to open PostgreSQL connection: " << e.what() << std::endl;
+      slot.busy = false;
+      return false;
+    }
+    requeue(&slot);
+    return true;
+  }
+
+  /**
+   * Check an idle slot held by the health checker. Broken connections and
+   * connections older than CONNECTION_LIFETIME_MIN are replaced; connections
+   * idle past the check interval are pinged.
+   *
+   * @param slot Slot held by the caller.
+   * @param now Time of the current pass.
+   */
+  void ConnectionPool::check_slot(PooledConnection &slot, std::chrono::steady_clock::time_point now)
+  {
+    ConnectionMetadata &metadata = slot.metadata;
+    const auto connection_age = std::chrono::duration_cast<std::chrono::minutes>(
+                                    now - metadata.created)
+                                    .count();
+    const auto last_health_check = std::chrono::duration_cast<std::chrono::seconds>(
+                                       now - metadata.last_checked)
+                                       .count();
+
+    if (slot.conn && metadata.is_healthy && last_health_check >= HEALTH_CHECK_INTERVAL_SEC)
+    {
+      metadata.is_healthy = validate_connection(slot.conn.get());
+      metadata.last_checked = now;
+    }
+
+    if (!slot.conn || !metadata.is_healthy || connection_age >= CONNECTION_LIFETIME_MIN)
+    {
+      try
+      {
+        reset_connection(slot);
+      }
+      catch (const std::exception &e)
+      {
+        // Left unqueued; the next pass tries again.
+        std::cerr << "Failed to reconnect to PostgreSQL: " << e.what() << std::endl;
+        slot.busy = false;
+        return;
+      }
+    }
+
+    if (slot.conn && slot.metadata.is_healthy)
+    {
+      requeue(&slot);
+    }
+    else
+    {
+      slot.busy = false;
+    }
+  }
+
+  /**
+   * Run one health check pass: check every idle slot, then top the pool up to
+   * its minimum size and open extra connections while threads are waiting.
+   */
+  void ConnectionPool::run_health_checks()
+  {
+    auto now = std::chrono::steady_clock::now();
+    int opened = total_connections;
+    for (int i = 0; i < opened; ++i)
+    {
+      PooledConnection &slot = slots[i];
+      bool expected = false;
+      if (slot.busy.compare_exchange_strong(expected, true))
+      {
+        check_slot(slot, now);
+      }
+    }
+
+    while (total_connections < min_size && open_slot())
+    {
+    }
+    while (waiters > 0 && open_slot())
+    {
+    }
+  }
+
+  /**
+   * Health checker thread. Runs a pass every HEALTH_CHECK_INTERVAL_SEC seconds,
+   * or sooner when a request thread asks for a refill.
+   */
+  void ConnectionPool::health_check_loop()
+  {
+    std::unique_lock<std::mutex> lock(health_mutex);
+    while (!health_stop)
+    {
+      health_cv.wait_for(lock, std::chrono::seconds(HEALTH_CHECK_INTERVAL_SEC), [this]
+                         { return health_stop || refill_requested; });
+      if (health_stop)
+      {
+        break;
+      }
+      refill_requested = false;
+
+      lock.unlock();
+      try
+      {
+        run_health_checks();
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "Connection health check failed: " << e.what() << std::endl;
+      }
+      lock.lock();
+    }
   }
 
   /**
@@ -465,9 +1113,68 @@ namespace postgres
   {
     if (!global_pool)
     {
-      global_pool = new ConnectionPool(std::max(10u, 2 * std::thread::hardware_concurrency()));
+      int max_size = static_cast<int>(std::max(10u, 2 * std::thread::hardware_concurrency()));
+      global_pool = new ConnectionPool(MIN_POOL_SIZE, max_size, connection_string());
+    }
+    std::cout << "Postgres connection pool initialized with " << global_pool->size() << " connections (max " << global_pool->max_size << ")." << std::endl;
+
+    std::string replica_conninfo = replica_connection_string();
+    if (!replica_pool && !replica_conninfo.empty())
+    {
+      replica_pool = new ConnectionPool(MIN_POOL_SIZE, global_pool->max_size, replica_conninfo);
+      std::cout << "Postgres replica pool initialized with " << replica_pool->size() << " connections (max " << replica_pool->max_size << ")." << std::endl;
     }
-    std::cout << "Postgres connection pool initialized with " << global_pool->max_size << " connections." << std::endl;
+  }
+
+  /**
+   * Prepare a registered statement on a connection if it has not been prepared
+   * there yet. Prepared statements outlive transactions, so each statement is
+   * prepared at most once per connection.
+   *
+   * @param slot Slot held by the caller.
+   * @param name Name of the statement.
+   * @return Access level of the statement.
+   */
+  StatementAccess ConnectionPool::prepare(PooledConnection &slot, std::string_view name)
+  {
+    std::string key(name);
+    auto prepared = slot.metadata.prepared.find(key);
+    if (prepared != slot.metadata.prepared.end())
+    {
+      return prepared->second;
+    }
+
+    auto it = prepared_statements.find(key);
+    if (it == prepared_statements.end())
+    {
+      throw std::runtime_error("Unknown prepared statement: " + key);
+    }
+    slot.conn->prepare(key, it->second.sql);
+    slot.metadata.prepared.emplace(std::move(key), it->second.access);
+    return it->second.access;
+  }
+
+  /**
+   * Get the number of connections currently open, idle or in use.
+   */
+  int ConnectionPool::size() const
+  {
+    return total_connections;
+  }
+
+  /**
+   * Get the SQL for a registered prepared statement.
+   * @param name Name of the statement.
+   * @return SQL of the statement.
+   */
+  const std::string &ConnectionPool::get_statement(const std::string &name) const
+  {
+    auto it = prepared_statements.find(name);
+    if (it == prepared_statements.end())
+    {
+      throw std::runtime_error("Unknown prepared statement: " + name);
+    }
+    return it->second.sql;
   }
 
   /**
@@ -482,4 +1189,18 @@ namespace postgres
     }
     return *global_pool;
   }
+
+  bool has_replica_pool()
+  {
+    return replica_pool != nullptr;
+  }
+
+  /**
+   * Get the read replica connection pool.
+   * @return Replica pool if one is configured, the global pool otherwise.
+   */
+  ConnectionPool &get_replica_pool()
+  {
+    return replica_pool ? *replica_pool : get_connection_pool();
+  }
 }
@@ -11,17 +11,77 @@
 #include <thread>
 #include <condition_variable>
 #include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <string_view>
+#include <vector>
 #include <algorithm>
+#include <memory>
 
 #include "config.h"
 
 namespace postgres
 {
+  const int MIN_POOL_SIZE = 4;
+
+  enum class StatementAccess
+  {
+    ReadOnly,
+    ReadWrite
+  };
+
+  struct Statement
+  {
+    std::string sql;
+    StatementAccess access;
+  };
+
   struct ConnectionMetadata
   {
+    std::chrono::time_point<std::chrono::steady_clock> created;
     std::chrono::time_point<std::chrono::steady_clock> last_used;
     std::chrono::time_point<std::chrono::steady_clock> last_checked;
     bool is_healthy;
+    std::unordered_map<std::string, StatementAccess> prepared;
+    std::uint64_t replayed_lsn;
+  };
+
+  /**
+   * @brief Pool slot holding a connection and its metadata.
+   *
+   * Slots are never freed while the pool is alive; a broken connection is
+   * replaced inside its slot by the health checker. The metadata is only
+   * touched by the thread that holds the slot, so it needs no locking.
+   */
+  struct PooledConnection
+  {
+    std::unique_ptr<pqxx::connection> conn;
+    ConnectionMetadata metadata{};
+    std::atomic<bool> busy{false};
+    std::atomic<bool> queued{false};
+  };
+
+  /**
+   * @brief Bounded lock-free multi-producer multi-consumer queue of idle slots.
+   */
+  class FreeList
+  {
+    struct Cell
+    {
+      std::atomic<std::size_t> sequence;
+      PooledConnection *slot;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos{0};
+
+  public:
+    explicit FreeList(std::size_t capacity);
+
+    bool push(PooledConnection *slot);
+    PooledConnection *pop();
   };
 
   class ConnectionPool
@@ -31,34 +91,66 @@ namespace postgres
     const int ACQUIRE_TIMEOUT_MS = 5000;
     const int CONNECTION_LIFETIME_MIN = 30;
     const int HEALTH_CHECK_INTERVAL_SEC = 30;
-    const int MAX_RETRIES = 3;
 
     std::atomic<int> active_connections{0};
+    std::atomic<int> total_connections{0};
     std::atomic<int> failed_acquires{0};
 
-    std::unordered_map<std::string, std::string> prepared_statements;
-    std::queue<pqxx::connection *> pool;
-    std::mutex pool_mutex;
+    std::string conninfo;
+    std::unordered_map<std::string, Statement> prepared_statements;
+    std::unique_ptr<PooledConnection[]> slots;
+    FreeList free_list;
+
+    // Only used when the pool is exhausted and a thread has to wait.
+    std::atomic<int> waiters{0};
+    std::mutex wait_mutex;
     std::condition_variable pool_cv;
 
-    pqxx::connection *create_new_connection();
+    // Background health checker; reconnects never happen on request threads.
+    std::thread health_thread;
+    std::mutex health_mutex;
+    std::condition_variable health_cv;
+    bool health_stop = false;
+    bool refill_requested = false;
+
+    void add_statement(const std::string &name, StatementAccess access, std::string sql);
+    void register_statements();
+    std::unique_ptr<pqxx::connection> create_new_connection();
+    void reset_connection(PooledConnection &slot);
+    void open_connections(int count);
+    PooledConnection *try_acquire();
+    PooledConnection *checkout(PooledConnection *slot);
+    void requeue(PooledConnection *slot);
+    void request_refill();
+    bool open_slot();
+    void check_slot(PooledConnection &slot, std::chrono::steady_clock::time_point now);
+    void run_health_checks();
+    void health_check_loop();
     int validate_connection(pqxx::connection *c);
 
   public:
+    int min_size;
     int max_size;
-    explicit ConnectionPool(int size);
+    ConnectionPool(int min_size, int max_size, std::string conninfo);
     ~ConnectionPool();
 
     ConnectionPool(const ConnectionPool &) = delete;
     ConnectionPool &operator=(const ConnectionPool &) = delete;
 
-    pqxx::connection *acquire();
-    void release(pqxx::connection *c);
+    PooledConnection *acquire();
+    void release(PooledConnection *slot);
+    StatementAccess prepare(PooledConnection &slot, std::string_view name);
+    const std::string &get_statement(const std::string &name) const;
+    int size() const;
   };
 
-  extern std::unordered_map<pqxx::connection *, ConnectionMetadata> connection_metadata;
+  std::string connection_string();
+  std::string replica_connection_string();
+  std::uint64_t parse_lsn(std::string_view lsn);
   void init_connection();
   ConnectionPool &get_connection_pool();
+  bool has_replica_pool();
+  ConnectionPool &get_replica_pool();
 }
 
 #endif
@@ -0,0 +1,72 @@
+#include "executor.hpp"
+#include "db/postgres.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace executor
+{
+  static BlockingExecutor *global_executor = nullptr;
+
+  /**
+   * Create a blocking executor.
+   * @param threads Number of worker threads.
+   * @param max_pending Maximum number of queued or running jobs.
+   */
+  BlockingExecutor::BlockingExecutor(std::size_t threads, std::size_t max_pending)
+      : pool_(threads), max_pending_(max_pending), thread_count_(threads)
+  {
+  }
+
+  /**
+   * Wait for queued jobs to finish and stop the worker threads.
+   */
+  BlockingExecutor::~BlockingExecutor()
+  {
+    pool_.join();
+  }
+
+  std::size_t BlockingExecutor::pending() const
+  {
+    return pending_.load(std::memory_order_acquire);
+  }
+
+  std::size_t BlockingExecutor::thread_count() const
+  {
+    return thread_count_;
+  }
+
+  net::thread_pool::executor_type BlockingExecutor::get_executor()
+  {
+    return pool_.get_executor();
+  }
+
+  /**
+   * Initialize the global blocking executor. The worker count is clamped to
+   * the Postgres pool size, so workers do not queue behind each other for
+   * connections. Must be called after postgres::init_connection.
+   */
+  void init_executor()
+  {
+    if (!global_executor)
+    {
+      std::size_t threads = std::max<std::size_t>(MIN_WORKER_THREADS, 2 * std::thread::hardware_concurrency());
+      threads = std::min<std::size_t>(threads, static_cast<std::size_t>(postgres::get_connection_pool().max_size));
+      global_executor = new BlockingExecutor(threads, MAX_QUEUE_DEPTH);
+    }
+    std::cout << "Blocking executor initialized with " << global_executor->thread_count() << " threads." << std::endl;
+  }
+
+  /**
+   * Get the global blocking executor.
+   * @return Global blocking executor.
+   */
+  BlockingExecutor &get_executor()
+  {
+    if (!global_executor)
+    {
+      throw std::runtime_error("Blocking executor not initialized. Call init_executor first.");
+    }
+    return *global_executor;
+  }
+}
@@ -0,0 +1,273 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#pragma once
+#include <utility>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace net = boost::asio;
+
+namespace executor
+{
+  const std::size_t MIN_WORKER_THREADS = 4;
+  const std::size_t MAX_QUEUE_DEPTH = 1024;
+
+  /**
+   * @brief Thrown to an awaiting coroutine when the executor queue is full.
+   */
+  class QueueFull : public std::runtime_error
+  {
+  public:
+    QueueFull() : std::runtime_error("Blocking executor queue is full") {}
+  };
+
+  /**
+   * @brief Bounded thread pool for blocking handler work (pqxx, redis++, outbound HTTP).
+   *
+   * I/O threads only accept, read and write; anything that may block is posted here.
+   * Once MAX_QUEUE_DEPTH jobs are queued or running, try_post refuses further work so
+   * the caller can shed load instead of queueing without limit.
+   */
+  class BlockingExecutor
+  {
+    net::thread_pool pool_;
+    std::atomic<std::size_t> pending_{0};
+    const std::size_t max_pending_;
+    const std::size_t thread_count_;
+
+  public:
+    BlockingExecutor(std::size_t threads, std::size_t max_pending);
+    ~BlockingExecutor();
+
+    BlockingExecutor(const BlockingExecutor &) = delete;
+    BlockingExecutor &operator=(const BlockingExecutor &) = delete;
+
+    /**
+     * Queue a job on the executor unless the queue is full.
+     * @param fn Job to run on a worker thread.
+     * @return true if the job was queued, false if the queue depth limit was reached.
+     */
+    template <typename Function>
+    bool try_post(Function &&fn)
+    {
+      if (pending_.fetch_add(1, std::memory_order_acq_rel) >= max_pending_)
+      {
+        pending_.fetch_sub(1, std::memory_order_acq_rel);
+        return false;
+      }
+
+      net::post(pool_, [this, fn = std::forward<Function>(fn)]() mutable
+                {
+        try
+        {
+          fn();
+        }
+        catch (const std::exception &e)
+        {
+          std::cerr << "Blocking job failed: " << e.what() << std::endl;
+        }
+        catch (...)
+        {
+          std::cerr << "Blocking job failed with unknown error" << std::endl;
+        }
+        pending_.fetch_sub(1, std::memory_order_acq_rel); });
+      return true;
+    }
+
+    std::size_t pending() const;
+    std::size_t thread_count() const;
+    net::thread_pool::executor_type get_executor();
+  };
+
+  void init_executor();
+  BlockingExecutor &get_executor();
+
+  /**
+   * Run several blocking functions concurrently on the blocking executor and
+   * resume the awaiting coroutine on its own executor once all of them finish.
+   * If any function throws, or cannot be queued, the first error is rethrown
+   * to the coroutine after the others complete.
+   *
+   * @param fns Functions to run. Their results must be default constructible.
+   * @return Tuple of the function results, in argument order.
+   */
+  template <typename... Functions>
+  net::awaitable<std::tuple<std::invoke_result_t<Functions &>...>> run_blocking_all(Functions... fns)
+  {
+    using Results = std::tuple<std::invoke_result_t<Functions &>...>;
+
+    auto initiation = [](auto handler, BlockingExecutor &blocking, std::tuple<Functions...> jobs)
+    {
+      using Handler = decltype(handler);
+
+      struct State
+      {
+        Handler handler;
+        Results results;
+        std::exception_ptr error;
+        std::atomic<std::size_t> remaining{sizeof...(Functions)};
+        std::atomic<bool> failed{false};
+
+        explicit State(Handler &&h) : handler(std::move(h)) {}
+
+        void fail(std::exception_ptr e)
+        {
+          if (!failed.exchange(true))
+          {
+            error = e;
+          }
+        }
+
+        static void finish(const std::shared_ptr<State> &state)
+        {
+          if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+          {
+            return;
+          }
+          auto target = net::get_associated_executor(state->handler);
+          net::post(target, [state]() mutable
+                    { state->handler(state->error, std::move(state->results)); });
+        }
+      };
+
+      auto state = std::make_shared<State>(std::move(handler));
+
+      auto submit = [&](auto index, auto &job)
+      {
+        constexpr std::size_t I = decltype(index)::value;
+        bool queued = blocking.try_post([state, job = std::move(job)]() mutable
+                                        {
+          try
+          {
+            std::get<I>(state->results) = job();
+          }
+          catch (...)
+          {
+            state->fail(std::current_exception());
+          }
+          State::finish(state); });
+
+        if (!queued)
+        {
+          state->fail(std::make_exception_ptr(QueueFull()));
+          State::finish(state);
+        }
+      };
+
+      [&]<std::size_t... I>(std::index_sequence<I...>)
+      {
+        (submit(std::integral_constant<std::size_t, I>{}, std::get<I>(jobs)), ...);
+      }(std::index_sequence_for<Functions...>{});
+    };
+
+    co_return co_await net::async_initiate<const net::use_awaitable_t<> &, void(std::exception_ptr, Results)>(
+        initiation, net::use_awaitable, std::ref(get_executor()), std::tuple<Functions...>(std::move(fns)...));
+  }
+
+  /**
+   * Run a runtime-sized list of blocking functions concurrently on the blocking
+   * executor and resume the awaiting coroutine on its own executor once all of
+   * them finish. Unlike run_blocking_all, a function that throws or cannot be
+   * queued does not fail the others: its error is handed to on_error, whose
+   * result takes the function's place.
+   *
+   * @param fns Functions to run. Their results must be default constructible.
+   * @param on_error Maps the error of a failed function to a result.
+   * @return Function results, in input order.
+   */
+  template <typename Function, typename ErrorFunction>
+  net::awaitable<std::vector<std::invoke_result_t<Function &>>> run_blocking_each(std::vector<Function> fns, ErrorFunction on_error)
+  {
+    using Result = std::invoke_result_t<Function &>;
+    using Results = std::vector<Result>;
+
+    if (fns.empty())
+    {
+      co_return Results{};
+    }
+
+    auto initiation = [](auto handler, BlockingExecutor &blocking, std::vector<Function> jobs, ErrorFunction on_error)
+    {
+      using Handler = decltype(handler);
+
+      struct State
+      {
+        Handler handler;
+        Results results;
+        ErrorFunction on_error;
+        std::atomic<std::size_t> remaining;
+
+        State(Handler &&h, std::size_t size, ErrorFunction &&e) : handler(std::move(h)), results(size), on_error(std::move(e)), remaining(size) {}
+
+        static void finish(const std::shared_ptr<State> &state)
+        {
+          if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+          {
+            return;
+          }
+          auto target = net::get_associated_executor(state->handler);
+          net::post(target, [state]() mutable
+                    { state->handler(std::move(state->results)); });
+        }
+      };
+
+      auto state = std::make_shared<State>(std::move(handler), jobs.size(), std::move(on_error));
+
+      for (std::size_t i = 0; i < jobs.size(); ++i)
+      {
+        bool queued = blocking.try_post([state, i, job = std::move(jobs[i])]() mutable
+                                        {
+          try
+          {
+            state->results[i] = job();
+          }
+          catch (...)
+          {
+            state->results[i] = state->on_error(std::current_exception());
+          }
+          State::finish(state); });
+
+        if (!queued)
+        {
+          state->results[i] = state->on_error(std::make_exception_ptr(QueueFull()));
+          State::finish(state);
+        }
+      }
+    };
+
+    co_return co_await net::async_initiate<const net::use_awaitable_t<> &, void(Results)>(
+        initiation, net::use_awaitable, std::ref(get_executor()), std::move(fns), std::move(on_error));
+  }
+
+  /**
+   * Run a blocking function on the blocking executor and resume the awaiting
+   * coroutine on its own executor with the result.
+   *
+   * @param fn Function to run. Its result must be default constructible.
+   * @return Result of the function.
+   */
+  template <typename Function>
+  net::awaitable<std::invoke_result_t<Function &>> run_blocking(Function fn)
+  {
+    auto results = co_await run_blocking_all(std::move(fn));
+    co_return std::move(std::get<0>(results));
+  }
+}
+
+#endif
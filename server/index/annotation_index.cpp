@@ -0,0 +1,380 @@
+#include "annotation_index.hpp"
+#include "../cache/invalidation.hpp"
+#include "../request/request.hpp"
+#include "../utils.hpp"
+
+#include <algorithm>
+
+namespace annotation_index
+{
+  /**
+   * Recompute the running maximum of ends from a position onwards.
+   * @param from First index to recompute.
+   */
+  void TextIntervals::rebuild_max_ends(std::size_t from)
+  {
+    max_ends.resize(ends.size());
+    for (std::size_t i = from; i < ends.size(); ++i)
+    {
+      max_ends[i] = i == 0 ? ends[i] : std::max(max_ends[i - 1], ends[i]);
+    }
+  }
+
+  /**
+   * Find the first range whose end, or any earlier range's end, reaches a position.
+   * No range before the returned index ends at or after the position.
+   *
+   * @param position Position to reach.
+   * @return Index of the first candidate range.
+   */
+  std::size_t TextIntervals::first_reaching(int position) const
+  {
+    return std::lower_bound(max_ends.begin(), max_ends.end(), position) - max_ends.begin();
+  }
+
+  /**
+   * Replace the ranges with a freshly loaded set.
+   * @param intervals Ranges of the text, in any order.
+   */
+  void TextIntervals::assign(std::vector<Interval> intervals)
+  {
+    std::sort(intervals.begin(), intervals.end(), [](const Interval &a, const Interval &b)
+              { return a.start < b.start || (a.start == b.start && a.id < b.id); });
+
+    starts.clear();
+    ends.clear();
+    ids.clear();
+    starts.reserve(intervals.size());
+    ends.reserve(intervals.size());
+    ids.reserve(intervals.size());
+    for (const Interval &interval : intervals)
+    {
+      starts.push_back(interval.start);
+      ends.push_back(interval.end);
+      ids.push_back(interval.id);
+    }
+    rebuild_max_ends(0);
+  }
+
+  /**
+   * Add a range. Adding a range whose ID is already present does nothing, so a
+   * write that raced with a load is not counted twice.
+   *
+   * @param interval Range to add.
+   * @return true if the range was added, false if it was already present.
+   */
+  bool TextIntervals::insert(const Interval &interval)
+  {
+    if (std::find(ids.begin(), ids.end(), interval.id) != ids.end())
+    {
+      return false;
+    }
+
+    std::size_t position = std::upper_bound(starts.begin(), starts.end(), interval.start) - starts.begin();
+    starts.insert(starts.begin() + position, interval.start);
+    ends.insert(ends.begin() + position, interval.end);
+    ids.insert(ids.begin() + position, interval.id);
+    rebuild_max_ends(position);
+    return true;
+  }
+
+  /**
+   * Remove a range by annotation ID.
+   * @param id ID of the annotation.
+   * @return true if the range was removed, false if it was not present.
+   */
+  bool TextIntervals::remove(int id)
+  {
+    auto it = std::find(ids.begin(), ids.end(), id);
+    if (it == ids.end())
+    {
+      return false;
+    }
+
+    std::size_t position = it - ids.begin();
+    starts.erase(starts.begin() + position);
+    ends.erase(ends.begin() + position);
+    ids.erase(ids.begin() + position);
+    rebuild_max_ends(position);
+    return true;
+  }
+
+  /**
+   * Check whether a new annotation may cover a range. Ranges include both
+   * ends, so a range overlaps an existing one if start <= existing.end and
+   * end >= existing.start; sharing a single endpoint counts as overlapping.
+   * A range that exactly matches an existing annotation is allowed.
+   *
+   * @param start Start position of the new annotation.
+   * @param end End position of the new annotation.
+   * @return true if the annotation may be inserted, false otherwise.
+   */
+  bool TextIntervals::can_insert(int start, int end) const
+  {
+    std::size_t last = std::upper_bound(starts.begin(), starts.end(), end) - starts.begin();
+    for (std::size_t i = first_reaching(start); i < last; ++i)
+    {
+      if (starts[i] == start && ends[i] == end)
+      {
+        return true;
+      }
+      if (ends[i] >= start)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Select the ranges that lie entirely inside a window.
+   * @param start Start of the window.
+   * @param end End of the window.
+   * @return Ranges with start >= window start and end <= window end.
+   */
+  std::vector<Interval> TextIntervals::within(int start, int end) const
+  {
+    std::vector<Interval> result;
+    std::size_t first = std::lower_bound(starts.begin(), starts.end(), start) - starts.begin();
+    std::size_t last = std::upper_bound(starts.begin(), starts.end(), end) - starts.begin();
+    for (std::size_t i = first; i < last; ++i)
+    {
+      if (ends[i] <= end)
+      {
+        result.push_back({ids[i], starts[i], ends[i]});
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Select every range of the text, ordered by start.
+   */
+  std::vector<Interval> TextIntervals::all() const
+  {
+    std::vector<Interval> result;
+    result.reserve(ids.size());
+    for (std::size_t i = 0; i < ids.size(); ++i)
+    {
+      result.push_back({ids[i], starts[i], ends[i]});
+    }
+    return result;
+  }
+
+  std::size_t TextIntervals::size() const
+  {
+    return ids.size();
+  }
+
+  AnnotationIndex::AnnotationIndex(Loader loader) : loader(std::move(loader))
+  {
+  }
+
+  /**
+   * Check whether an entry holds ranges the invalidation listener is still
+   * keeping current. The caller must hold the entry's lock.
+   */
+  bool AnnotationIndex::Entry::fresh() const
+  {
+    return loaded && epoch != 0 && epoch == invalidation::listening_epoch();
+  }
+
+  /**
+   * Get the entry for a text, creating an empty unloaded one if needed.
+   * @param text_id ID of the text.
+   */
+  std::shared_ptr<AnnotationIndex::Entry> AnnotationIndex::get_entry(int text_id)
+  {
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      auto it = entries.find(text_id);
+      if (it != entries.end())
+      {
+        return it->second;
+      }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto &entry = entries[text_id];
+    if (!entry)
+    {
+      entry = std::make_shared<Entry>();
+    }
+    return entry;
+  }
+
+  /**
+   * Get the entry for a text if one exists.
+   * @param text_id ID of the text.
+   */
+  std::shared_ptr<AnnotationIndex::Entry> AnnotationIndex::find_entry(int text_id)
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = entries.find(text_id);
+    return it == entries.end() ? nullptr : it->second;
+  }
+
+  /**
+   * Run a query against a text's ranges, loading them first if they are
+   * missing or no longer trusted. Loading holds the entry's exclusive lock, so
+   * writes and invalidations arriving while the load runs are applied after
+   * it. The listener's epoch is read before loading, so a load that spans a
+   * reconnection is not trusted.
+   *
+   * @param text_id ID of the text.
+   * @param fn Query to run on the ranges.
+   * @return Result of the query.
+   */
+  template <typename Fn>
+  auto AnnotationIndex::read(int text_id, Fn &&fn)
+  {
+    std::shared_ptr<Entry> entry = get_entry(text_id);
+    {
+      std::shared_lock<std::shared_mutex> lock(entry->mutex);
+      if (entry->fresh())
+      {
+        return fn(entry->intervals);
+      }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(entry->mutex);
+    if (!entry->fresh())
+    {
+      std::uint64_t epoch = invalidation::listening_epoch();
+      entry->intervals.assign(loader(text_id));
+      entry->loaded = true;
+      entry->epoch = epoch;
+    }
+    return fn(entry->intervals);
+  }
+
+  /**
+   * Check whether a new annotation may cover a range of a text, loading the
+   * text's ranges first if needed. The check is inclusive at both ends, and a
+   * range exactly matching an existing annotation is allowed.
+   *
+   * @param text_id ID of the text.
+   * @param start Start position of the new annotation.
+   * @param end End position of the new annotation.
+   * @return true if the annotation does not overlap an existing one.
+   */
+  bool AnnotationIndex::can_insert(int text_id, int start, int end)
+  {
+    return read(text_id, [start, end](const TextIntervals &intervals)
+                { return intervals.can_insert(start, end); });
+  }
+
+  /**
+   * Select the annotation ranges of a text that lie inside a window.
+   * @param text_id ID of the text.
+   * @param start Start of the window.
+   * @param end End of the window.
+   * @return Ranges inside the window, ordered by start.
+   */
+  std::vector<Interval> AnnotationIndex::within(int text_id, int start, int end)
+  {
+    return read(text_id, [start, end](const TextIntervals &intervals)
+                { return intervals.within(start, end); });
+  }
+
+  /**
+   * Select every annotation range of a text.
+   * @param text_id ID of the text.
+   * @return Ranges of the text, ordered by start.
+   */
+  std::vector<Interval> AnnotationIndex::all(int text_id)
+  {
+    return read(text_id, [](const TextIntervals &intervals)
+                { return intervals.all(); });
+  }
+
+  /**
+   * Record a committed annotation. Texts that are not loaded are left alone;
+   * their next load reads the annotation from the database.
+   *
+   * @param text_id ID of the text.
+   * @param interval Range of the new annotation.
+   */
+  void AnnotationIndex::insert(int text_id, const Interval &interval)
+  {
+    std::shared_ptr<Entry> entry = find_entry(text_id);
+    if (!entry)
+    {
+      return;
+    }
+    std::unique_lock<std::shared_mutex> lock(entry->mutex);
+    if (entry->loaded)
+    {
+      entry->intervals.insert(interval);
+    }
+  }
+
+  /**
+   * Record a deleted annotation.
+   * @param text_id ID of the text.
+   * @param id ID of the deleted annotation.
+   */
+  void AnnotationIndex::remove(int text_id, int id)
+  {
+    std::shared_ptr<Entry> entry = find_entry(text_id);
+    if (!entry)
+    {
+      return;
+    }
+    std::unique_lock<std::shared_mutex> lock(entry->mutex);
+    if (entry->loaded)
+    {
+      entry->intervals.remove(id);
+    }
+  }
+
+  /**
+   * Drop a text's ranges so the next query reloads them.
+   * @param text_id ID of the text.
+   */
+  void AnnotationIndex::invalidate(int text_id)
+  {
+    std::shared_ptr<Entry> entry = find_entry(text_id);
+    if (!entry)
+    {
+      return;
+    }
+    std::unique_lock<std::shared_mutex> lock(entry->mutex);
+    entry->loaded = false;
+  }
+
+  /**
+   * Select all annotation ranges for a given text ID from the primary, so an
+   * annotation written moments ago is never missing from the index. Errors are
+   * thrown so a failed load is not cached as an empty text.
+   *
+   * @param text_id ID of the text to select annotation ranges from.
+   * @return Ranges of the annotations on the text.
+   */
+  std::vector<Interval> select_annotation_ranges(int text_id)
+  {
+    utils::Logger::instance().debug("Loading annotation ranges for text_id=" + std::to_string(text_id));
+    request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+    pqxx::result r = txn.exec_prepared(
+        "select_annotation_ranges",
+        text_id);
+    txn.commit();
+
+    std::vector<Interval> ranges;
+    ranges.reserve(r.size());
+    for (const auto &row : r)
+    {
+      ranges.push_back({row[0].as<int>(), row[1].as<int>(), row[2].as<int>()});
+    }
+    return ranges;
+  }
+
+  /**
+   * Get the process-wide annotation index.
+   */
+  AnnotationIndex &get_annotation_index()
+  {
+    static AnnotationIndex index(select_annotation_ranges);
+    return index;
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef ANNOTATION_INDEX_HPP
+#define ANNOTATION_INDEX_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace annotation_index
+{
+  struct Interval
+  {
+    int id;
+    int start;
+    int end;
+  };
+
+  /**
+   * @brief Annotation ranges of one text, stored as parallel arrays sorted by start.
+   *
+   * max_ends[i] is the largest end among the first i + 1 ranges, which lets
+   * overlap queries skip every range that ends before the window with a
+   * binary search.
+   */
+  class TextIntervals
+  {
+    std::vector<int> starts;
+    std::vector<int> ends;
+    std::vector<int> ids;
+    std::vector<int> max_ends;
+
+    void rebuild_max_ends(std::size_t from);
+    std::size_t first_reaching(int position) const;
+
+  public:
+    void assign(std::vector<Interval> intervals);
+    bool insert(const Interval &interval);
+    bool remove(int id);
+
+    bool can_insert(int start, int end) const;
+    std::vector<Interval> within(int start, int end) const;
+    std::vector<Interval> all() const;
+    std::size_t size() const;
+  };
+
+  /**
+   * @brief Process-wide index of annotation ranges per text.
+   *
+   * A text's ranges are loaded from the primary on first use and kept up to
+   * date by this process's annotation write paths and by the cache
+   * invalidation listener, which drops a text's ranges whenever any server
+   * changes its annotations. Ranges are only trusted while the listener stays
+   * on the connection they were loaded under; while it is disconnected every
+   * query reloads from the primary.
+   */
+  class AnnotationIndex
+  {
+  public:
+    using Loader = std::function<std::vector<Interval>(int text_id)>;
+
+    explicit AnnotationIndex(Loader loader);
+
+    bool can_insert(int text_id, int start, int end);
+    std::vector<Interval> within(int text_id, int start, int end);
+    std::vector<Interval> all(int text_id);
+
+    void insert(int text_id, const Interval &interval);
+    void remove(int text_id, int id);
+    void invalidate(int text_id);
+
+  private:
+    struct Entry
+    {
+      std::shared_mutex mutex;
+      bool loaded = false;
+      std::uint64_t epoch = 0;
+      TextIntervals intervals;
+
+      bool fresh() const;
+    };
+
+    Loader loader;
+    std::shared_mutex mutex;
+    std::unordered_map<int, std::shared_ptr<Entry>> entries;
+
+    std::shared_ptr<Entry> get_entry(int text_id);
+    std::shared_ptr<Entry> find_entry(int text_id);
+    template <typename Fn>
+    auto read(int text_id, Fn &&fn);
+  };
+
+  std::vector<Interval> select_annotation_ranges(int text_id);
+  AnnotationIndex &get_annotation_index();
+}
+
+#endif
@@ -0,0 +1,734 @@
+#include "text_index.hpp"
+#include "../request/request.hpp"
+#include "../utils.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+namespace text_index
+{
+  namespace
+  {
+    /**
+     * Folded form of each code point in the Latin-1 Supplement and Latin
+     * Extended-A (U+00C0 to U+017F), the Greek and Coptic block (U+0370 to
+     * U+03FF) and Greek Extended (U+1F00 to U+1FFF). Letters map to their
+     * lowercase base letter with accents and breathings removed, final sigma
+     * maps to sigma, and anything that is not a letter or digit maps to 0.
+     */
+    const char16_t LATIN_FOLD[] = {
+        0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x00E6, 0x0063,
+        0x0065, 0x0065, 0x0065, 0x0065, 0x0069, 0x0069, 0x0069, 0x0069,
+        0x00F0, 0x006E, 0x006F, 0x006F, 0x006F, 0x006F, 0x006F, 0x0000,
+        0x00F8, 0x0075, 0x0075, 0x0075, 0x0075, 0x0079, 0x00FE, 0x00DF,
+        0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x00E6, 0x0063,
+        0x0065, 0x0065, 0x0065, 0x0065, 0x0069, 0x0069, 0x0069, 0x0069,
+        0x00F0, 0x006E, 0x006F, 0x006F, 0x006F, 0x006F, 0x006F, 0x0000,
+        0x00F8, 0x0075, 0x0075, 0x0075, 0x0075, 0x0079, 0x00FE, 0x0079,
+        0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0061, 0x0063, 0x0063,
+        0x0063, 0x0063, 0x0063, 0x0063, 0x0063, 0x0063, 0x0064, 0x0064,
+        0x0111, 0x0111, 0x0065, 0x0065, 0x0065, 0x0065, 0x0065, 0x0065,
+        0x0065, 0x0065, 0x0065, 0x0065, 0x0067, 0x0067, 0x0067, 0x0067,
+        0x0067, 0x0067, 0x0067, 0x0067, 0x0068, 0x0068, 0x0127, 0x0127,
+        0x0069, 0x0069, 0x0069, 0x0069, 0x0069, 0x0069, 0x0069, 0x0069,
+        0x0069, 0x0131, 0x0133, 0x0133, 0x006A, 0x006A, 0x006B, 0x006B,
+        0x0138, 0x006C, 0x006C, 0x006C, 0x006C, 0x006C, 0x006C, 0x0140,
+        0x0140, 0x0142, 0x0142, 0x006E, 0x006E, 0x006E, 0x006E, 0x006E,
+        0x006E, 0x0149, 0x014B, 0x014B, 0x006F, 0x006F, 0x006F, 0x006F,
+        0x006F, 0x006F, 0x0153, 0x0153, 0x0072, 0x0072, 0x0072, 0x0072,
+        0x0072, 0x0072, 0x0073, 0x0073, 0x0073, 0x0073, 0x0073, 0x0073,
+        0x0073, 0x0073, 0x0074, 0x0074, 0x0074, 0x0074, 0x0167, 0x0167,
+        0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075, 0x0075,
+        0x0075, 0x0075, 0x0075, 0x0075, 0x0077, 0x0077, 0x0079, 0x0079,
+        0x0079, 0x007A, 0x007A, 0x007A, 0x007A, 0x007A, 0x007A, 0x017F,
+    };
+
+    const char16_t GREEK_FOLD[] = {
+        0x0371, 0x0371, 0x0373, 0x0373, 0x02B9, 0x0000, 0x0377, 0x0377,
+        0x0000, 0x0000, 0x037A, 0x037B, 0x037C, 0x037D, 0x0000, 0x03F3,
+        0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x03B1, 0x0000,
+        0x03B5, 0x03B7, 0x03B9, 0x0000, 0x03BF, 0x0000, 0x03C5, 0x03C9,
+        0x03B9, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+        0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+        0x03C0, 0x03C1, 0x0000, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+        0x03C8, 0x03C9, 0x03B9, 0x03C5, 0x03B1, 0x03B5, 0x03B7, 0x03B9,
+        0x03C5, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+        0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+        0x03C0, 0x03C1, 0x03C3, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+        0x03C8, 0x03C9, 0x03B9, 0x03C5, 0x03BF, 0x03C5, 0x03C9, 0x03D7,
+        0x03D0, 0x03D1, 0x03D2, 0x03D2, 0x03D2, 0x03D5, 0x03D6, 0x03D7,
+        0x03D9, 0x03D9, 0x03DB, 0x03DB, 0x03DD, 0x03DD, 0x03DF, 0x03DF,
+        0x03E1, 0x03E1, 0x03E3, 0x03E3, 0x03E5, 0x03E5, 0x03E7, 0x03E7,
+        0x03E9, 0x03E9, 0x03EB, 0x03EB, 0x03ED, 0x03ED, 0x03EF, 0x03EF,
+        0x03F0, 0x03F1, 0x03F2, 0x03F3, 0x03B8, 0x03F5, 0x0000, 0x03F8,
+        0x03F8, 0x03F2, 0x03FB, 0x03FB, 0x03FC, 0x037B, 0x037C, 0x037D,
+    };
+
+    const char16_t GREEK_EXTENDED_FOLD[] = {
+        0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1,
+        0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1,
+        0x03B5, 0x03B5, 0x03B5, 0x03B5, 0x03B5, 0x03B5, 0x0000, 0x0000,
+        0x03B5, 0x03B5, 0x03B5, 0x03B5, 0x03B5, 0x03B5, 0x0000, 0x0000,
+        0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7,
+        0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7,
+        0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9,
+        0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x03B9,
+        0x03BF, 0x03BF, 0x03BF, 0x03BF, 0x03BF, 0x03BF, 0x0000, 0x0000,
+        0x03BF, 0x03BF, 0x03BF, 0x03BF, 0x03BF, 0x03BF, 0x0000, 0x0000,
+        0x03C5, 0x03C5, 0x03C5, 0x03C5, 0x03C5, 0x03C5, 0x03C5, 0x03C5,
+        0x0000, 0x03C5, 0x0000, 0x03C5, 0x0000, 0x03C5, 0x0000, 0x03C5,
+        0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9,
+        0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9,
+        0x03B1, 0x03B1, 0x03B5, 0x03B5, 0x03B7, 0x03B7, 0x03B9, 0x03B9,
+        0x03BF, 0x03BF, 0x03C5, 0x03C5, 0x03C9, 0x03C9, 0x0000, 0x0000,
+        0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1,
+        0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1,
+        0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7,
+        0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7, 0x03B7,
+        0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9,
+        0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9, 0x03C9,
+        0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x0000, 0x03B1, 0x03B1,
+        0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x03B1, 0x0000, 0x03B9, 0x0000,
+        0x0000, 0x0000, 0x03B7, 0x03B7, 0x03B7, 0x0000, 0x03B7, 0x03B7,
+        0x03B5, 0x03B5, 0x03B7, 0x03B7, 0x03B7, 0x0000, 0x0000, 0x0000,
+        0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x0000, 0x0000, 0x03B9, 0x03B9,
+        0x03B9, 0x03B9, 0x03B9, 0x03B9, 0x0000, 0x0000, 0x0000, 0x0000,
+        0x03C5, 0x03C5, 0x03C5, 0x03C5, 0x03C1, 0x03C1, 0x03C5, 0x03C5,
+        0x03C5, 0x03C5, 0x03C5, 0x03C5, 0x03C1, 0x0000, 0x0000, 0x0000,
+        0x0000, 0x0000, 0x03C9, 0x03C9, 0x03C9, 0x0000, 0x03C9, 0x03C9,
+        0x03BF, 0x03BF, 0x03C9, 0x03C9, 0x03C9, 0x0000, 0x0000, 0x0000,
+    };
+    const char32_t SKIP = 0xFFFFFFFF;
+
+    /**
+     * Fold a code point for search.
+     * @param cp Code point to fold.
+     * @return Folded code point, 0 for a word separator, or SKIP for a
+     * combining mark that belongs to the word it follows.
+     */
+    char32_t fold_code_point(char32_t cp)
+    {
+      if (cp < 0x80)
+      {
+        if ((cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z'))
+        {
+          return cp;
+        }
+        if (cp >= 'A' && cp <= 'Z')
+        {
+          return cp + ('a' - 'A');
+        }
+        return 0;
+      }
+      if (cp < 0xC0)
+      {
+        return 0;
+      }
+      if (cp < 0x180)
+      {
+        return LATIN_FOLD[cp - 0xC0];
+      }
+      if (cp >= 0x300 && cp < 0x370)
+      {
+        return SKIP;
+      }
+      if (cp >= 0x370 && cp < 0x400)
+      {
+        return GREEK_FOLD[cp - 0x370];
+      }
+      if (cp >= 0x1F00 && cp < 0x2000)
+      {
+        return GREEK_EXTENDED_FOLD[cp - 0x1F00];
+      }
+      if ((cp >= 0x2000 && cp < 0x2070) || (cp >= 0x3000 && cp < 0x3040) || cp == 0xFEFF)
+      {
+        return 0;
+      }
+      return cp;
+    }
+
+    /**
+     * Decode one UTF-8 code point. Invalid bytes decode to U+FFFD one byte at a time.
+     * @param text Text to decode from.
+     * @param i Byte offset to decode at, advanced past the code point.
+     * @return Decoded code point.
+     */
+    char32_t decode(std::string_view text, std::size_t &i)
+    {
+      unsigned char c = static_cast<unsigned char>(text[i]);
+      std::size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+      if (length == 0 || i + length > text.size())
+      {
+        ++i;
+        return 0xFFFD;
+      }
+
+      char32_t cp = length == 1 ? c : c & (0x7F >> length);
+      for (std::size_t k = 1; k < length; ++k)
+      {
+        unsigned char next = static_cast<unsigned char>(text[i + k]);
+        if ((next >> 6) != 0x2)
+        {
+          ++i;
+          return 0xFFFD;
+        }
+        cp = (cp << 6) | (next & 0x3F);
+      }
+      i += length;
+      return cp;
+    }
+
+    void append_utf8(std::string &out, char32_t cp)
+    {
+      if (cp < 0x80)
+      {
+        out.push_back(static_cast<char>(cp));
+      }
+      else if (cp < 0x800)
+      {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      }
+      else if (cp < 0x10000)
+      {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      }
+      else
+      {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+      }
+    }
+
+    /**
+     * Skip HTML markup at a position. Tags and character entities separate
+     * words but are never part of one.
+     *
+     * @param text Text being tokenized.
+     * @param i Byte offset of a '<' or '&', advanced past the markup if there is any.
+     * @return true if markup was skipped.
+     */
+    bool skip_markup(std::string_view text, std::size_t &i)
+    {
+      if (text[i] == '<')
+      {
+        std::size_t close = text.find('>', i);
+        i = close == std::string_view::npos ? text.size() : close + 1;
+        return true;
+      }
+      if (text[i] == '&')
+      {
+        std::size_t k = i + 1;
+        while (k < text.size() && k - i <= 10 && (std::isalnum(static_cast<unsigned char>(text[k])) || text[k] == '#'))
+        {
+          ++k;
+        }
+        if (k < text.size() && text[k] == ';' && k > i + 1)
+        {
+          i = k + 1;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    template <typename T>
+    auto find_text(T &list, int text_id)
+    {
+      return std::lower_bound(list.begin(), list.end(), text_id, [](const auto &posting, int id)
+                              { return posting.text_id < id; });
+    }
+  }
+
+  /**
+   * Fold text for search: lowercase it, strip Greek accents and breathings
+   * (tonos, dialytika and polytonic marks) and Latin diacritics, and collapse
+   * everything between words to a single space.
+   *
+   * @param text UTF-8 text to fold.
+   * @return Folded words separated by spaces.
+   */
+  std::string fold(std::string_view text)
+  {
+    std::string folded;
+    for (const Token &token : tokenize(text))
+    {
+      if (!folded.empty())
+      {
+        folded.push_back(' ');
+      }
+      folded += token.term;
+    }
+    return folded;
+  }
+
+  /**
+   * Split text into folded words, skipping HTML markup.
+   * @param text UTF-8 text to split.
+   * @return Words in order, with their byte ranges in the text.
+   */
+  std::vector<Token> tokenize(std::string_view text)
+  {
+    std::vector<Token> tokens;
+    Token current{{}, 0, 0};
+    bool in_word = false;
+
+    auto finish = [&]
+    {
+      if (in_word)
+      {
+        tokens.push_back(std::move(current));
+        current = Token{{}, 0, 0};
+        in_word = false;
+      }
+    };
+
+    std::size_t i = 0;
+    while (i < text.size())
+    {
+      if ((text[i] == '<' || text[i] == '&') && skip_markup(text, i))
+      {
+        finish();
+        continue;
+      }
+
+      std::size_t begin = i;
+      char32_t folded = fold_code_point(decode(text, i));
+      if (folded == SKIP)
+      {
+        if (in_word)
+        {
+          current.end = static_cast<std::uint32_t>(i);
+        }
+        continue;
+      }
+      if (folded == 0)
+      {
+        finish();
+        continue;
+      }
+
+      if (!in_word)
+      {
+        current.begin = static_cast<std::uint32_t>(begin);
+        in_word = true;
+      }
+      append_utf8(current.term, folded);
+      current.end = static_cast<std::uint32_t>(i);
+    }
+    finish();
+    return tokens;
+  }
+
+  /**
+   * Tokenise a text and group its word positions by term. This touches no
+   * shared state, so it runs before the index is locked.
+   *
+   * @param document Text to prepare.
+   * @return Entry for the text and the positions of each of its terms.
+   */
+  TextIndex::Prepared TextIndex::prepare(Document document)
+  {
+    std::vector<Token> tokens = tokenize(document.text);
+    Prepared prepared{Entry{std::move(document), {}, {}}, {}};
+    prepared.entry.spans.reserve(tokens.size());
+
+    for (std::uint32_t position = 0; position < tokens.size(); ++position)
+    {
+      prepared.entry.spans.emplace_back(tokens[position].begin, tokens[position].end);
+      prepared.positions[tokens[position].term].push_back(position);
+    }
+
+    prepared.entry.terms.reserve(prepared.positions.size());
+    for (const auto &term_positions : prepared.positions)
+    {
+      prepared.entry.terms.push_back(term_positions.first);
+    }
+    return prepared;
+  }
+
+  /**
+   * Add a prepared text to the index. The caller must hold the index's
+   * exclusive lock and make sure the text is not already indexed.
+   *
+   * @param prepared Text to add.
+   */
+  void TextIndex::add_locked(Prepared prepared)
+  {
+    int text_id = prepared.entry.document.text_id;
+    for (auto &[term, term_positions] : prepared.positions)
+    {
+      std::vector<Posting> &list = postings[term];
+      list.insert(find_text(list, text_id), Posting{text_id, std::move(term_positions)});
+    }
+    entries.emplace(text_id, std::move(prepared.entry));
+  }
+
+  /**
+   * Remove a text from the index. The caller must hold the index's exclusive lock.
+   * @param text_id ID of the text.
+   */
+  void TextIndex::remove_locked(int text_id)
+  {
+    auto entry = entries.find(text_id);
+    if (entry == entries.end())
+    {
+      return;
+    }
+
+    for (const std::string &term : entry->second.terms)
+    {
+      auto list = postings.find(term);
+      if (list == postings.end())
+      {
+        continue;
+      }
+      auto posting = find_text(list->second, text_id);
+      if (posting != list->second.end() && posting->text_id == text_id)
+      {
+        list->second.erase(posting);
+      }
+      if (list->second.empty())
+      {
+        postings.erase(list);
+      }
+    }
+    entries.erase(entry);
+  }
+
+  /**
+   * Replace the whole index. The new index is built before the lock is taken,
+   * so searches keep running against the old one while it builds.
+   *
+   * @param documents Every text to index.
+   */
+  void TextIndex::assign(std::vector<Document> documents)
+  {
+    TextIndex next;
+    for (Document &document : documents)
+    {
+      next.remove_locked(document.text_id);
+      next.add_locked(prepare(std::move(document)));
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    postings.swap(next.postings);
+    entries.swap(next.entries);
+  }
+
+  /**
+   * Add a text, or replace it if it is already indexed. The text is tokenised
+   * before the lock is taken, so searches only wait for the postings update.
+   *
+   * @param document Text to index.
+   */
+  void TextIndex::upsert(Document document)
+  {
+    Prepared prepared = prepare(std::move(document));
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    remove_locked(prepared.entry.document.text_id);
+    add_locked(std::move(prepared));
+  }
+
+  /**
+   * Remove a text from the index.
+   * @param text_id ID of the text.
+   */
+  void TextIndex::remove(int text_id)
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    remove_locked(text_id);
+  }
+
+  /**
+   * Find every occurrence of a phrase. The caller must hold the index's lock,
+   * and the result is only valid while it does.
+   *
+   * @param terms Folded words of the phrase, in order.
+   * @param storage Holds the occurrences of a phrase of several words.
+   * @return Texts containing the phrase and the positions it starts at, sorted
+   * by text ID. A single word's posting list is returned without copying it.
+   */
+  std::span<const TextIndex::Posting> TextIndex::match_phrase(const std::vector<std::string> &terms, std::vector<Posting> &storage) const
+  {
+    std::vector<const std::vector<Posting> *> lists;
+    lists.reserve(terms.size());
+    for (const std::string &term : terms)
+    {
+      auto list = postings.find(term);
+      if (list == postings.end())
+      {
+        return {};
+      }
+      lists.push_back(&list->second);
+    }
+
+    if (lists.size() == 1)
+    {
+      return *lists.front();
+    }
+
+    storage.clear();
+    for (const Posting &first : *lists.front())
+    {
+      std::vector<const std::vector<std::uint32_t> *> following;
+      following.reserve(lists.size() - 1);
+      for (std::size_t k = 1; k < lists.size(); ++k)
+      {
+        auto posting = find_text(*lists[k], first.text_id);
+        if (posting == lists[k]->end() || posting->text_id != first.text_id)
+        {
+          break;
+        }
+        following.push_back(&posting->positions);
+      }
+      if (following.size() != lists.size() - 1)
+      {
+        continue;
+      }
+
+      Posting match{first.text_id, {}};
+      for (std::uint32_t position : first.positions)
+      {
+        bool found = true;
+        for (std::size_t k = 0; k < following.size() && found; ++k)
+        {
+          found = std::binary_search(following[k]->begin(), following[k]->end(), position + static_cast<std::uint32_t>(k) + 1);
+        }
+        if (found)
+        {
+          match.positions.push_back(position);
+        }
+      }
+      if (!match.positions.empty())
+      {
+        storage.push_back(std::move(match));
+      }
+    }
+    return storage;
+  }
+
+  /**
+   * Cut a keyword-in-context line out of a text.
+   * @param entry Indexed text.
+   * @param position Word position the match starts at.
+   * @param length Number of words in the match.
+   * @param context Number of words to show on each side.
+   * @return Match with the text before, of and after it.
+   */
+  Match TextIndex::make_match(const Entry &entry, std::uint32_t position, std::size_t length, int context) const
+  {
+    const std::string &text = entry.document.text;
+    std::uint32_t last = position + static_cast<std::uint32_t>(length) - 1;
+    std::uint32_t first_context = position > static_cast<std::uint32_t>(context) ? position - context : 0;
+    std::uint32_t last_context = std::min<std::uint32_t>(last + context, static_cast<std::uint32_t>(entry.spans.size()) - 1);
+
+    std::uint32_t match_begin = entry.spans[position].first;
+    std::uint32_t match_end = entry.spans[last].second;
+    std::uint32_t left_begin = entry.spans[first_context].first;
+    std::uint32_t right_end = entry.spans[last_context].second;
+
+    return Match{
+        position,
+        text.substr(left_begin, match_begin - left_begin),
+        text.substr(match_begin, match_end - match_begin),
+        text.substr(match_end, right_end - match_end)};
+  }
+
+  /**
+   * Search the index. The query is a list of words and double-quoted phrases,
+   * folded the same way as the texts; a text matches if it contains all of them.
+   * Texts are ranked by the number of matches, and keyword-in-context lines are
+   * only cut for the texts returned.
+   *
+   * @param query Search query.
+   * @param language Language to restrict results to, or empty for every language.
+   * @param limit Maximum number of texts to return.
+   * @param context Number of words to show on each side of a match.
+   * @return Matching texts, best first.
+   */
+  std::vector<SearchResult> TextIndex::search(std::string_view query, std::string_view language, std::size_t limit, int context) const
+  {
+    std::vector<std::vector<std::string>> phrases;
+    bool quoted = false;
+    std::size_t segment_start = 0;
+    for (std::size_t i = 0; i <= query.size(); ++i)
+    {
+      if (i < query.size() && query[i] != '"')
+      {
+        continue;
+      }
+
+      std::vector<Token> tokens = tokenize(query.substr(segment_start, i - segment_start));
+      if (quoted && !tokens.empty())
+      {
+        std::vector<std::string> phrase;
+        for (Token &token : tokens)
+        {
+          phrase.push_back(std::move(token.term));
+        }
+        phrases.push_back(std::move(phrase));
+      }
+      else
+      {
+        for (Token &token : tokens)
+        {
+          phrases.push_back({std::move(token.term)});
+        }
+      }
+      quoted = !quoted;
+      segment_start = i + 1;
+    }
+
+    if (phrases.empty())
+    {
+      return {};
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+
+    std::vector<std::vector<Posting>> storage(phrases.size());
+    std::vector<std::span<const Posting>> matches;
+    matches.reserve(phrases.size());
+    for (std::size_t p = 0; p < phrases.size(); ++p)
+    {
+      matches.push_back(match_phrase(phrases[p], storage[p]));
+      if (matches.back().empty())
+      {
+        return {};
+      }
+    }
+
+    auto find_posting = [](std::span<const Posting> list, int text_id) -> const Posting *
+    {
+      auto posting = find_text(list, text_id);
+      return posting == list.end() || posting->text_id != text_id ? nullptr : &*posting;
+    };
+
+    // Drive the intersection from the rarest phrase
+    std::size_t rarest = 0;
+    for (std::size_t p = 1; p < matches.size(); ++p)
+    {
+      if (matches[p].size() < matches[rarest].size())
+      {
+        rarest = p;
+      }
+    }
+
+    // Rank candidates on their hit counts alone
+    struct Candidate
+    {
+      const Entry *entry;
+      std::size_t hits;
+    };
+    std::vector<Candidate> candidates;
+    for (const Posting &candidate : matches[rarest])
+    {
+      const Entry &entry = entries.at(candidate.text_id);
+      if (!language.empty() && entry.document.language != language)
+      {
+        continue;
+      }
+
+      std::size_t hits = 0;
+      bool all = true;
+      for (std::size_t p = 0; p < matches.size() && all; ++p)
+      {
+        const Posting *posting = find_posting(matches[p], candidate.text_id);
+        all = posting != nullptr;
+        hits += all ? posting->positions.size() : 0;
+      }
+      if (all)
+      {
+        candidates.push_back({&entry, hits});
+      }
+    }
+
+    std::size_t returned = std::min(limit, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + returned, candidates.end(), [](const Candidate &a, const Candidate &b)
+                      { return a.hits > b.hits || (a.hits == b.hits && a.entry->document.text_id < b.entry->document.text_id); });
+
+    std::vector<SearchResult> results;
+    results.reserve(returned);
+    for (std::size_t c = 0; c < returned; ++c)
+    {
+      const Entry &entry = *candidates[c].entry;
+      std::vector<std::pair<std::uint32_t, std::size_t>> hits;
+      hits.reserve(candidates[c].hits);
+      for (std::size_t p = 0; p < matches.size(); ++p)
+      {
+        for (std::uint32_t position : find_posting(matches[p], entry.document.text_id)->positions)
+        {
+          hits.emplace_back(position, phrases[p].size());
+        }
+      }
+
+      std::size_t shown = std::min<std::size_t>(hits.size(), MAX_MATCHES_PER_TEXT);
+      std::partial_sort(hits.begin(), hits.begin() + shown, hits.end());
+      SearchResult result{entry.document.text_id, entry.document.text_object_id, entry.document.language, hits.size(), {}};
+      result.matches.reserve(shown);
+      for (std::size_t h = 0; h < shown; ++h)
+      {
+        result.matches.push_back(make_match(entry, hits[h].first, hits[h].second, context));
+      }
+      results.push_back(std::move(result));
+    }
+    return results;
+  }
+
+  std::size_t TextIndex::size() const
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return entries.size();
+  }
+
+  /**
+   * Build the index from every text in the database.
+   */
+  void load_texts()
+  {
+    request::PooledTxn txn = request::begin_read_transaction();
+    pqxx::result r = txn.exec_prepared("select_search_texts");
+    txn.commit();
+
+    std::vector<Document> documents;
+    documents.reserve(r.size());
+    for (const auto &row : r)
+    {
+      documents.push_back({row[0].as<int>(), row[1].as<int>(), row[2].as<std::string>(), row[3].as<std::string>()});
+    }
+    get_text_index().assign(std::move(documents));
+    utils::Logger::instance().info("Search index built with " + std::to_string(r.size()) + " texts");
+  }
+
+  /**
+   * Reindex a single text after it changed, or drop it if it was deleted.
+   * @param text_id ID of the text.
+   */
+  void reload_text(int text_id)
+  {
+    request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+    pqxx::result r = txn.exec_prepared("select_search_text", text_id);
+    txn.commit();
+
+    if (r.empty())
+    {
+      get_text_index().remove(text_id);
+      return;
+    }
+    get_text_index().upsert({r[0][0].as<int>(), r[0][1].as<int>(), r[0][2].as<std::string>(), r[0][3].as<std::string>()});
+  }
+
+  /**
+   * Get the process-wide text index.
+   */
+  TextIndex &get_text_index()
+  {
+    static TextIndex index;
+    return index;
+  }
+}
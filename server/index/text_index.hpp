@@ -0,0 +1,120 @@
+#ifndef TEXT_INDEX_HPP
+#define TEXT_INDEX_HPP
+
+#include <cstdint>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace text_index
+{
+  const int MAX_MATCHES_PER_TEXT = 10;
+
+  /**
+   * @brief Word of a text, folded for search, with its byte range in the original text.
+   */
+  struct Token
+  {
+    std::string term;
+    std::uint32_t begin;
+    std::uint32_t end;
+  };
+
+  std::string fold(std::string_view text);
+  std::vector<Token> tokenize(std::string_view text);
+
+  /**
+   * @brief Text as stored in the index, kept whole so matches can be shown in context.
+   */
+  struct Document
+  {
+    int text_id;
+    int text_object_id;
+    std::string language;
+    std::string text;
+  };
+
+  /**
+   * @brief Occurrence of a query in a text, with the words around it.
+   */
+  struct Match
+  {
+    std::uint32_t position;
+    std::string left;
+    std::string match;
+    std::string right;
+  };
+
+  /**
+   * @brief Text matching a search, with its hit count and keyword-in-context lines.
+   */
+  struct SearchResult
+  {
+    int text_id;
+    int text_object_id;
+    std::string language;
+    std::size_t hits;
+    std::vector<Match> matches;
+  };
+
+  /**
+   * @brief Positional inverted index over every text.
+   *
+   * Each folded term maps to the texts containing it and the word positions it
+   * appears at, sorted by text ID. Queries are a mix of single words and quoted
+   * phrases, all of which must match. Phrases match on consecutive positions.
+   * Texts can be added, replaced and removed one at a time.
+   */
+  class TextIndex
+  {
+    struct Posting
+    {
+      int text_id;
+      std::vector<std::uint32_t> positions;
+    };
+
+    struct Entry
+    {
+      Document document;
+      std::vector<std::pair<std::uint32_t, std::uint32_t>> spans;
+      std::vector<std::string> terms;
+    };
+
+    /**
+     * @brief Tokenised text with the positions of each of its terms, built
+     * before the index is locked.
+     */
+    struct Prepared
+    {
+      Entry entry;
+      std::unordered_map<std::string, std::vector<std::uint32_t>> positions;
+    };
+
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, std::vector<Posting>> postings;
+    std::unordered_map<int, Entry> entries;
+
+    static Prepared prepare(Document document);
+    void add_locked(Prepared prepared);
+    void remove_locked(int text_id);
+    std::span<const Posting> match_phrase(const std::vector<std::string> &terms, std::vector<Posting> &storage) const;
+    Match make_match(const Entry &entry, std::uint32_t position, std::size_t length, int context) const;
+
+  public:
+    void assign(std::vector<Document> documents);
+    void upsert(Document document);
+    void remove(int text_id);
+
+    std::vector<SearchResult> search(std::string_view query, std::string_view language, std::size_t limit, int context) const;
+    std::size_t size() const;
+  };
+
+  void load_texts();
+  void reload_text(int text_id);
+  TextIndex &get_text_index();
+}
+
+#endif
@@ -0,0 +1,290 @@
+#include "title_index.hpp"
+#include "text_index.hpp"
+#include "../request/request.hpp"
+#include "../utils.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace title_index
+{
+  namespace
+  {
+    struct BuildState
+    {
+      bool final = false;
+      std::vector<std::pair<std::uint8_t, std::uint32_t>> edges;
+    };
+
+    struct Pending
+    {
+      std::uint32_t parent;
+      std::uint32_t child;
+    };
+
+    /**
+     * @brief Incremental construction of a minimal automaton from sorted keys
+     * (Daciuk et al.). Once a key is added, every state on the previous key's
+     * path below the shared prefix can no longer change, so it is merged with
+     * an equivalent registered state or registered itself.
+     */
+    class Builder
+    {
+    public:
+      std::vector<BuildState> states{1};
+
+      void add(std::string_view key)
+      {
+        std::size_t common = 0;
+        while (common < key.size() && common < previous.size() && key[common] == previous[common])
+        {
+          ++common;
+        }
+        minimize(common);
+
+        std::uint32_t state = unchecked.empty() ? 0 : unchecked.back().child;
+        for (std::size_t i = common; i < key.size(); ++i)
+        {
+          std::uint32_t next = static_cast<std::uint32_t>(states.size());
+          states.emplace_back();
+          states[state].edges.emplace_back(static_cast<std::uint8_t>(key[i]), next);
+          unchecked.push_back({state, next});
+          state = next;
+        }
+        states[state].final = true;
+        previous.assign(key);
+      }
+
+      void finish()
+      {
+        minimize(0);
+      }
+
+    private:
+      std::string previous;
+      std::vector<Pending> unchecked;
+      std::unordered_map<std::string, std::uint32_t> registry;
+
+      std::string signature(std::uint32_t state) const
+      {
+        std::string signature(1, states[state].final ? '1' : '0');
+        for (const auto &[label, target] : states[state].edges)
+        {
+          signature.push_back(static_cast<char>(label));
+          signature.append(reinterpret_cast<const char *>(&target), sizeof(target));
+        }
+        return signature;
+      }
+
+      void minimize(std::size_t down_to)
+      {
+        while (unchecked.size() > down_to)
+        {
+          Pending pending = unchecked.back();
+          unchecked.pop_back();
+
+          auto [registered, inserted] = registry.try_emplace(signature(pending.child), pending.child);
+          if (!inserted)
+          {
+            // Keys are added in order, so the child is always the parent's last edge
+            states[pending.parent].edges.back().second = registered->second;
+          }
+        }
+      }
+    };
+  }
+
+  /**
+   * Build the automaton for a set of titles.
+   * @param titles Titles to suggest from.
+   */
+  TitleAutomaton::TitleAutomaton(std::vector<Title> titles) : titles(std::move(titles))
+  {
+    std::vector<std::pair<std::string, std::uint32_t>> keys;
+    for (std::uint32_t t = 0; t < this->titles.size(); ++t)
+    {
+      std::vector<text_index::Token> tokens = text_index::tokenize(this->titles[t].title);
+      for (std::size_t w = 0; w < tokens.size(); ++w)
+      {
+        std::string key = tokens[w].term;
+        for (std::size_t k = w + 1; k < tokens.size(); ++k)
+        {
+          key.push_back(' ');
+          key += tokens[k].term;
+        }
+        keys.emplace_back(std::move(key), t);
+      }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    Builder builder;
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+      if (k > 0 && keys[k].first == keys[k - 1].first)
+      {
+        if (keys[k].second != keys[k - 1].second)
+        {
+          key_titles.push_back(keys[k].second);
+        }
+        continue;
+      }
+      builder.add(keys[k].first);
+      key_offsets.push_back(static_cast<std::uint32_t>(key_titles.size()));
+      key_titles.push_back(keys[k].second);
+    }
+    builder.finish();
+    key_offsets.push_back(static_cast<std::uint32_t>(key_titles.size()));
+
+    // Renumber the states reachable from the root into flat arrays
+    std::vector<std::uint32_t> ids(builder.states.size(), UINT32_MAX);
+    std::function<std::uint32_t(std::uint32_t)> freeze = [&](std::uint32_t state) -> std::uint32_t
+    {
+      if (ids[state] != UINT32_MAX)
+      {
+        return ids[state];
+      }
+
+      const BuildState &source = builder.states[state];
+      if (source.edges.size() > UINT16_MAX)
+      {
+        throw std::length_error("Too many edges on one state");
+      }
+      std::uint32_t id = static_cast<std::uint32_t>(states.size());
+      ids[state] = id;
+      std::uint32_t first_edge = static_cast<std::uint32_t>(labels.size());
+      states.push_back({first_edge, source.final ? 1u : 0u, static_cast<std::uint16_t>(source.edges.size()), source.final});
+      labels.resize(labels.size() + source.edges.size());
+      targets.resize(targets.size() + source.edges.size());
+
+      std::uint32_t count = source.final ? 1 : 0;
+      for (std::size_t e = 0; e < source.edges.size(); ++e)
+      {
+        std::uint32_t target = freeze(source.edges[e].second);
+        labels[first_edge + e] = source.edges[e].first;
+        targets[first_edge + e] = target;
+        count += states[target].count;
+      }
+      states[id].count = count;
+      return id;
+    };
+    freeze(0);
+  }
+
+  /**
+   * Suggest titles for what has been typed so far. The prefix is folded the same
+   * way as the titles, so case, accents and breathings are ignored.
+   *
+   * @param prefix Text typed so far.
+   * @param limit Maximum number of titles to return.
+   * @return Titles with a word sequence starting with the prefix, in key order.
+   */
+  std::vector<const Title *> TitleAutomaton::suggest(std::string_view prefix, std::size_t limit) const
+  {
+    std::string folded = text_index::fold(prefix);
+    if (folded.empty() || states.empty())
+    {
+      return {};
+    }
+
+    std::uint32_t state = 0;
+    std::uint32_t rank = 0;
+    for (char c : folded)
+    {
+      std::uint8_t label = static_cast<std::uint8_t>(c);
+      const State &current = states[state];
+      if (current.final)
+      {
+        ++rank;
+      }
+
+      auto begin = labels.begin() + current.first_edge;
+      auto end = begin + current.edge_count;
+      auto edge = std::lower_bound(begin, end, label);
+      if (edge == end || *edge != label)
+      {
+        return {};
+      }
+      for (auto skipped = begin; skipped != edge; ++skipped)
+      {
+        rank += states[targets[skipped - labels.begin()]].count;
+      }
+      state = targets[edge - labels.begin()];
+    }
+
+    std::vector<const Title *> suggestions;
+    std::uint32_t last = rank + states[state].count;
+    for (std::uint32_t key = rank; key < last && suggestions.size() < limit; ++key)
+    {
+      for (std::uint32_t t = key_offsets[key]; t < key_offsets[key + 1] && suggestions.size() < limit; ++t)
+      {
+        const Title *title = &titles[key_titles[t]];
+        if (std::find(suggestions.begin(), suggestions.end(), title) == suggestions.end())
+        {
+          suggestions.push_back(title);
+        }
+      }
+    }
+    return suggestions;
+  }
+
+  std::size_t TitleAutomaton::state_count() const
+  {
+    return states.size();
+  }
+
+  /**
+   * Build a new automaton and swap it in.
+   * @param titles Every title.
+   */
+  void TitleIndex::assign(std::vector<Title> titles)
+  {
+    auto next = std::make_shared<const TitleAutomaton>(std::move(titles));
+    std::lock_guard<std::mutex> lock(mutex);
+    automaton = std::move(next);
+  }
+
+  /**
+   * Get the current automaton. It stays valid for as long as the caller holds it,
+   * even if a rebuild swaps in a new one.
+   */
+  std::shared_ptr<const TitleAutomaton> TitleIndex::get() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return automaton;
+  }
+
+  /**
+   * Rebuild the title suggester from every text object in the database.
+   */
+  void load_titles()
+  {
+    request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+    pqxx::result r = txn.exec_prepared("select_suggest_titles");
+    txn.commit();
+
+    std::vector<Title> titles;
+    titles.reserve(r.size());
+    for (const auto &row : r)
+    {
+      std::optional<int> group_id;
+      if (!row[3].is_null())
+      {
+        group_id = row[3].as<int>();
+      }
+      titles.push_back({row[0].as<int>(), row[1].as<std::string>(), row[2].as<std::string>(), group_id});
+    }
+    get_title_index().assign(std::move(titles));
+    utils::Logger::instance().info("Title suggester built with " + std::to_string(r.size()) + " titles");
+  }
+
+  /**
+   * Get the process-wide title suggester.
+   */
+  TitleIndex &get_title_index()
+  {
+    static TitleIndex index;
+    return index;
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef TITLE_INDEX_HPP
+#define TITLE_INDEX_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace title_index
+{
+  struct Title
+  {
+    int id;
+    std::string title;
+    std::string level;
+    std::optional<int> group_id;
+  };
+
+  /**
+   * @brief Immutable minimal acyclic automaton (DAWG) over folded title keys.
+   *
+   * Every title is keyed by its folded text starting at each of its words, so a
+   * prefix can match the start of any word in a title. Shared prefixes and
+   * suffixes of the keys are stored once. Each state counts the keys below it,
+   * which gives every key its rank in sorted order: the keys starting with a
+   * prefix are a contiguous range of ranks, mapped to titles through a flat table.
+   */
+  class TitleAutomaton
+  {
+    struct State
+    {
+      std::uint32_t first_edge;
+      std::uint32_t count;
+      std::uint16_t edge_count;
+      bool final;
+    };
+
+    std::vector<State> states;
+    std::vector<std::uint8_t> labels;
+    std::vector<std::uint32_t> targets;
+    std::vector<std::uint32_t> key_offsets;
+    std::vector<std::uint32_t> key_titles;
+    std::vector<Title> titles;
+
+  public:
+    explicit TitleAutomaton(std::vector<Title> titles);
+
+    std::vector<const Title *> suggest(std::string_view prefix, std::size_t limit) const;
+    std::size_t state_count() const;
+  };
+
+  /**
+   * @brief Process-wide title suggester. Rebuilds replace the automaton in one
+   * swap, so a suggestion always runs against a complete automaton.
+   */
+  class TitleIndex
+  {
+    mutable std::mutex mutex;
+    std::shared_ptr<const TitleAutomaton> automaton;
+
+  public:
+    void assign(std::vector<Title> titles);
+    std::shared_ptr<const TitleAutomaton> get() const;
+  };
+
+  void load_titles();
+  TitleIndex &get_title_index();
+}
+
+#endif
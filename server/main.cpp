@@ -3,6 +3,10 @@
 #include "auth/email.hpp"
 #include "db/redis.hpp"
 #include "db/postgres.hpp"
+#include "request/request.hpp"
+#include "cache/invalidation.hpp"
+#include "index/text_index.hpp"
+#include "index/title_index.hpp"
 #include "config.h"
 
 int main()
@@ -16,21 +20,85 @@ int main()
     utils::Logger::instance().initialize_from_env();
     utils::Logger::instance().info("Logger initialized from environment");
 
-    net::io_context ioc;
+    /**
+     * In sharded mode every core the process may run on gets its own
+     * io_context, pinned thread and SO_REUSEPORT listener. Otherwise all
+     * threads share a single io_context.
+     */
+    bool sharded = std::string(READER_SERVER_SHARDED) == "true";
+    std::size_t thread_count = server::allowed_cores().size();
+    std::size_t context_count = sharded ? thread_count : 1;
+
+    std::vector<std::unique_ptr<net::io_context>> contexts;
+    std::vector<std::shared_ptr<server::Listener>> listeners;
     std::vector<std::thread> threads;
 
-    auto listener = std::make_shared<server::Listener>(ioc, tcp::endpoint{address, port});
+    for (std::size_t i = 0; i < context_count; ++i)
+    {
+      contexts.emplace_back(std::make_unique<net::io_context>(sharded ? 1 : static_cast<int>(thread_count)));
+      listeners.emplace_back(std::make_shared<server::Listener>(*contexts.back(), tcp::endpoint{address, port}, sharded));
+    }
 
     /**
      * Initialize PostgreSQL connection.
      */
     postgres::init_connection();
 
+    /**
+     * Refresh the title listing so it includes text objects added while the
+     * server was down.
+     */
+    try
+    {
+      request::PooledTxn txn = request::begin_transaction(postgres::get_connection_pool());
+      txn.exec_prepared("refresh_textobject_list");
+      txn.commit();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error refreshing title listing: ") + e.what());
+    }
+
     /**
      * Initialize Redis connection.
      */
     Redis::init_connection();
 
+    /**
+     * Initialize the executor for blocking handler work.
+     */
+    executor::init_executor();
+
+    /**
+     * Build the in-memory search index over every text.
+     */
+    try
+    {
+      text_index::load_texts();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error building search index: ") + e.what());
+    }
+
+    /**
+     * Build the title suggester.
+     */
+    try
+    {
+      title_index::load_titles();
+    }
+    catch (const std::exception &e)
+    {
+      utils::Logger::instance().error(std::string("Error building title suggester: ") + e.what());
+    }
+
+    /**
+     * Listen for changes made to the database, including those made outside
+     * this server, and purge the caches and indexes they affect.
+     */
+    invalidation::init_listener();
+
     /**
      * Initialize email service.
      */
@@ -43,10 +111,26 @@ int main()
     auto &service = email::EmailService::get_instance();
     service.configure(config);
 
-    for (std::size_t i = 0; i < std::thread::hardware_concurrency(); ++i)
+    if (sharded)
+    {
+      utils::Logger::instance().info("Running " + std::to_string(context_count) + " pinned io_context shards");
+      for (std::size_t i = 0; i < context_count; ++i)
+      {
+        net::io_context &ioc = *contexts[i];
+        threads.emplace_back([&ioc, i]
+                             {
+          server::pin_thread_to_core(i);
+          ioc.run(); });
+      }
+    }
+    else
     {
-      threads.emplace_back([&ioc]
-                           { ioc.run(); });
+      net::io_context &ioc = *contexts.front();
+      for (std::size_t i = 0; i < thread_count; ++i)
+      {
+        threads.emplace_back([&ioc]
+                             { ioc.run(); });
+      }
     }
 
     for (auto &t : threads)
@@ -0,0 +1,34 @@
+--
+-- Add like and dislike counters to Annotation and backfill them from
+-- UserAnnotationInteraction. New databases get the columns from
+-- database_schema.sql; existing ones run this once before deploying:
+--
+--   psql "$DATABASE_URL" -f migrations/001_annotation_vote_counts.sql
+--
+-- The script is idempotent. Votes are blocked while it runs, so the counters
+-- start from the exact vote totals and later deltas apply to a correct base.
+--
+
+BEGIN;
+
+ALTER TABLE public."Annotation"
+    ADD COLUMN IF NOT EXISTS likes integer DEFAULT 0 NOT NULL,
+    ADD COLUMN IF NOT EXISTS dislikes integer DEFAULT 0 NOT NULL;
+
+LOCK TABLE public."UserAnnotationInteraction" IN SHARE MODE;
+
+UPDATE public."Annotation" a
+SET likes = v.likes,
+    dislikes = v.dislikes
+FROM (
+    SELECT an.id,
+           count(uai.id) FILTER (WHERE uai.type = 'LIKE') AS likes,
+           count(uai.id) FILTER (WHERE uai.type = 'DISLIKE') AS dislikes
+    FROM public."Annotation" an
+    LEFT JOIN public."UserAnnotationInteraction" uai ON uai.annotation_id = an.id
+    GROUP BY an.id
+) v
+WHERE a.id = v.id
+AND (a.likes, a.dislikes) IS DISTINCT FROM (v.likes::integer, v.dislikes::integer);
+
+COMMIT;
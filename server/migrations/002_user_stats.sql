@@ -0,0 +1,50 @@
+--
+-- Create UserStats and backfill it from Annotation and
+-- UserAnnotationInteraction. New databases get the table from
+-- database_schema.sql; existing ones run this once before deploying:
+--
+--   psql "$DATABASE_URL" -f migrations/002_user_stats.sql
+--
+-- The script is idempotent and recomputes every user's row. Annotation and
+-- vote writes are blocked while it runs, so the deltas applied by
+-- insert_annotation, delete_annotation and toggle_interaction afterwards
+-- start from exact counts and never take a count below zero.
+--
+
+BEGIN;
+
+CREATE TABLE IF NOT EXISTS public."UserStats" (
+    user_id integer NOT NULL,
+    annotation_count integer DEFAULT 0 NOT NULL,
+    like_count integer DEFAULT 0 NOT NULL,
+    dislike_count integer DEFAULT 0 NOT NULL,
+    CONSTRAINT "UserStats_pkey" PRIMARY KEY (user_id),
+    CONSTRAINT "UserStats_userId_fkey" FOREIGN KEY (user_id) REFERENCES public."User"(id) ON UPDATE CASCADE ON DELETE CASCADE
+);
+
+LOCK TABLE public."Annotation", public."UserAnnotationInteraction" IN SHARE MODE;
+
+INSERT INTO public."UserStats" AS s (user_id, annotation_count, like_count, dislike_count)
+SELECT u.id,
+       COALESCE(a.annotation_count, 0),
+       COALESCE(v.like_count, 0),
+       COALESCE(v.dislike_count, 0)
+FROM public."User" u
+LEFT JOIN (
+    SELECT user_id, count(*) AS annotation_count
+    FROM public."Annotation"
+    GROUP BY user_id
+) a ON a.user_id = u.id
+LEFT JOIN (
+    SELECT user_id,
+           count(*) FILTER (WHERE type = 'LIKE') AS like_count,
+           count(*) FILTER (WHERE type = 'DISLIKE') AS dislike_count
+    FROM public."UserAnnotationInteraction"
+    GROUP BY user_id
+) v ON v.user_id = u.id
+ON CONFLICT (user_id) DO UPDATE
+SET annotation_count = EXCLUDED.annotation_count,
+    like_count = EXCLUDED.like_count,
+    dislike_count = EXCLUDED.dislike_count;
+
+COMMIT;
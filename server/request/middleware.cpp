@@ -63,7 +63,7 @@ namespace middleware
     try
     {
       auto &pool = get_connection_pool();
-      pqxx::work &txn = request::begin_transaction(pool);
+      request::PooledTxn txn = request::begin_transaction(pool);
 
       pqxx::result r = txn.exec_prepared(
           "select_accepted_policy",
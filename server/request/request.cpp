@@ -5,25 +5,270 @@ using namespace postgres;
 using utils::Logger;
 namespace request
 {
-  thread_local std::shared_ptr<pqxx::connection> cached_connection;
-  thread_local std::chrono::steady_clock::time_point last_used;
-  thread_local std::unique_ptr<pqxx::work> current_txn;
+  /**
+   * Acquire a connection from the pool and begin a transaction on it.
+   * @param pool Connection pool to acquire the connection from.
+   * @param access Whether the transaction may run read-write statements.
+   */
+  PooledTxn::PooledTxn(postgres::ConnectionPool &pool, postgres::StatementAccess access)
+      : pool_(&pool), slot_(pool.acquire()), access_(access)
+  {
+    try
+    {
+      txn_ = std::make_unique<pqxx::work>(*slot_->conn);
+    }
+    catch (...)
+    {
+      release();
+      throw;
+    }
+  }
+
+  /**
+   * Abort the transaction if it is still open and return the connection to the pool.
+   */
+  PooledTxn::~PooledTxn()
+  {
+    release();
+  }
+
+  PooledTxn::PooledTxn(PooledTxn &&other) noexcept
+      : pool_(std::exchange(other.pool_, nullptr)),
+        slot_(std::exchange(other.slot_, nullptr)),
+        txn_(std::move(other.txn_)),
+        access_(other.access_),
+        session_id_(std::move(other.session_id_)),
+        wrote_(std::exchange(other.wrote_, false))
+  {
+  }
+
+  PooledTxn &PooledTxn::operator=(PooledTxn &&other) noexcept
+  {
+    if (this != &other)
+    {
+      release();
+      pool_ = std::exchange(other.pool_, nullptr);
+      slot_ = std::exchange(other.slot_, nullptr);
+      txn_ = std::move(other.txn_);
+      access_ = other.access_;
+      session_id_ = std::move(other.session_id_);
+      wrote_ = std::exchange(other.wrote_, false);
+    }
+    return *this;
+  }
+
+  /**
+   * Destroy the transaction (aborting it if uncommitted) before handing the
+   * connection back, so the connection is idle when the next thread gets it.
+   */
+  void PooledTxn::release()
+  {
+    txn_.reset();
+    if (slot_ && pool_)
+    {
+      pool_->release(slot_);
+    }
+    slot_ = nullptr;
+  }
+
+  /**
+   * Execute a raw query in the transaction.
+   * @param query Query to execute.
+   * @return Result of the query.
+   */
+  pqxx::result PooledTxn::exec(std::string_view query)
+  {
+    return work().exec(query);
+  }
+
+  /**
+   * Commit the transaction and return the connection to the pool. The
+   * connection is returned even if the commit fails.
+   */
+  void PooledTxn::commit()
+  {
+    try
+    {
+      work().commit();
+    }
+    catch (...)
+    {
+      release();
+      throw;
+    }
+    record_write_token();
+    release();
+  }
+
+  /**
+   * After a committed write in a tracked session, store the primary's WAL
+   * position as the session's read-your-writes token. Replica reads for the
+   * session wait for the replica to replay past it. Failures only cost the
+   * session a possibly stale replica read, so they are logged and ignored.
+   */
+  void PooledTxn::record_write_token()
+  {
+    if (!wrote_ || session_id_.empty() || !postgres::has_replica_pool())
+    {
+      return;
+    }
+    try
+    {
+      txn_.reset();
+      pqxx::nontransaction lsn_txn(*slot_->conn);
+      pqxx::result r = lsn_txn.exec("SELECT pg_current_wal_lsn()::text");
+      if (!r.empty())
+      {
+        Redis::get_instance().set("ryw:" + session_id_, r[0][0].as<std::string>(), std::chrono::seconds(RYW_TOKEN_TTL_SEC));
+      }
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Error recording read-your-writes token: ") + e.what());
+    }
+  }
+
+  /**
+   * Check whether the server this transaction runs on has replayed the WAL up
+   * to a position. The last replayed position seen on a connection is kept in
+   * its metadata, so the server is only asked when the token is newer.
+   *
+   * @param lsn WAL position to wait for.
+   * @return true if the server has replayed past the position, false otherwise.
+   */
+  bool PooledTxn::replica_caught_up(std::uint64_t lsn)
+  {
+    if (slot_->metadata.replayed_lsn >= lsn)
+    {
+      return true;
+    }
+
+    pqxx::result r = work().exec("SELECT pg_last_wal_replay_lsn()::text");
+    if (r.empty() || r[0][0].is_null())
+    {
+      // Not a standby, so every committed write is visible
+      slot_->metadata.replayed_lsn = UINT64_MAX;
+      return true;
+    }
+    slot_->metadata.replayed_lsn = postgres::parse_lsn(r[0][0].as<std::string>());
+    return slot_->metadata.replayed_lsn >= lsn;
+  }
+
+  /**
+   * Record a read-your-writes token for a session when this transaction
+   * commits a read-write statement.
+   *
+   * @param session_id Session that made the write.
+   */
+  void PooledTxn::track_writes(std::string_view session_id)
+  {
+    session_id_ = std::string(session_id);
+  }
 
   /**
-   * Begin a transaction with the database.
-   * This function will create a new connection if one does not exist or if the current connection is stale.
+   * Abort the transaction and return the connection to the pool.
+   * Does nothing if the lease has already been released.
+   */
+  void PooledTxn::abort()
+  {
+    if (txn_)
+    {
+      txn_->abort();
+    }
+    release();
+  }
+
+  bool PooledTxn::is_open() const
+  {
+    return txn_ != nullptr;
+  }
+
+  /**
+   * Get the underlying transaction.
+   * @return Transaction running on the leased connection.
+   */
+  pqxx::work &PooledTxn::work()
+  {
+    if (!txn_)
+    {
+      throw std::logic_error("Transaction already committed or aborted");
+    }
+    return *txn_;
+  }
+
+  /**
+   * Begin a transaction with the database. The returned lease owns both the
+   * pooled connection and the transaction until it is committed or aborted.
+   *
    * @param pool Connection pool to get a connection from.
-   * @return Transaction object for the database.
+   * @return Lease on the connection and transaction.
    */
-  pqxx::work &begin_transaction(postgres::ConnectionPool &pool)
+  PooledTxn begin_transaction(postgres::ConnectionPool &pool)
   {
-    static thread_local std::unique_ptr<pqxx::work> current_txn;
+    return PooledTxn(pool);
+  }
 
-    std::shared_ptr<pqxx::connection> conn(pool.acquire(), [&pool](pqxx::connection *c)
-                                           { pool.release(c); });
+  /**
+   * Begin a transaction for writes made by a session. Once committed, reads
+   * by the same session see the writes even when routed to a replica.
+   *
+   * @param pool Connection pool to get a connection from.
+   * @param session_id Session making the writes.
+   * @return Lease on the connection and transaction.
+   */
+  PooledTxn begin_transaction(postgres::ConnectionPool &pool, std::string_view session_id)
+  {
+    PooledTxn txn(pool);
+    txn.track_writes(session_id);
+    return txn;
+  }
 
-    current_txn = std::make_unique<pqxx::work>(*conn);
-    return *current_txn;
+  /**
+   * Begin a read-only transaction, on the read replica if one is configured.
+   * If the session has a read-your-writes token the replica has not replayed
+   * yet, or the replica is unavailable, the primary is used instead.
+   *
+   * @param session_id Session making the read, empty for anonymous reads.
+   * @return Lease on the connection and transaction.
+   */
+  PooledTxn begin_read_transaction(std::string_view session_id)
+  {
+    postgres::ConnectionPool &primary = get_connection_pool();
+    if (!postgres::has_replica_pool())
+    {
+      return PooledTxn(primary, StatementAccess::ReadOnly);
+    }
+
+    std::uint64_t token = 0;
+    if (!session_id.empty())
+    {
+      try
+      {
+        std::optional<std::string> lsn = Redis::get_instance().get("ryw:" + std::string(session_id));
+        if (lsn)
+        {
+          token = postgres::parse_lsn(*lsn);
+        }
+      }
+      catch (const std::exception &e)
+      {
+        Logger::instance().error(std::string("Error reading read-your-writes token: ") + e.what());
+      }
+    }
+
+    try
+    {
+      PooledTxn txn(get_replica_pool(), StatementAccess::ReadOnly);
+      if (token == 0 || txn.replica_caught_up(token))
+      {
+        return txn;
+      }
+    }
+    catch (const std::exception &e)
+    {
+      Logger::instance().error(std::string("Replica unavailable, reading from primary: ") + e.what());
+    }
+    return PooledTxn(primary, StatementAccess::ReadOnly);
   }
 
   /**
@@ -57,13 +302,71 @@ namespace request
     return std::string_view(cookie.data() + pos, end == std::string::npos ? cookie.length() - pos : end - pos);
   }
 
+  static thread_local const SessionScope *current_session_scope = nullptr;
+
   /**
-   * Get the user ID from a session ID.
+   * Open a session scope on the current thread.
+   * @param session_id Session ID that was resolved.
+   * @param valid Whether validate_session accepted the session.
+   * @param user_id User ID the session belongs to, or -1 if it has none.
+   */
+  SessionScope::SessionScope(std::string session_id, bool valid, int user_id)
+      : session_id_(std::move(session_id)), valid_(valid), user_id_(user_id), previous_(current_session_scope)
+  {
+    current_session_scope = this;
+  }
+
+  SessionScope::~SessionScope()
+  {
+    current_session_scope = previous_;
+  }
+
+  /**
+   * Get whether a session is valid if it is the one this scope resolved.
+   * @param session_id Session ID to check.
+   * @return Whether the session is valid, or nothing if it is a different one.
+   */
+  std::optional<bool> SessionScope::valid(std::string_view session_id) const
+  {
+    if (session_id != session_id_)
+    {
+      return std::nullopt;
+    }
+    return valid_;
+  }
+
+  /**
+   * Get the user ID of a session if it is the one this scope resolved.
+   * @param session_id Session ID to look up.
+   * @return User ID, or nothing if the session is a different one.
+   */
+  std::optional<int> SessionScope::user_id(std::string_view session_id) const
+  {
+    if (session_id != session_id_)
+    {
+      return std::nullopt;
+    }
+    return user_id_;
+  }
+
+  /**
+   * Get the user ID from a session ID. Sessions resolved by a SessionScope on
+   * this thread are answered without a Redis lookup.
+   *
    * @param session_id Session ID to get the user ID from.
    * @return User ID from the session ID.
    */
   int get_user_id_from_session(std::string session_id)
   {
+    if (current_session_scope)
+    {
+      std::optional<int> scoped = current_session_scope->user_id(session_id);
+      if (scoped)
+      {
+        return *scoped;
+      }
+    }
+
     auto &redis = Redis::get_instance();
     std::string key = "session:" + session_id;
     try
@@ -166,6 +469,8 @@ namespace request
   /**
    * Check if a session ID is valid. This checks if the session ID exists
    * and that the given user ID matches the user ID stored with the session ID.
+   * Sessions resolved by a SessionScope on this thread are answered without a
+   * Redis lookup.
    *
    * @param session_id Session ID to check.
    * @param user_id User ID to check.
@@ -173,6 +478,15 @@ namespace request
    */
   bool validate_session(std::string signed_session_id)
   {
+    if (current_session_scope)
+    {
+      std::optional<bool> scoped = current_session_scope->valid(signed_session_id);
+      if (scoped)
+      {
+        return *scoped;
+      }
+    }
+
     std::string session_id, signature;
     if (!split_session_id(signed_session_id, session_id, signature))
     {
@@ -259,6 +573,36 @@ namespace request
     return params;
   }
 
+  /**
+   * Decode a percent-encoded query string value, turning '+' into a space.
+   * Malformed escapes are kept as they are.
+   *
+   * @param value Value to decode.
+   * @return Decoded value.
+   */
+  std::string url_decode(std::string_view value)
+  {
+    std::string decoded;
+    decoded.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+      if (value[i] == '+')
+      {
+        decoded.push_back(' ');
+      }
+      else if (value[i] == '%' && i + 2 < value.size() && std::isxdigit(static_cast<unsigned char>(value[i + 1])) && std::isxdigit(static_cast<unsigned char>(value[i + 2])))
+      {
+        decoded.push_back(static_cast<char>(std::stoi(std::string(value.substr(i + 1, 2)), nullptr, 16)));
+        i += 2;
+      }
+      else
+      {
+        decoded.push_back(value[i]);
+      }
+    }
+    return decoded;
+  }
+
   /**
    * Parse the given parameter from a request. This ensures that the parameter
    * parameter appears in the query string. If it does not, an empty optional is returned.
@@ -416,4 +760,40 @@ namespace request
 
     return res;
   }
-}
\ No newline at end of file
+
+  /**
+   * Create a response around JSON information that is already serialised, such
+   * as a cached payload. The payload is embedded as is, without being parsed.
+   *
+   * @param json_payload Serialised JSON information to include in the response.
+   * @param req Request to send the response for.
+   * @return Response with the JSON information.
+   */
+  http::response<http::string_body> make_json_payload_response(
+      std::string_view json_payload, const http::request<http::string_body> &req)
+  {
+    std::string body;
+    body.reserve(json_payload.size() + 30);
+    body.append("{\"message\":").append(json_payload).append(",\"status\":\"ok\"}");
+    return make_json_body_response(std::move(body), req);
+  }
+
+  /**
+   * Create a response from a complete, already serialised JSON body.
+   * @param body Serialised response body.
+   * @param req Request to send the response for.
+   * @return Response with the body.
+   */
+  http::response<http::string_body> make_json_body_response(
+      std::string body, const http::request<http::string_body> &req)
+  {
+    http::response<http::string_body> res{http::status::ok, req.version()};
+    res.set(http::field::server, "Beast");
+    res.set(http::field::content_type, "application/json");
+    res.body() = std::move(body);
+    res.keep_alive(req.keep_alive());
+    res.prepare_payload();
+
+    return res;
+  }
+}
@@ -20,6 +20,8 @@
 #include <iostream>
 #include <chrono>
 #include <unordered_map>
+#include <memory>
+#include <utility>
 
 #include "../auth/session.hpp"
 #include "../db/postgres.hpp"
@@ -30,7 +32,99 @@ namespace http = boost::beast::http;
 
 namespace request
 {
-  pqxx::work &begin_transaction(postgres::ConnectionPool &pool);
+  const int RYW_TOKEN_TTL_SEC = 30;
+
+  /**
+   * @brief RAII lease on a pooled connection and the transaction running on it.
+   *
+   * The connection stays checked out until the transaction is committed or
+   * aborted (or the lease is destroyed), so no other thread can acquire it
+   * while statements are still running. Several statements can be batched
+   * in one lease before committing.
+   */
+  class PooledTxn
+  {
+    postgres::ConnectionPool *pool_;
+    postgres::PooledConnection *slot_;
+    std::unique_ptr<pqxx::work> txn_;
+    postgres::StatementAccess access_;
+    std::string session_id_;
+    bool wrote_ = false;
+
+    void release();
+    void record_write_token();
+
+  public:
+    explicit PooledTxn(postgres::ConnectionPool &pool, postgres::StatementAccess access = postgres::StatementAccess::ReadWrite);
+    ~PooledTxn();
+
+    PooledTxn(PooledTxn &&other) noexcept;
+    PooledTxn &operator=(PooledTxn &&other) noexcept;
+    PooledTxn(const PooledTxn &) = delete;
+    PooledTxn &operator=(const PooledTxn &) = delete;
+
+    /**
+     * Execute a registered statement, preparing it on this connection first if
+     * it has not been used here before. Read-only transactions reject
+     * statements registered as read-write.
+     */
+    template <typename... Args>
+    pqxx::result exec_prepared(const std::string &statement, Args &&...args)
+    {
+      pqxx::work &txn = work();
+      postgres::StatementAccess access = pool_->prepare(*slot_, statement);
+      if (access == postgres::StatementAccess::ReadWrite)
+      {
+        if (access_ == postgres::StatementAccess::ReadOnly)
+        {
+          throw std::logic_error("Read-write statement " + statement + " in a read-only transaction");
+        }
+        wrote_ = true;
+      }
+      return txn.exec_prepared(statement, std::forward<Args>(args)...);
+    }
+
+    pqxx::result exec(std::string_view query);
+    void commit();
+    void abort();
+    bool is_open() const;
+    bool replica_caught_up(std::uint64_t lsn);
+    void track_writes(std::string_view session_id);
+    pqxx::work &work();
+  };
+
+  /**
+   * @brief Session resolved once and reused by every lookup on the current thread.
+   *
+   * While a scope is alive, validate_session and get_user_id_from_session
+   * answer for its session without going to Redis. Batched sub-requests open
+   * one on each worker thread they run on, so the session is looked up once per
+   * batch.
+   *
+   * The scope is thread-local state in request.cpp, which is built into the
+   * server executable only, so every handler library sees the same scope.
+   */
+  class SessionScope
+  {
+    std::string session_id_;
+    bool valid_;
+    int user_id_;
+    const SessionScope *previous_;
+
+  public:
+    SessionScope(std::string session_id, bool valid, int user_id);
+    ~SessionScope();
+
+    SessionScope(const SessionScope &) = delete;
+    SessionScope &operator=(const SessionScope &) = delete;
+
+    std::optional<bool> valid(std::string_view session_id) const;
+    std::optional<int> user_id(std::string_view session_id) const;
+  };
+
+  PooledTxn begin_transaction(postgres::ConnectionPool &pool);
+  PooledTxn begin_transaction(postgres::ConnectionPool &pool, std::string_view session_id);
+  PooledTxn begin_read_transaction(std::string_view session_id = {});
   std::string_view get_session_id_from_cookie(const http::request<http::string_body> &req);
   int get_user_id_from_session(std::string session_id);
 
@@ -40,6 +134,7 @@ namespace request
 
   std::map<std::string, std::string> parse_query_string(std::string_view query);
   std::optional<std::string> parse_from_request(const http::request<http::string_body> &req, const std::string &parameter);
+  std::string url_decode(std::string_view value);
 
   /* request responses */
   http::response<http::string_body> make_unauthorized_response(const std::string &message, const http::request<http::string_body> &req);
@@ -47,5 +142,7 @@ namespace request
   http::response<http::string_body> make_too_many_requests_response(const std::string &message, const http::request<http::string_body> &req);
   http::response<http::string_body> make_ok_request_response(const std::string &message, const http::request<http::string_body> &req);
   http::response<http::string_body> make_json_request_response(const nlohmann::json &json_info, const http::request<http::string_body> &req);
+  http::response<http::string_body> make_json_payload_response(std::string_view json_payload, const http::request<http::string_body> &req);
+  http::response<http::string_body> make_json_body_response(std::string body, const http::request<http::string_body> &req);
 }
 #endif
\ No newline at end of file
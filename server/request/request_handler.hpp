@@ -1,7 +1,16 @@
+#ifndef REQUEST_HANDLER_HPP
+#define REQUEST_HANDLER_HPP
+
 #include <string>
+#include <vector>
 #include <boost/beast/http.hpp>
+#include <boost/asio/awaitable.hpp>
+
+#include "router.hpp"
+#include "../executor.hpp"
 
 namespace http = boost::beast::http;
+namespace net = boost::asio;
 
 class RequestHandler
 {
@@ -9,4 +18,36 @@ public:
   virtual ~RequestHandler() = default;
   virtual std::string get_endpoint() const = 0;
   virtual http::response<http::string_body> handle_request(const http::request<http::string_body> &req, const std::string &ip_address) = 0;
-};
\ No newline at end of file
+
+  /**
+   * Methods served by this handler. The router answers any other method with
+   * 405 Method Not Allowed before the handler is called.
+   */
+  virtual std::vector<http::verb> get_methods() const
+  {
+    return {http::verb::get, http::verb::post, http::verb::put, http::verb::patch, http::verb::delete_};
+  }
+
+  /**
+   * Handle a request matched by the router. Handlers with parameterised
+   * endpoints override this to read the captured path parameters.
+   */
+  virtual http::response<http::string_body> handle_route(const http::request<http::string_body> &req, const std::string &ip_address, const router::RouteParams &)
+  {
+    return handle_request(req, ip_address);
+  }
+
+  /**
+   * Asynchronous entry point used by the server. The default implementation
+   * adapts synchronous handlers by running handle_route on the blocking
+   * executor; handlers that can overlap their I/O override this and co_await
+   * it instead.
+   */
+  virtual net::awaitable<http::response<http::string_body>> handle_route_async(const http::request<http::string_body> &req, const std::string &ip_address, const router::RouteParams &params)
+  {
+    co_return co_await executor::run_blocking([this, &req, &ip_address, &params]
+                                              { return handle_route(req, ip_address, params); });
+  }
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "router.hpp"
+#include "request_handler.hpp"
+
+#include <charconv>
+#include <stdexcept>
+
+namespace router
+{
+  /**
+   * Add a path parameter to the set.
+   * @param name Name of the parameter.
+   * @param value Value of the parameter.
+   * @return true if the parameter was added, false if the set is full.
+   */
+  bool RouteParams::push(std::string_view name, std::string_view value)
+  {
+    if (size_ == MAX_PATH_PARAMS)
+    {
+      return false;
+    }
+    params_[size_++] = {name, value};
+    return true;
+  }
+
+  /**
+   * Remove the most recently added path parameter.
+   */
+  void RouteParams::pop()
+  {
+    if (size_ > 0)
+    {
+      --size_;
+    }
+  }
+
+  std::size_t RouteParams::size() const
+  {
+    return size_;
+  }
+
+  /**
+   * Get the value of a path parameter by name.
+   * @param name Name of the parameter.
+   * @return Value of the parameter if it exists, empty optional otherwise.
+   */
+  std::optional<std::string_view> RouteParams::get(std::string_view name) const
+  {
+    for (std::size_t i = 0; i < size_; ++i)
+    {
+      if (params_[i].name == name)
+      {
+        return params_[i].value;
+      }
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Get the value of a path parameter as an integer.
+   * @param name Name of the parameter.
+   * @return Integer value of the parameter if it exists and is numeric, empty optional otherwise.
+   */
+  std::optional<int> RouteParams::get_int(std::string_view name) const
+  {
+    std::optional<std::string_view> value = get(name);
+    if (!value)
+    {
+      return std::nullopt;
+    }
+
+    int result = 0;
+    auto [ptr, ec] = std::from_chars(value->data(), value->data() + value->size(), result);
+    if (ec != std::errc() || ptr != value->data() + value->size())
+    {
+      return std::nullopt;
+    }
+    return result;
+  }
+
+  /**
+   * Check whether a path segment satisfies a parameter type.
+   * @param type Type of the parameter.
+   * @param segment Path segment to check.
+   * @return true if the segment is a valid value for the type, false otherwise.
+   */
+  static bool segment_matches(ParamType type, std::string_view segment)
+  {
+    if (segment.empty())
+    {
+      return false;
+    }
+    if (type == ParamType::String)
+    {
+      return true;
+    }
+
+    std::size_t start = segment[0] == '-' ? 1 : 0;
+    if (start == segment.size())
+    {
+      return false;
+    }
+    for (std::size_t i = start; i < segment.size(); ++i)
+    {
+      if (segment[i] < '0' || segment[i] > '9')
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Strip the query string, fragment and trailing slash from a request target.
+   * @param target Request target.
+   * @return Path component of the target.
+   */
+  static std::string_view normalize_path(std::string_view target)
+  {
+    std::size_t end = target.find_first_of("?#");
+    if (end != std::string_view::npos)
+    {
+      target = target.substr(0, end);
+    }
+    if (target.size() > 1 && target.back() == '/')
+    {
+      target.remove_suffix(1);
+    }
+    if (target.empty())
+    {
+      return "/";
+    }
+    return target;
+  }
+
+  /**
+   * Insert a static path into the tree, splitting existing nodes on the longest
+   * common prefix.
+   *
+   * @param node Node to insert below.
+   * @param path Static path to insert.
+   * @return Node at the end of the inserted path.
+   */
+  Router::Node *Router::insert_static(Node *node, std::string_view path)
+  {
+    while (!path.empty())
+    {
+      std::size_t index = node->indices.find(path[0]);
+      if (index == std::string::npos)
+      {
+        auto child = std::make_unique<Node>();
+        child->prefix = std::string(path);
+        node->indices.push_back(path[0]);
+        node->children.push_back(std::move(child));
+        return node->children.back().get();
+      }
+
+      Node *child = node->children[index].get();
+      std::size_t common = 0;
+      while (common < child->prefix.size() && common < path.size() && child->prefix[common] == path[common])
+      {
+        ++common;
+      }
+
+      if (common < child->prefix.size())
+      {
+        auto split = std::make_unique<Node>();
+        split->prefix = child->prefix.substr(0, common);
+        split->indices.push_back(child->prefix[common]);
+        child->prefix.erase(0, common);
+        split->children.push_back(std::move(node->children[index]));
+        node->children[index] = std::move(split);
+        child = node->children[index].get();
+      }
+
+      node = child;
+      path.remove_prefix(common);
+    }
+    return node;
+  }
+
+  /**
+   * Insert a parameter segment such as "id:int" below a node.
+   * @param node Node to insert below.
+   * @param segment Parameter declaration without braces.
+   * @return Parameter node.
+   */
+  Router::Node *Router::insert_param(Node *node, std::string_view segment)
+  {
+    std::string_view name = segment;
+    ParamType type = ParamType::String;
+
+    std::size_t colon = segment.find(':');
+    if (colon != std::string_view::npos)
+    {
+      name = segment.substr(0, colon);
+      std::string_view type_name = segment.substr(colon + 1);
+      if (type_name == "int")
+      {
+        type = ParamType::Int;
+      }
+      else if (type_name != "string")
+      {
+        throw std::runtime_error("Unknown path parameter type: " + std::string(type_name));
+      }
+    }
+
+    if (name.empty())
+    {
+      throw std::runtime_error("Empty path parameter name");
+    }
+
+    if (!node->param_child)
+    {
+      node->param_child = std::make_unique<Node>();
+      node->param_name = std::string(name);
+      node->param_type = type;
+    }
+    else if (node->param_name != name || node->param_type != type)
+    {
+      throw std::runtime_error("Conflicting path parameter: " + std::string(name) + " (already registered as " + node->param_name + ")");
+    }
+    return node->param_child.get();
+  }
+
+  /**
+   * Register a handler for a method and path pattern. Patterns may contain
+   * parameter segments such as "/text/{text_object_id:int}".
+   *
+   * @param pattern Path pattern to register.
+   * @param method HTTP method to register.
+   * @param handler Handler to call for matching requests.
+   */
+  void Router::add_route(std::string_view pattern, http::verb method, RequestHandler *handler)
+  {
+    std::size_t method_index = static_cast<std::size_t>(method);
+    if (method_index >= VERB_COUNT || method == http::verb::unknown)
+    {
+      throw std::runtime_error("Invalid method for route: " + std::string(pattern));
+    }
+
+    std::string_view path = normalize_path(pattern);
+    Node *node = &root_;
+
+    while (!path.empty())
+    {
+      std::size_t open = path.find('{');
+      if (open == std::string_view::npos)
+      {
+        node = insert_static(node, path);
+        break;
+      }
+
+      std::size_t close = path.find('}', open);
+      if (close == std::string_view::npos || open == 0 || path[open - 1] != '/' ||
+          (close + 1 < path.size() && path[close + 1] != '/'))
+      {
+        throw std::runtime_error("Malformed path parameter in route: " + std::string(pattern));
+      }
+
+      node = insert_static(node, path.substr(0, open));
+      node = insert_param(node, path.substr(open + 1, close - open - 1));
+      path.remove_prefix(close + 1);
+    }
+
+    if (node->handlers[method_index])
+    {
+      throw std::runtime_error("Duplicate route: " + std::string(http::to_string(method)) + " " + std::string(pattern));
+    }
+
+    node->handlers[method_index] = handler;
+    node->has_handlers = true;
+    if (!node->allowed_methods.empty())
+    {
+      node->allowed_methods += ", ";
+    }
+    node->allowed_methods += std::string(http::to_string(method));
+  }
+
+  /**
+   * Register a request handler for its endpoint and every method it supports.
+   * @param handler Handler to register.
+   */
+  void Router::add_handler(RequestHandler &handler)
+  {
+    std::string endpoint = handler.get_endpoint();
+    for (http::verb method : handler.get_methods())
+    {
+      add_route(endpoint, method, &handler);
+    }
+  }
+
+  /**
+   * Find the node matching a path. Static children take priority over
+   * parameter segments, falling back to the parameter if the static branch fails.
+   *
+   * @param node Node to match below.
+   * @param path Remaining path to match.
+   * @param params Parameters captured so far.
+   * @return Matching node if one exists, nullptr otherwise.
+   */
+  const Router::Node *Router::find(const Node &node, std::string_view path, RouteParams &params) const
+  {
+    if (path.empty())
+    {
+      return node.has_handlers ? &node : nullptr;
+    }
+
+    std::size_t index = node.indices.find(path[0]);
+    if (index != std::string::npos)
+    {
+      const Node &child = *node.children[index];
+      if (path.compare(0, child.prefix.size(), child.prefix) == 0)
+      {
+        if (const Node *found = find(child, path.substr(child.prefix.size()), params))
+        {
+          return found;
+        }
+      }
+    }
+
+    if (node.param_child)
+    {
+      std::string_view segment = path.substr(0, path.find('/'));
+      if (segment_matches(node.param_type, segment) && params.push(node.param_name, segment))
+      {
+        if (const Node *found = find(*node.param_child, path.substr(segment.size()), params))
+        {
+          return found;
+        }
+        params.pop();
+      }
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * Match a request against the registered routes.
+   * @param method HTTP method of the request.
+   * @param target Request target, including any query string.
+   * @return Match result with the handler and captured path parameters.
+   */
+  RouteMatch Router::match(http::verb method, std::string_view target) const
+  {
+    RouteMatch result;
+    const Node *node = find(root_, normalize_path(target), result.params);
+    if (!node)
+    {
+      result.params = {};
+      return result;
+    }
+
+    std::size_t method_index = static_cast<std::size_t>(method);
+    if (method_index >= VERB_COUNT || !node->handlers[method_index])
+    {
+      result.status = MatchStatus::MethodNotAllowed;
+      result.allowed_methods = node->allowed_methods;
+      return result;
+    }
+
+    result.status = MatchStatus::Found;
+    result.handler = node->handlers[method_index];
+    return result;
+  }
+}
@@ -0,0 +1,107 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <boost/beast/http.hpp>
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http = boost::beast::http;
+
+class RequestHandler;
+
+namespace router
+{
+  const std::size_t MAX_PATH_PARAMS = 8;
+  const std::size_t VERB_COUNT = static_cast<std::size_t>(http::verb::unlink) + 1;
+
+  /**
+   * @brief Type constraint of a path parameter, e.g. "/text/{id:int}".
+   */
+  enum class ParamType
+  {
+    String,
+    Int
+  };
+
+  struct PathParam
+  {
+    std::string_view name;
+    std::string_view value;
+  };
+
+  /**
+   * @brief Fixed capacity set of path parameters captured while matching a route.
+   *
+   * Names point into the router and values point into the request target, so a
+   * RouteParams must not outlive either of them.
+   */
+  class RouteParams
+  {
+    std::array<PathParam, MAX_PATH_PARAMS> params_{};
+    std::size_t size_ = 0;
+
+  public:
+    bool push(std::string_view name, std::string_view value);
+    void pop();
+    std::size_t size() const;
+    std::optional<std::string_view> get(std::string_view name) const;
+    std::optional<int> get_int(std::string_view name) const;
+  };
+
+  enum class MatchStatus
+  {
+    Found,
+    NotFound,
+    MethodNotAllowed
+  };
+
+  struct RouteMatch
+  {
+    MatchStatus status = MatchStatus::NotFound;
+    RequestHandler *handler = nullptr;
+    RouteParams params;
+    std::string_view allowed_methods;
+  };
+
+  /**
+   * @brief Radix tree router mapping (method, path) pairs to request handlers.
+   *
+   * Routes are compiled once at startup. Matching walks the request path a single
+   * time and performs no allocations.
+   */
+  class Router
+  {
+    struct Node
+    {
+      std::string prefix;
+      std::string indices;
+      std::vector<std::unique_ptr<Node>> children;
+
+      std::unique_ptr<Node> param_child;
+      std::string param_name;
+      ParamType param_type = ParamType::String;
+
+      std::array<RequestHandler *, VERB_COUNT> handlers{};
+      std::string allowed_methods;
+      bool has_handlers = false;
+    };
+
+    Node root_;
+
+    Node *insert_static(Node *node, std::string_view path);
+    Node *insert_param(Node *node, std::string_view segment);
+    const Node *find(const Node &node, std::string_view path, RouteParams &params) const;
+
+  public:
+    void add_route(std::string_view pattern, http::verb method, RequestHandler *handler);
+    void add_handler(RequestHandler &handler);
+    RouteMatch match(http::verb method, std::string_view target) const;
+  };
+}
+
+#endif
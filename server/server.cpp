@@ -44,15 +44,45 @@ namespace server
   }
 
   /**
-   * Handle an HTTP request. This function iterates over all loaded request handlers and
-   * calls their handle_request method if the request target starts with the handler's endpoint.
+   * Build the router from the loaded request handlers. Each handler is registered
+   * for its endpoint and the methods it declares.
    *
-   * @param req HTTP request to handle.
-   * @return HTTP response.
+   * @param handlers Loaded request handlers.
+   * @return Router dispatching to the handlers.
    */
-  http::response<http::string_body> handle_request(http::request<http::string_body> const & req, const std::string & ip_address)
+  router::Router build_router(const std::vector<std::unique_ptr<RequestHandler>> &handlers)
+  {
+    router::Router routes;
+    for (const auto &handler : handlers)
+    {
+      routes.add_handler(*handler);
+    }
+    return routes;
+  }
+
+  /**
+   * Get the router for the handlers in the working directory. Handlers are
+   * loaded and compiled into the router on first use.
+   *
+   * @return Router dispatching to the loaded handlers.
+   */
+  const router::Router &get_router()
   {
     static std::vector<std::unique_ptr<RequestHandler>> handlers = load_handlers(".");
+    static const router::Router routes = build_router(handlers);
+    return routes;
+  }
+
+  /**
+   * Create a response for a request that is not dispatched to a handler:
+   * a CORS preflight, an unknown path (404) or an unsupported method (405).
+   *
+   * @param req HTTP request to respond to.
+   * @param match Router match for the request.
+   * @return HTTP response.
+   */
+  http::response<http::string_body> make_unrouted_response(http::request<http::string_body> const &req, const router::RouteMatch &match)
+  {
     http::response<http::string_body> res;
     std::string allowed_methods = "DELETE, GET, OPTIONS, PATCH, POST, PUT";
 
@@ -68,24 +98,112 @@ namespace server
       return res;
     }
 
-    for (const auto &handler : handlers)
+    if (match.status == router::MatchStatus::MethodNotAllowed)
     {
-      if (req.target().starts_with(handler->get_endpoint()))
-      {
-        res = handler->handle_request(req, ip_address);
-        break;
-      }
+      res = {http::status::method_not_allowed, req.version()};
+      res.set(http::field::allow, beast::string_view(match.allowed_methods.data(), match.allowed_methods.size()));
+      return res;
+    }
+
+    std::cerr << "No handler found for endpoint: " << req.target() << std::endl;
+    res = {http::status::not_found, req.version()};
+    return res;
+  }
+
+  /**
+   * Match a request against the router.
+   * @param req HTTP request to match.
+   * @return Router match for the request.
+   */
+  router::RouteMatch match_request(http::request<http::string_body> const &req)
+  {
+    std::string_view target(req.target().data(), req.target().size());
+    return get_router().match(req.method(), target);
+  }
+
+  /**
+   * Set the headers shared by every response.
+   * @param res Response to finalize.
+   * @param req Request the response is for.
+   */
+  void finalize_response(http::response<http::string_body> &res, http::request<http::string_body> const &req)
+  {
+    res.set(http::field::access_control_allow_origin, READER_ALLOWED_ORIGIN);
+    res.keep_alive(req.keep_alive());
+  }
+
+  /**
+   * Handle an HTTP request synchronously on the calling thread. The request is
+   * matched against the router by method and path, so unknown paths (404) and
+   * unsupported methods (405) are answered without calling into any handler.
+   *
+   * @param req HTTP request to handle.
+   * @return HTTP response.
+   */
+  http::response<http::string_body> handle_request(http::request<http::string_body> const & req, const std::string & ip_address)
+  {
+    router::RouteMatch match = match_request(req);
+    http::response<http::string_body> res;
+
+    if (req.method() == http::verb::options || match.status != router::MatchStatus::Found)
+    {
+      res = make_unrouted_response(req, match);
+    }
+    else
+    {
+      res = match.handler->handle_route(req, ip_address, match.params);
     }
 
-    if (res.result() == http::status::unknown)
+    finalize_response(res, req);
+    return res;
+  }
+
+  /**
+   * Handle an HTTP request asynchronously. Routing happens on the calling I/O
+   * thread; the matched handler's asynchronous entry point decides where its
+   * work runs.
+   *
+   * @param req HTTP request to handle. Must outlive the returned awaitable.
+   * @param ip_address IP address of the client.
+   * @return HTTP response.
+   */
+  net::awaitable<http::response<http::string_body>> handle_request_async(http::request<http::string_body> const &req, std::string ip_address)
+  {
+    router::RouteMatch match = match_request(req);
+    http::response<http::string_body> res;
+
+    if (req.method() == http::verb::options || match.status != router::MatchStatus::Found)
     {
-      std::cerr << "No handler found for endpoint: " << req.target() << std::endl;
-      res = {http::status::not_found, req.version()};
+      res = make_unrouted_response(req, match);
+    }
+    else
+    {
+      try
+      {
+        res = co_await match.handler->handle_route_async(req, ip_address, match.params);
+      }
+      catch (const executor::QueueFull &)
+      {
+        res = make_overloaded_response(req);
+      }
     }
 
-    // Set CORS headers
+    finalize_response(res, req);
+    co_return res;
+  }
+
+  /**
+   * Create a response for when the blocking executor queue is full.
+   * @param req Request that could not be queued.
+   * @return 503 response asking the client to retry.
+   */
+  http::response<http::string_body> make_overloaded_response(http::request<http::string_body> const &req)
+  {
+    http::response<http::string_body> res{http::status::service_unavailable, req.version()};
     res.set(http::field::access_control_allow_origin, READER_ALLOWED_ORIGIN);
+    res.set(http::field::retry_after, "1");
     res.keep_alive(req.keep_alive());
+    res.prepare_payload();
     return res;
   }
 
@@ -156,8 +274,17 @@ namespace server
 
                        boost::asio::ip::address ip_address = socket_.remote_endpoint().address();
                        std::string ip_str = ip_address.to_string();
-                       http::response<http::string_body> res = handle_request(req_, ip_str);
-                       do_write(std::move(res));
+
+                       net::co_spawn(socket_.get_executor(), handle_request_async(req_, std::move(ip_str)),
+                                     [this, self](std::exception_ptr e, http::response<http::string_body> res)
+                                     {
+                                       if (e)
+                                       {
+                                         res = {http::status::internal_server_error, req_.version()};
+                                         finalize_response(res, req_);
+                                       }
+                                       do_write(std::move(res));
+                                     });
                      });
   }
 
@@ -196,8 +323,62 @@ namespace server
       do_read(); });
   }
 
-  Listener::Listener(net::io_context &ioc, tcp::endpoint endpoint) : ioc_(ioc),
-                                                                     acceptor_(net::make_strand(ioc))
+  /**
+   * List the CPU cores the process may run on. In a container or cgroup this is
+   * usually a subset of the cores hardware_concurrency() reports.
+   * @return Allowed cores in ascending order, never empty.
+   */
+  std::vector<int> allowed_cores()
+  {
+    std::vector<int> cores;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) == 0)
+    {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      {
+        if (CPU_ISSET(cpu, &cpuset))
+        {
+          cores.push_back(cpu);
+        }
+      }
+    }
+    if (cores.empty())
+    {
+      for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+      {
+        cores.push_back(static_cast<int>(cpu));
+      }
+    }
+    return cores;
+  }
+
+  /**
+   * Pin the calling thread to the core of a shard. Shard i runs on the i-th
+   * core the process is allowed to use.
+   * @param shard Index of the shard.
+   * @return true if the thread was pinned, false otherwise.
+   */
+  bool pin_thread_to_core(std::size_t shard)
+  {
+    static const std::vector<int> cores = allowed_cores();
+    int core = cores[shard % cores.size()];
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (rc != 0)
+    {
+      std::cerr << "Failed to pin thread to core " << core << ": " << std::strerror(rc) << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  Listener::Listener(net::io_context &ioc, tcp::endpoint endpoint, bool reuse_port) : ioc_(ioc),
+                                                                                      acceptor_(net::make_strand(ioc))
   {
     beast::error_code ec;
 
@@ -236,6 +417,17 @@ namespace server
       return;
     }
 
+    if (reuse_port)
+    {
+      using reuse_port_option = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+      acceptor_.set_option(reuse_port_option(true), ec);
+      if (ec)
+      {
+        std::cerr << "Set reuse port error: " << ec.message() << std::endl;
+        return;
+      }
+    }
+
     acceptor_.set_option(tcp::no_delay(true), ec);
     if (ec)
     {
@@ -7,10 +7,15 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/awaitable.hpp>
 #include <boost/config.hpp>
 
 #include <filesystem>
+#include <cstring>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
 #include <vector>
 #include <iostream>
 #include <memory>
@@ -21,7 +26,9 @@
 
 #include "config.h"
 #include "request/request_handler.hpp"
+#include "request/router.hpp"
 #include "db/postgres.hpp"
+#include "executor.hpp"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -34,7 +41,16 @@ namespace server
   const int WRITE_TIMEOUT_SECONDS = 30;
   const int HANDSHAKE_TIMEOUT_SECONDS = 30;
   std::vector<std::unique_ptr<RequestHandler>> load_handlers(const std::string &directory);
+  router::Router build_router(const std::vector<std::unique_ptr<RequestHandler>> &handlers);
+  const router::Router &get_router();
+  router::RouteMatch match_request(http::request<http::string_body> const &req);
+  http::response<http::string_body> make_unrouted_response(http::request<http::string_body> const &req, const router::RouteMatch &match);
+  void finalize_response(http::response<http::string_body> &res, http::request<http::string_body> const &req);
   http::response<http::string_body> handle_request(http::request<http::string_body> const &req, const std::string &ip_address);
+  net::awaitable<http::response<http::string_body>> handle_request_async(http::request<http::string_body> const &req, std::string ip_address);
+  http::response<http::string_body> make_overloaded_response(http::request<http::string_body> const &req);
+  std::vector<int> allowed_cores();
+  bool pin_thread_to_core(std::size_t shard);
 
   class Session : public std::enable_shared_from_this<Session>
   {
@@ -53,13 +69,19 @@ namespace server
     void do_write(http::response<http::string_body> res);
   };
 
+  /**
+   * @brief Acceptor bound to a single io_context. In sharded mode every core
+   * runs its own io_context with its own SO_REUSEPORT listener, so the kernel
+   * spreads connections across cores and each session stays on the core that
+   * accepted it.
+   */
   class Listener : public std::enable_shared_from_this<Listener>
   {
     net::io_context &ioc_;
     tcp::acceptor acceptor_;
 
   public:
-    Listener(net::io_context &ioc, tcp::endpoint endpoint);
+    Listener(net::io_context &ioc, tcp::endpoint endpoint, bool reuse_port = false);
     void do_accept();
   };
 }